@@ -0,0 +1,122 @@
+/*
+ * buffer.c - a growable byte queue used for non-blocking I/O
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * A buffer keeps the bytes which could not be written to a non-blocking
+ * socket yet. Bytes are appended at the tail and consumed from the head.
+ * When the buffer drains completely the offsets are rewound, so a buffer
+ * which is written out as fast as it is filled never grows.
+ */
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include "buffer.h"
+
+/*
+ * buffer_init - initialize an empty buffer without any storage
+ */
+void buffer_init(Buffer *b) {
+    b -> data = NULL;
+    b -> off = 0;
+    b -> len = 0;
+    b -> cap = 0;
+}
+
+/*
+ * buffer_free - release the storage of the buffer and empty it
+ */
+void buffer_free(Buffer *b) {
+    free(b -> data);
+    buffer_init(b);
+}
+
+/*
+ * buffer_reserve - make room for at least n more bytes at the tail.
+ *      Returns 0 on success, -1 on malloc failure.
+ */
+int buffer_reserve(Buffer *b, size_t n) {
+    if (b -> off == b -> len) {
+        /* nothing pending, rewind */
+        b -> off = b -> len = 0;
+    }
+    if (b -> len + n <= b -> cap) {
+        return 0;
+    }
+    if (b -> off > 0) {
+        /* reclaim the consumed bytes at the head first */
+        memmove(b -> data, b -> data + b -> off, b -> len - b -> off);
+        b -> len -= b -> off;
+        b -> off = 0;
+        if (b -> len + n <= b -> cap) {
+            return 0;
+        }
+    }
+    size_t cap = b -> cap ? b -> cap : 256;
+    while (cap < b -> len + n) {
+        cap *= 2;
+    }
+    char *data;
+    if ((data = (char *) realloc(b -> data, cap)) == NULL) {
+        return -1;
+    }
+    b -> data = data;
+    b -> cap = cap;
+    return 0;
+}
+
+/*
+ * buffer_append - append n bytes to the tail of the buffer.
+ *      Returns 0 on success, -1 on malloc failure.
+ */
+int buffer_append(Buffer *b, const void *data, size_t n) {
+    if (buffer_reserve(b, n) < 0) {
+        return -1;
+    }
+    memcpy(b -> data + b -> len, data, n);
+    b -> len += n;
+    return 0;
+}
+
+/*
+ * buffer_printf - append formatted text to the tail of the buffer.
+ *      Returns 0 on success, -1 on failure.
+ */
+int buffer_printf(Buffer *b, const char *fmt, ...) {
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    /* one more byte for the terminating '\0' written by vsnprintf */
+    if (n < 0 || buffer_reserve(b, n + 1) < 0) {
+        return -1;
+    }
+    va_start(ap, fmt);
+    vsnprintf(b -> data + b -> len, n + 1, fmt, ap);
+    va_end(ap);
+    b -> len += n;
+    return 0;
+}
+
+/*
+ * buffer_consume - drop n bytes from the head of the buffer
+ */
+void buffer_consume(Buffer *b, size_t n) {
+    b -> off += n;
+    if (b -> off >= b -> len) {
+        b -> off = b -> len = 0;
+    }
+}
+
+/*
+ * buffer_trim - drop the last n pending bytes of the buffer
+ */
+void buffer_trim(Buffer *b, size_t n) {
+    b -> len -= n;
+    if (b -> off >= b -> len) {
+        b -> off = b -> len = 0;
+    }
+}
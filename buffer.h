@@ -0,0 +1,33 @@
+/*
+ * buffer.h - a growable byte queue used for non-blocking I/O
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ */
+#ifndef __BUFFER_H__
+#define __BUFFER_H__
+
+#include <stdlib.h>
+
+/* a byte queue, bytes in [off, len) are pending */
+typedef struct buffer_type {
+    char *data;     /* the backing storage */
+    size_t off;     /* offset of the first pending byte */
+    size_t len;     /* offset one past the last pending byte */
+    size_t cap;     /* allocated size of data */
+} Buffer;
+
+void buffer_init(Buffer *b);
+void buffer_free(Buffer *b);
+int buffer_reserve(Buffer *b, size_t n);
+int buffer_append(Buffer *b, const void *data, size_t n);
+int buffer_printf(Buffer *b, const char *fmt, ...);
+void buffer_consume(Buffer *b, size_t n);
+void buffer_trim(Buffer *b, size_t n);
+
+/* the number of bytes still pending in the buffer */
+#define buffer_pending(b) ((b) -> len - (b) -> off)
+/* the first pending byte */
+#define buffer_head(b) ((b) -> data + (b) -> off)
+
+#endif /* __BUFFER_H__ */
@@ -0,0 +1,251 @@
+#!/usr/bin/env python3
+
+# cache-bench.py - This runs the proxy against a local origin on the
+#                  workloads the cache was tuned with, and prints the
+#                  hit ratios and memory figures they give:
+#
+#   scan    - a 480 KB working set between 1.2 MB scans of objects seen
+#             once, under every policy, with and without TinyLFU. With
+#             the filter, the scans must be rejected and the victims they
+#             would have evicted put back, so the working set still hits.
+#   cost    - 30 slow 4 KB objects (50 ms origin) among 20 KB scans from
+#             a fast origin, lru against gdsf, without the filter.
+#   density - 6000 small objects into a 2-shard cache: the objects it
+#             holds and the slab pages they take.
+#   fill    - readers of an object whose origin breaks off mid-body: all
+#             of them must get a short body, the fill must be counted as
+#             failed, and the object must not be cached.
+#
+# usage: cache-bench.py [scan|cost|density|fill ...]
+#
+# Run it from the proxy directory after make. With no argument every
+# workload runs. It exits with 1 if a check fails.
+#
+import http.client
+import http.server
+import os
+import socket
+import socketserver
+import subprocess
+import sys
+import threading
+import time
+
+POLICIES = ["lru", "clock", "s3fifo", "arc", "gdsf"]
+SLOW_DELAY = 0.05               # seconds a slow object takes the origin
+CUT_STEPS = 10                  # pieces a broken object is sent in
+
+counts = {}                     # requests the origin got, by path
+counts_lock = threading.Lock()
+failures = []
+
+
+def body(n):
+    return bytes((i * 7) % 251 for i in range(n))
+
+
+class Origin(http.server.BaseHTTPRequestHandler):
+    # /len/N/name, /slow/N/name and /cut/N/name: N bytes, N bytes after
+    # SLOW_DELAY, and half of N bytes dripped before the connection drops
+    protocol_version = "HTTP/1.1"
+
+    def log_message(self, *args):
+        pass
+
+    def do_GET(self):
+        with counts_lock:
+            counts[self.path] = counts.get(self.path, 0) + 1
+        kind, n = self.path.split("/")[1], int(self.path.split("/")[2])
+        if kind == "slow":
+            time.sleep(SLOW_DELAY)
+        self.send_response(200)
+        self.send_header("Content-Length", str(n))
+        self.end_headers()
+        self.wfile.flush()
+        b = body(n)
+        if kind != "cut":
+            self.wfile.write(b)
+            return
+        piece = n // 2 // CUT_STEPS
+        for i in range(CUT_STEPS):
+            self.wfile.write(b[i * piece:(i + 1) * piece])
+            self.wfile.flush()
+            time.sleep(0.05)
+        self.close_connection = True
+        self.connection.shutdown(socket.SHUT_RDWR)
+
+
+class OriginServer(socketserver.ThreadingMixIn, http.server.HTTPServer):
+    daemon_threads = True
+
+
+def free_port():
+    s = socket.socket()
+    s.bind(("127.0.0.1", 0))
+    port = s.getsockname()[1]
+    s.close()
+    return port
+
+
+def origin_count(path):
+    with counts_lock:
+        return counts.get(path, 0)
+
+
+class Proxy:
+    # a proxy started with args for one run, and a client connection
+    # fetching through it from the origin on origin_port
+
+    def __init__(self, args, origin_port):
+        self.port = free_port()
+        self.origin_port = origin_port
+        self.proc = subprocess.Popen(["./proxy"] + args + [str(self.port)],
+                                     stdout=subprocess.DEVNULL,
+                                     stderr=subprocess.DEVNULL)
+        for _ in range(50):
+            try:
+                socket.create_connection(("127.0.0.1", self.port)).close()
+                break
+            except OSError:
+                if self.proc.poll() is not None:
+                    sys.exit("./proxy %s did not start" % " ".join(args))
+                time.sleep(0.1)
+        self.conn = http.client.HTTPConnection("127.0.0.1", self.port,
+                                               timeout=10)
+
+    def get(self, path):
+        self.conn.request("GET", "http://127.0.0.1:%d%s" %
+                          (self.origin_port, path))
+        return self.conn.getresponse().read()
+
+    def stats(self):
+        self.conn.request("GET", "/proxy-stats")
+        lines = self.conn.getresponse().read().decode().splitlines()
+        return dict(line.split(" ", 1) for line in lines)
+
+    def close(self):
+        self.conn.close()
+        self.proc.terminate()
+        self.proc.wait()
+
+
+def check(ok, what):
+    print("    %s: %s" % ("ok" if ok else "FAIL", what))
+    if not ok:
+        failures.append(what)
+
+
+def bench_scan(origin_port):
+    print("scan: 60 x 8 KB working set, 150 x 8 KB scans, 6 rounds, "
+          "1 shard")
+    for admission in ["none", "tinylfu"]:
+        for policy in POLICIES:
+            tag = "%s/%s" % (policy, admission)
+            p = Proxy(["-s", "1", "-p", policy, "-a", admission],
+                      origin_port)
+            for r in range(6):
+                for i in range(60):
+                    p.get("/len/8000/hot%d_%s" % (i, tag))
+                for i in range(150):
+                    p.get("/len/8000/scan%d_%d_%s" % (r, i, tag))
+            s = p.stats()
+            p.close()
+            misses = sum(origin_count("/len/8000/hot%d_%s" % (i, tag))
+                         for i in range(60))
+            print("  %-16s hit ratio %s, working set hits %3d/300, "
+                  "rejected %s" % (tag, s["cache_hit_ratio"],
+                                   360 - misses, s.get("cache_rejected", "-")))
+            if admission == "tinylfu":
+                check(int(s["cache_rejected"]) > 0 and misses == 60,
+                      "%s rejects the scans and restores their victims"
+                      % tag)
+
+
+def bench_cost(origin_port):
+    print("cost: 30 x 4 KB slow objects, 120 x 20 KB fast ones, 3 rounds, "
+          "1 shard, no admission")
+    for policy in ["lru", "gdsf"]:
+        p = Proxy(["-s", "1", "-p", policy, "-a", "none"], origin_port)
+        for r in range(3):
+            for i in range(30):
+                p.get("/slow/4000/s%d_%s" % (i, policy))
+            for i in range(120):
+                p.get("/len/20000/f%d_%d_%s" % (r, i, policy))
+        s = p.stats()
+        p.close()
+        misses = sum(origin_count("/slow/4000/s%d_%s" % (i, policy))
+                     for i in range(30))
+        print("  %-16s hit ratio %s, slow hits %2d/60" %
+              (policy, s["cache_hit_ratio"], 90 - misses))
+
+
+def bench_density(origin_port):
+    print("density: 6000 objects of 50 to 146 bytes, 2 shards, "
+          "no admission")
+    p = Proxy(["-s", "2", "-a", "none"], origin_port)
+    for i in range(6000):
+        p.get("/len/%d/d%d" % (50 + i % 97, i))
+    s = p.stats()
+    p.close()
+    print("  objects %s, slab pages %s, logical bytes %s, budget bytes %s"
+          % (s["cache_objects"], s["slab_pages"], s["cache_logical_bytes"],
+             s["cache_budget_bytes"]))
+
+
+def bench_fill(origin_port):
+    print("fill: 4 readers of a 2 MB object cut off halfway")
+    path = "/cut/2000000/f"
+    p = Proxy(["-c", "64m", "-o", "4m"], origin_port)
+    got = [None] * 4
+
+    def read(i):
+        s = socket.create_connection(("127.0.0.1", p.port))
+        s.sendall(b"GET http://127.0.0.1:%d%s HTTP/1.0\r\n\r\n" %
+                  (origin_port, path.encode()))
+        data = b""
+        while True:
+            d = s.recv(65536)
+            if not d:
+                break
+            data += d
+        s.close()
+        got[i] = len(data.split(b"\r\n\r\n", 1)[-1])
+
+    readers = [threading.Thread(target=read, args=(i,)) for i in range(4)]
+    readers[0].start()
+    time.sleep(0.2)
+    for t in readers[1:]:
+        t.start()
+    for t in readers:
+        t.join()
+    bodies = list(got)
+    s = p.stats()
+    # fetched again, it comes from the origin once more
+    read(0)
+    p.close()
+    print("  bodies %s of 2000000, fills %s, readers %s, failed %s" %
+          (bodies, s["cache_fills"], s["cache_fill_readers"],
+           s["cache_fills_failed"]))
+    check(all(n < 2000000 for n in bodies), "every reader is cut short")
+    check(s["cache_fills"] == "1" and s["cache_fills_failed"] == "1",
+          "the readers share one fill, counted failed")
+    check(origin_count(path) == 2, "the broken object is not cached")
+
+
+BENCHES = {"scan": bench_scan, "cost": bench_cost,
+           "density": bench_density, "fill": bench_fill}
+
+if not os.access("./proxy", os.X_OK):
+    sys.exit("no ./proxy, run make first")
+names = sys.argv[1:] or ["scan", "cost", "density", "fill"]
+for name in names:
+    if name not in BENCHES:
+        sys.exit("usage: %s [scan|cost|density|fill ...]" % sys.argv[0])
+origin_port = free_port()
+origin = OriginServer(("127.0.0.1", origin_port), Origin)
+threading.Thread(target=origin.serve_forever, daemon=True).start()
+for name in names:
+    BENCHES[name](origin_port)
+if failures:
+    print("%d check(s) failed" % len(failures))
+    sys.exit(1)
@@ -1,178 +1,1965 @@
-/*
- * cache.c - the proxy cache implementation
- *
- * Author: Tian Xin
- * Andrew ID: txin
- *
- * This implementation of cache uses a relaxed LRU eviction policy.
- * It utilizes the structure of linked list and in each of the list node,
- * there are information about the cached web objects. Also, inside each
- * node, the timestamp of its last access is stored. So when eviction has
- * to happen, the oldest object with the smallest timestamp is deleted.
- *
- * Reader - writer lock is implemented in this cache to support concurrency.
- * There can be multiple readers reading simultaneously and there can be only
- * one client writing or updating the structure of the linkedlist at a time.
- * The implementation is in favor of the readers and starves the writers.
- */
-#include "cache.h"
-#include "csapp.h"
-#include "proxylib.h"
-
-CacheNode *cache_head = NULL;   /* the cache linked list head */
-size_t cache_size = 0;          /* the current cache size */
-sem_t reader_count_mutex;       /* the reader_count lock */
-sem_t writer_mutex;             /* the writer semaphore */
-int reader_count = 0;           /* the current reader count */
-
-/*
- * init_cache - initialize cache operations 
- */
-void init_cache() {
-    /* set reader_count_mutex = 1 */
-    V(&reader_count_mutex);
-    /* set writer_mutex = 1 */
-    V(&writer_mutex);
-}
-/*
- * find_cache_node - 
- *      a helper to find the cache object node
- *      inside the cache linked list with absolute_uri
- */
-CacheNode *find_cache_node(char *absolute_uri) {
-    CacheNode *p = cache_head;
-    while (p) {
-        if (!strncmp(absolute_uri, p -> absolute_uri, MAXLINE)) {
-            return p;
-        }
-        p = p -> next;
-    }
-    return NULL;
-}
-
-/*
- * delete_cache_node -
- *      a helper to delete the cache object node from the cache linked list
- */
-void delete_cache_node(CacheNode *cache_node) {
-    if (cache_node == cache_head) {
-        cache_head = cache_head -> next;
-    }
-    else {
-        cache_node -> prev -> next = cache_node -> next;
-    }
-    if (cache_node -> next) {
-        cache_node -> next -> prev = cache_node -> prev;
-    }
-    free(cache_node -> absolute_uri);
-    free(cache_node -> content);
-    free(cache_node);
-}
-
-/*
- * evict_cache - cache evict method
- *      Delete the oldest cache object node from the cache.
- */
-void evict_cache() {
-    CacheNode *p, *to_evict = cache_head;
-    /* find the oldest cache object node */
-    for (p = cache_head; p; p = p -> next) {
-        /* Because the timestamp is measured in seconds, there might be
-         * many nodes with the same timestamps. We want to evict the oldest
-         * object, and because when putting into cache we put the new cache
-         * object node in the head of the linked list, the rightmost node with 
-         * the same timestamp value is the oldest one */
-        if (p -> timestamp <= to_evict -> timestamp) {
-            to_evict = p;
-        }
-    }
-    /* log to console about eviction */
-    printf("Cache evict, timestamp:%lu\n", 
-            (unsigned long) to_evict -> timestamp);
-    /* deduct the current cache size */
-    /* only writer can do evictions, and only one writer can write */
-    /* so no need to lock the cache_size variable */
-    cache_size -= to_evict -> size;
-    /* delete the cache object node from the linked list */
-    delete_cache_node(to_evict);
-}
-
-/*
- * get_cache - cache get method
- *      Read the cache object with the provided absolute_uri.
- */
-CacheNode *get_cache(char *absolute_uri) {
-    /* lock before updating reader_count */
-    P(&reader_count_mutex);
-    reader_count++;
-    if (reader_count == 1) { /* First reader in, lock writers */
-        P(&writer_mutex);
-    }
-    V(&reader_count_mutex);
-
-    CacheNode * ret = find_cache_node(absolute_uri);
-    if (ret) {
-        /* updating the last used timestamp on the cache object */
-        ret -> timestamp = time(NULL);
-        printf("Cache hit, timestamp: %lu\n", 
-                (unsigned long) ret -> timestamp);
-    }
-
-    /* lock before updating reader_count */
-    P(&reader_count_mutex);
-    reader_count--;
-    if (reader_count == 0) { /* Last reader out, unlock writers */
-        V(&writer_mutex);
-    }
-    V(&reader_count_mutex);
-    return ret;
-}
-
-/*
- * put_cache - cache put method
- *      Write a new cache object with the provided information.
- *      If the cache is full, evict cache nodes until the room is
- *      large enough to store the new cache object node.
- */
-void put_cache(char *absolute_uri, char *content, size_t size) {
-    /* acquire writer lock */
-    P(&writer_mutex);
-    cache_size += size;
-    /* if total size is larger than the max cache size,
-     * do cache evictions until this object can be stored in the cache */
-    while (cache_size > MAX_CACHE_SIZE) {
-        evict_cache();
-    }
-    CacheNode *cache_node;
-    if ((cache_node = find_cache_node(absolute_uri)) != NULL) {
-        /* if there exists an cache node with the same aboslute_uri 
-         * delete the old cache object and update it using the new one*/
-        delete_cache_node(cache_node);
-    }
-
-    /* inserting cache_node to head */
-    if ((cache_node = (CacheNode *) malloc(sizeof(CacheNode))) == NULL) {
-        /* if malloc for the cachenode fails, give up and return
-         * without exiting the program */
-        unix_error_non_exit("malloc for cache error");
-        V(&writer_mutex);
-        return;
-    }
-    /* set the time info */
-    cache_node -> timestamp = time(NULL);
-    /* cleaning up pointers */
-    cache_node -> next = cache_head;
-    cache_node -> prev = NULL;
-    if (cache_node -> next) {
-        cache_node -> next -> prev = cache_node;
-    }
-    cache_head = cache_node;
-
-    /* set the actual content and absolute_uri for the cache node */
-    cache_node -> absolute_uri = absolute_uri;
-    cache_node -> content = content;
-    cache_node -> size = size;
-    /* release writer lock */
-    V(&writer_mutex);
-}
-
+/*
+ * cache.c - the proxy cache implementation
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * The cache is split into shards by the hash of the key, each a complete
+ * cache of its own: a hash index, the queues of the eviction policy
+ * chosen at startup (see cache_lru.c and its siblings), a writer lock
+ * handed over in arrival order, and an equal part of the budget.
+ *
+ * Lookups never wait for a lock. Writers publish fully built nodes in
+ * the index, which is resized a few buckets per write, and retire what
+ * they unlink to the shard's epoch list (see epoch.c), so a node
+ * outlives the lookups which might still see it. Each node is one slab
+ * chunk (see slab.c) with its key and object, or the head of the object
+ * and its segments.
+ *
+ * Puts over the high watermark wake the reclaimer thread, which evicts
+ * down to the low watermark. An object may be published while it is
+ * still fetched (cache_fill_start), and its readers tail it as it fills.
+ * TinyLFU admission (see tinylfu.c) and the budget, which may change at
+ * run time or under memory pressure, decide what is kept.
+ */
+#include <limits.h>
+#include <sys/eventfd.h>
+#include "cache.h"
+#include "csapp.h"
+#include "slab.h"
+#include "proxylib.h"
+
+static CacheShard *shards = NULL;   /* the shards */
+static int shard_count = 0;         /* the number of shards */
+static CachePolicy *policy = NULL;  /* the eviction policy */
+static int admission = 0;           /* whether TinyLFU filters puts */
+static size_t capacity_total = 0;   /* the budget of the cache, guarded
+                                       by resize_lock */
+static size_t pressure_cap = SIZE_MAX;  /* the budget memory pressure
+                                           allows, by resize_lock too */
+static atomic_size_t object_limit = 0;  /* the largest object stored */
+static pthread_mutex_t resize_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t reclaim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reclaim_ready = PTHREAD_COND_INITIALIZER;
+static int reclaim_pending = 0;     /* a shard wants the reclaimer,
+                                       guarded by reclaim_lock */
+static _Atomic(CacheCounters *) counters = NULL;    /* every thread's */
+static __thread CacheCounters *self = NULL;         /* this thread's */
+/* guards the tails waiting on fills and the mailboxes */
+static pthread_mutex_t tail_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread CacheMailbox *tail_mailbox = NULL;  /* this worker's */
+/* the hashes of this thread's hits not told to the policy yet */
+static __thread uint64_t touches[CACHE_TOUCH_BATCH];
+static __thread int touch_count = 0;
+static atomic_ulong fills = 0;      /* objects published while fetched */
+static atomic_ulong fills_failed = 0;   /* of which broke off */
+
+/* the policies to choose from */
+static CachePolicy *policies[] = {
+    &lru_policy, &clock_policy, &s3fifo_policy, &arc_policy, &gdsf_policy,
+    NULL
+};
+
+/* function declarations */
+static CacheShard *cache_shard(uint64_t hash);
+static void cache_lock_init(CacheLock *lock);
+static void cache_lock(CacheLock *lock);
+static void cache_unlock(CacheLock *lock);
+static int cache_trylock(CacheLock *lock);
+static void cache_touch(uint64_t hash);
+static void touch_flush(void);
+static CacheCounters *cache_counters(void);
+static void evict_victim(CacheShard *shard, CacheNode *cache_node);
+static size_t shard_used(CacheShard *shard);
+static size_t shard_mark(CacheShard *shard, int percent);
+static void *reclaimer_thread(void *arg);
+static void reclaim_shard(CacheShard *shard);
+static void reclaim_wake(void);
+static size_t cache_floor(size_t max_object);
+static int cache_apply(void);
+static int cache_insert(CacheShard *shard, CacheNode *cache_node);
+static CacheNode *cache_node_new(const char *key, size_t key_size,
+        const char *head, size_t head_size, CacheFill *body);
+static size_t object_segments(size_t key_size, size_t size,
+        size_t body_size);
+static size_t object_charge(size_t key_size, size_t head_size, size_t size);
+static size_t node_chunk_size(size_t key_size, size_t kept, size_t count);
+static int fill_segment(CacheFill *fill);
+static void free_cache_node(void *arg);
+static void discard_cache_node(CacheNode *cache_node);
+static void free_cache_chunks(CacheNode *cache_node);
+static void cache_node_setup(CacheNode *cache_node, uint64_t hash,
+        size_t charge, unsigned long cost, size_t filled);
+static void tail_wake(CacheNode *cache_node);
+static uint64_t cache_hash(const char *key);
+static uint32_t cache_ghost_tag(uint64_t hash);
+static CacheTable *table_new(size_t size);
+static size_t table_bytes(size_t size);
+static CacheNode *index_lookup(CacheIndex *index, char *absolute_uri,
+        uint64_t hash);
+static void index_insert(CacheShard *shard, CacheNode *cache_node);
+static void index_remove(CacheShard *shard, CacheNode *cache_node);
+static CacheNode *index_find_hash(CacheIndex *index, uint64_t hash);
+static void index_resize(CacheShard *shard, size_t size);
+static void index_rehash_step(CacheShard *shard);
+
+/*
+ * init_cache - initialize cache operations with nshards shards sharing
+ *      capacity bytes, each of which must be able to hold an object of
+ *      max_object bytes, evicting with policy, admitting new objects
+ *      through TinyLFU if admit is set.
+ *      Returns 0 on success, -1 on failure.
+ */
+int init_cache(int nshards, size_t capacity, size_t max_object,
+        CachePolicy *cache_policy, int admit) {
+    pthread_t tid;
+    int i, j, rc;
+
+    if (nshards < 1) {
+        fprintf(stderr, "cache shard count must be at least 1\n");
+        return -1;
+    }
+    if (capacity == 0 || max_object == 0) {
+        fprintf(stderr, "cache and object sizes must be positive\n");
+        return -1;
+    }
+    if (max_object > CACHE_MAX_OBJECT) {
+        fprintf(stderr, "cache objects cannot be larger than %d bytes\n",
+                CACHE_MAX_OBJECT);
+        return -1;
+    }
+    /* the largest chunk is a segment, larger objects are split */
+    if (slab_init(CACHE_SEGMENT_SIZE) < 0) {
+        return -1;
+    }
+    if ((shards = (CacheShard *) aligned_alloc(64,
+                    nshards * sizeof(CacheShard))) == NULL) {
+        unix_error_non_exit("malloc for cache error");
+        return -1;
+    }
+    memset(shards, 0, nshards * sizeof(CacheShard));
+    shard_count = nshards;
+    policy = cache_policy;
+    admission = admit;
+    capacity_total = capacity;
+    atomic_init(&object_limit, max_object);
+    for (i = 0; i < nshards; i++) {
+        CacheShard *shard = &shards[i];
+        CacheTable *table;
+        size_t slots = 1;
+        cache_lock_init(&shard -> writer_lock);
+        shard -> capacity = capacity / nshards;
+        shard -> overhead = sizeof(CacheShard);
+        /* as many ghosts as small objects fit in the shard */
+        while (slots < shard -> capacity / CACHE_GHOST_OBJECT) {
+            slots <<= 1;
+        }
+        for (j = 0; j < policy -> ghosts; j++) {
+            if ((shard -> ghosts[j].slots = (CacheGhostSlot *) calloc(slots,
+                            sizeof(CacheGhostSlot))) == NULL) {
+                unix_error_non_exit("malloc for cache ghost error");
+                return -1;
+            }
+            shard -> ghosts[j].size = slots;
+            shard -> overhead += slots * sizeof(CacheGhostSlot);
+        }
+        if (admit) {
+            if (tinylfu_init(&shard -> sketch, slots) < 0) {
+                return -1;
+            }
+            shard -> overhead += tinylfu_bytes(&shard -> sketch);
+        }
+        /* the empty index */
+        if ((table = table_new(CACHE_INDEX_MIN_BUCKETS)) == NULL) {
+            return -1;
+        }
+        atomic_init(&shard -> index.tables[0], table);
+        atomic_init(&shard -> index.tables[1], NULL);
+        atomic_init(&shard -> index.moving, 0);
+        shard -> overhead += table_bytes(CACHE_INDEX_MIN_BUCKETS);
+    }
+    if (capacity < cache_floor(max_object)) {
+        fprintf(stderr, "%d cache shards of %zu bytes are too small for "
+                "objects of %zu bytes\n", nshards, capacity / nshards,
+                max_object);
+        return -1;
+    }
+    if ((rc = pthread_create(&tid, NULL, reclaimer_thread, NULL)) != 0) {
+        posix_error_non_exit(rc, "pthread_create error");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+/*
+ * cache_resize - make the budget of the cache capacity bytes and the
+ *      largest object it stores max_object bytes, 0 keeping either as
+ *      it is. Room added is used right away, a shard shrunk below what
+ *      it holds is brought down by the reclaimer.
+ *      Returns 0 on success, -1 if the shards would be too small for
+ *      the largest object, or it is larger than CACHE_MAX_OBJECT.
+ */
+int cache_resize(size_t capacity, size_t max_object) {
+    int wake;
+
+    pthread_mutex_lock(&resize_lock);
+    if (capacity == 0) {
+        capacity = capacity_total;
+    }
+    if (max_object == 0) {
+        max_object = cache_max_object();
+    }
+    if (max_object > CACHE_MAX_OBJECT ||
+            capacity < cache_floor(max_object)) {
+        pthread_mutex_unlock(&resize_lock);
+        return -1;
+    }
+    capacity_total = capacity;
+    /* the objects already stored are kept, even if larger */
+    atomic_store_explicit(&object_limit, max_object, memory_order_relaxed);
+    wake = cache_apply();
+    pthread_mutex_unlock(&resize_lock);
+    printf("Cache resized to %zu bytes, objects of up to %zu bytes\n",
+            capacity, max_object);
+    if (wake) {
+        reclaim_wake();
+    }
+    return 0;
+}
+
+/*
+ * cache_pressure - cap the budget of the cache at cap bytes while memory
+ *      is short, SIZE_MAX lifting the cap. The cap is raised to the
+ *      smallest budget which still holds the largest objects, and
+ *      lifted once it reaches the configured budget.
+ *      Returns the budget in effect.
+ */
+size_t cache_pressure(size_t cap) {
+    size_t floor, effective;
+    int wake;
+
+    pthread_mutex_lock(&resize_lock);
+    floor = cache_floor(cache_max_object());
+    if (cap < floor) {
+        cap = floor;
+    }
+    pressure_cap = cap < capacity_total ? cap : SIZE_MAX;
+    wake = cache_apply();
+    effective = pressure_cap < capacity_total ? pressure_cap : capacity_total;
+    pthread_mutex_unlock(&resize_lock);
+    if (wake) {
+        reclaim_wake();
+    }
+    return effective;
+}
+
+/*
+ * cache_capacity - the configured budget of the cache, in bytes
+ */
+size_t cache_capacity(void) {
+    size_t capacity;
+
+    pthread_mutex_lock(&resize_lock);
+    capacity = capacity_total;
+    pthread_mutex_unlock(&resize_lock);
+    return capacity;
+}
+
+/*
+ * cache_effective_capacity - the budget in effect, under the cap of
+ *      memory pressure, in bytes
+ */
+size_t cache_effective_capacity(void) {
+    size_t capacity;
+
+    pthread_mutex_lock(&resize_lock);
+    capacity = pressure_cap < capacity_total ? pressure_cap : capacity_total;
+    pthread_mutex_unlock(&resize_lock);
+    return capacity;
+}
+
+/*
+ * cache_max_object - the largest object the cache stores, in bytes
+ */
+size_t cache_max_object(void) {
+    return atomic_load_explicit(&object_limit, memory_order_relaxed);
+}
+
+/*
+ * cache_find_policy - the eviction policy called name.
+ *      Returns the policy, NULL if there is none.
+ */
+CachePolicy *cache_find_policy(const char *name) {
+    int i;
+
+    for (i = 0; policies[i]; i++) {
+        if (!strcmp(policies[i] -> name, name)) {
+            return policies[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * find_cache_node -
+ *      a helper to find the cache object node with absolute_uri,
+ *      whose hash is hash, through the hash index of its shard.
+ *      Called in an epoch read section or by the shard's writer.
+ */
+CacheNode *find_cache_node(CacheShard *shard, char *absolute_uri,
+        uint64_t hash) {
+    CacheIndex *index = &shard -> index;
+    CacheNode *p;
+    unsigned moving;
+    int tries;
+
+    /*
+     * A chain moved while it is walked can hide a node: the walk follows
+     * a moved node into its new chain, or finds its old bucket emptied
+     * after it saw no table 1, or table 1 gone after the move finished.
+     * Nothing the rehash does can hide a node while the count is even
+     * and unchanged, so a miss is only trusted then and searched again
+     * otherwise. A hit is always right, the nodes are never changed.
+     * The lookup does not wait for the writer though: should it be
+     * preempted amid a move, the miss is given up on after a few tries
+     * and taken as a miss, which costs a fetch at worst.
+     */
+    for (tries = 0; ; tries++) {
+        moving = atomic_load_explicit(&index -> moving, memory_order_acquire);
+        if ((p = index_lookup(index, absolute_uri, hash)) != NULL) {
+            return p;
+        }
+        atomic_thread_fence(memory_order_acquire);
+        if ((!(moving & 1) && moving == atomic_load_explicit(
+                        &index -> moving, memory_order_relaxed)) ||
+                tries == CACHE_LOOKUP_RETRIES) {
+            return NULL;
+        }
+    }
+}
+
+/*
+ * index_lookup - search both tables of index for the node with
+ *      absolute_uri, whose hash is hash.
+ *      Returns the node, or NULL if it was not seen.
+ */
+static CacheNode *index_lookup(CacheIndex *index, char *absolute_uri,
+        uint64_t hash) {
+    CacheTable *table;
+    CacheNode *p;
+    int t;
+
+    /* while resizing, a node is in either table */
+    for (t = 0; t < 2; t++) {
+        table = atomic_load_explicit(&index -> tables[t],
+                memory_order_acquire);
+        if (table == NULL) {
+            break;
+        }
+        p = atomic_load_explicit(&table -> buckets[hash & (table -> size - 1)],
+                memory_order_acquire);
+        for (; p; p = atomic_load_explicit(&p -> hash_next,
+                    memory_order_acquire)) {
+            if (p -> hash == hash &&
+                    !strncmp(absolute_uri, cache_node_key(p), MAXLINE)) {
+                return p;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * index_find_hash - search both tables of index for a node whose hash
+ *      is hash, either of them if two keys share it. Called by the
+ *      writer, so the index holds still.
+ *      Returns the node, or NULL if there is none.
+ */
+static CacheNode *index_find_hash(CacheIndex *index, uint64_t hash) {
+    CacheTable *table;
+    CacheNode *p;
+    int t;
+
+    for (t = 0; t < 2; t++) {
+        table = atomic_load_explicit(&index -> tables[t],
+                memory_order_relaxed);
+        if (table == NULL) {
+            break;
+        }
+        p = atomic_load_explicit(&table -> buckets[hash & (table -> size - 1)],
+                memory_order_relaxed);
+        for (; p; p = atomic_load_explicit(&p -> hash_next,
+                    memory_order_relaxed)) {
+            if (p -> hash == hash) {
+                return p;
+            }
+        }
+    }
+    return NULL;
+}
+
+/*
+ * delete_cache_node -
+ *      a helper to delete the cache object node from its shard. The node
+ *      is freed once the lookups which might still see it are over.
+ */
+void delete_cache_node(CacheShard *shard, CacheNode *cache_node) {
+    policy -> unlink(shard, cache_node);
+    index_remove(shard, cache_node);
+    atomic_fetch_add_explicit(&shard -> retired_bytes, cache_node -> charge,
+            memory_order_relaxed);
+    epoch_retire(&shard -> retired, &cache_node -> retire,
+            free_cache_node, cache_node);
+}
+
+/*
+ * evict_cache - cache evict method
+ *      Delete the cache object node the policy chooses from the shard.
+ */
+void evict_cache(CacheShard *shard) {
+    CacheNode *to_evict = policy -> victim(shard);
+
+    policy -> unlink(shard, to_evict);
+    /* deduct the current cache size */
+    /* only writer can do evictions, and only one writer can write */
+    /* so no need to lock the size variable */
+    shard -> size -= to_evict -> charge;
+    evict_victim(shard, to_evict);
+}
+
+/*
+ * get_cache - cache get method
+ *      Read the cache object with the provided absolute_uri. On a hit the
+ *      calling thread stays in its epoch read section, so the object
+ *      stays allocated until the caller releases it with release_cache.
+ *      A lookup never waits for a writer, but it does write: the
+ *      counters of its thread, the freq of a hit until it is full, and
+ *      a batch of hits now and then, for the LRU or the sketch, if the
+ *      shard's lock is free. Only a miss goes to the sketch right
+ *      away. A large hit pinned by the caller (cache_pin) writes the
+ *      pins of the node too.
+ */
+CacheNode *get_cache(char *absolute_uri) {
+    uint64_t hash = cache_hash(absolute_uri);
+    CacheShard *shard = cache_shard(hash);
+
+    CacheCounters *mine = self ? self : cache_counters();
+    int freq;
+
+    epoch_enter();
+    CacheNode * ret = find_cache_node(shard, absolute_uri, hash);
+    if (ret == NULL) {
+        epoch_exit();
+        /* only this thread writes its counters */
+        atomic_store_explicit(&mine -> misses, atomic_load_explicit(
+                    &mine -> misses, memory_order_relaxed) + 1,
+                memory_order_relaxed);
+        if (admission) {
+            tinylfu_record(&shard -> sketch, hash);
+        }
+        return NULL;
+    }
+    atomic_store_explicit(&mine -> hits, atomic_load_explicit(
+                &mine -> hits, memory_order_relaxed) + 1,
+            memory_order_relaxed);
+    atomic_store_explicit(&mine -> hit_bytes, atomic_load_explicit(
+                &mine -> hit_bytes, memory_order_relaxed) + ret -> size,
+            memory_order_relaxed);
+    /* count it for the policy, writing only until the count is full.
+     * Racing lookups may lose a count, which does no harm */
+    if ((freq = atomic_load_explicit(&ret -> freq, memory_order_relaxed))
+            < CACHE_FREQ_MAX) {
+        atomic_store_explicit(&ret -> freq, freq + 1, memory_order_relaxed);
+    }
+    if (policy -> touch || admission) {
+        cache_touch(hash);
+    }
+    if (atomic_load_explicit(&ret -> filled, memory_order_relaxed) <
+            ret -> size) {
+        atomic_store_explicit(&mine -> fill_readers, atomic_load_explicit(
+                    &mine -> fill_readers, memory_order_relaxed) + 1,
+                memory_order_relaxed);
+    }
+    return ret;
+}
+
+/*
+ * release_cache - the caller of get_cache is done with the cache
+ *      object node, which may be freed from now on
+ */
+void release_cache(CacheNode *cache_node) {
+    epoch_exit();
+}
+
+/*
+ * cache_pin - keep cache_node, a hit not released yet, allocated after
+ *      release_cache until cache_unpin, for a caller which writes it out
+ *      over a longer time than a read section should last
+ */
+void cache_pin(CacheNode *cache_node) {
+    /* not retired yet, the read section is not over */
+    atomic_fetch_add_explicit(&cache_node -> pins, 1, memory_order_relaxed);
+}
+
+/*
+ * cache_unpin - the caller of cache_pin is done with cache_node, which
+ *      is freed right away if it was retired meanwhile
+ */
+void cache_unpin(CacheNode *cache_node) {
+    if (atomic_fetch_sub_explicit(&cache_node -> pins, 1,
+                memory_order_acq_rel) == (CACHE_NODE_FREED | 1)) {
+        discard_cache_node(cache_node);
+    }
+}
+
+/*
+ * cache_node_iov - point iov at the pieces of the object of cache_node
+ *      from offset on, the rest of its head and then its segments, up to
+ *      max of them and as far as it is filled.
+ *      Returns the pieces, 0 if offset is at the end of what is filled.
+ */
+int cache_node_iov(CacheNode *cache_node, size_t offset, struct iovec *iov,
+        int max) {
+    char **segments = cache_node_segments(cache_node);
+    size_t filled = cache_node_filled(cache_node);
+    size_t kept = cache_node -> segments ? cache_node -> head_size : filled;
+    size_t skip, len;
+    int count = 0;
+
+    if (offset < kept && count < max) {
+        iov[count].iov_base = cache_node_content(cache_node) + offset;
+        iov[count++].iov_len = kept - offset;
+        offset = kept;
+    }
+    while (offset < filled && count < max) {
+        /* all the segments but the last are full */
+        skip = (offset - kept) % CACHE_SEGMENT_SIZE;
+        len = CACHE_SEGMENT_SIZE - skip;
+        if (len > filled - offset) {
+            len = filled - offset;
+        }
+        iov[count].iov_base =
+            segments[(offset - kept) / CACHE_SEGMENT_SIZE] + skip;
+        iov[count++].iov_len = len;
+        offset += len;
+    }
+    return count;
+}
+
+/*
+ * put_cache - cache put method
+ *      Store a new cache object with the provided information, its head
+ *      copied and its body taken from the segments of body, which is
+ *      left empty either way.
+ *      If the shard is full, evict cache nodes until the room is
+ *      large enough to store the new cache object node, unless the
+ *      admission filter finds the object is worth less than them.
+ *      Past the high watermark, wake the reclaimer to make room for
+ *      the next ones. The origin took cost microseconds to send the
+ *      object.
+ */
+void put_cache(const char *absolute_uri, const char *head, size_t head_size,
+        CacheFill *body, unsigned long cost) {
+    uint64_t hash = cache_hash(absolute_uri);
+    CacheShard *shard = cache_shard(hash);
+    CacheNode *cache_node;
+    size_t key_size = strlen(absolute_uri) + 1;
+    size_t size = head_size + body -> size;
+    size_t charge = object_charge(key_size, head_size, size);
+
+    /* the overhead only changes under the lock, a stale one will do */
+    if (size > cache_max_object() || charge == 0 ||
+            charge + shard -> overhead > shard -> capacity) {
+        cache_fill_free(body);
+        return;
+    }
+    /* the node is built before the lock is taken */
+    if ((cache_node = cache_node_new(absolute_uri, key_size,
+                    head, head_size, body)) == NULL) {
+        return;
+    }
+    cache_node_setup(cache_node, hash, charge, cost, size);
+    cache_insert(shard, cache_node);
+}
+
+/*
+ * cache_fill_init - start collecting an empty body in fill
+ */
+void cache_fill_init(CacheFill *fill) {
+    buffer_init(&fill -> first);
+    fill -> segments = NULL;
+    fill -> count = fill -> room = 0;
+    fill -> size = 0;
+}
+
+/*
+ * cache_fill_append - add n bytes of data to the body in fill. The body
+ *      moves to segments once it is larger than one.
+ *      Returns 0 on success, -1 if out of memory.
+ */
+int cache_fill_append(CacheFill *fill, const char *data, size_t n) {
+    size_t used, len;
+
+    if (fill -> count == 0) {
+        if (fill -> size + n <= CACHE_SEGMENT_SIZE) {
+            if (buffer_append(&fill -> first, data, n) < 0) {
+                return -1;
+            }
+            fill -> size += n;
+            return 0;
+        }
+        if (fill_segment(fill) < 0) {
+            return -1;
+        }
+        memcpy(fill -> segments[0], buffer_head(&fill -> first),
+                fill -> size);
+        buffer_free(&fill -> first);
+    }
+    while (n > 0) {
+        used = fill -> size - (fill -> count - 1) * CACHE_SEGMENT_SIZE;
+        if (used == CACHE_SEGMENT_SIZE) {
+            if (fill_segment(fill) < 0) {
+                return -1;
+            }
+            used = 0;
+        }
+        len = CACHE_SEGMENT_SIZE - used < n ? CACHE_SEGMENT_SIZE - used : n;
+        memcpy(fill -> segments[fill -> count - 1] + used, data, len);
+        fill -> size += len;
+        data += len;
+        n -= len;
+    }
+    return 0;
+}
+
+/*
+ * cache_fill_free - drop the body collected in fill, leaving it empty
+ */
+void cache_fill_free(CacheFill *fill) {
+    size_t i;
+
+    for (i = 0; i < fill -> count; i++) {
+        slab_free(fill -> segments[i], CACHE_SEGMENT_SIZE);
+    }
+    free(fill -> segments);
+    buffer_free(&fill -> first);
+    cache_fill_init(fill);
+}
+
+/*
+ * cache_fill_start - publish the object of size bytes of absolute_uri
+ *      as soon as its head, of head_size bytes, is in, before its body
+ *      is, which is written into it with cache_fill_write as it is
+ *      relayed. It is stored as put_cache would, and lookups find it
+ *      from now on, reading what is written so far. The origin took
+ *      cost microseconds to send the head.
+ *      Returns the node, pinned until cache_fill_end, NULL if it is not
+ *      stored.
+ */
+CacheNode *cache_fill_start(const char *absolute_uri, const char *head,
+        size_t head_size, size_t size, unsigned long cost) {
+    uint64_t hash = cache_hash(absolute_uri);
+    CacheShard *shard = cache_shard(hash);
+    CacheNode *cache_node;
+    size_t key_size = strlen(absolute_uri) + 1;
+    size_t charge = object_charge(key_size, head_size, size);
+    size_t count = object_segments(key_size, size, size - head_size);
+
+    if (head_size > size || size > cache_max_object() || charge == 0 ||
+            charge + shard -> overhead > shard -> capacity) {
+        return NULL;
+    }
+    /* the segments are allocated as the body comes */
+    if ((cache_node = (CacheNode *) slab_alloc(node_chunk_size(key_size,
+                        count ? head_size : size, count))) == NULL) {
+        unix_error_non_exit("malloc for cache error");
+        return NULL;
+    }
+    cache_node -> key_size = key_size;
+    cache_node -> size = size;
+    cache_node -> head_size = count ? head_size : 0;
+    cache_node -> segments = count;
+    memcpy(cache_node_key(cache_node), absolute_uri, key_size);
+    memcpy(cache_node_content(cache_node), head, head_size);
+    if (count) {
+        memset(cache_node_segments(cache_node), 0, count * sizeof(char *));
+    }
+    cache_node_setup(cache_node, hash, charge, cost, head_size);
+    /* the filler's pin, it writes the node even once evicted */
+    atomic_init(&cache_node -> pins, 1);
+    if (cache_insert(shard, cache_node) < 0) {
+        return NULL;
+    }
+    atomic_fetch_add_explicit(&fills, 1, memory_order_relaxed);
+    return cache_node;
+}
+
+/*
+ * cache_fill_write - append n bytes of data to the body of cache_node,
+ *      published by cache_fill_start, and wake the readers waiting for
+ *      them.
+ *      Returns 0 on success, -1 if out of memory or past its size.
+ */
+int cache_fill_write(CacheNode *cache_node, const char *data, size_t n) {
+    char **segments = cache_node_segments(cache_node);
+    size_t kept = cache_node -> head_size;
+    size_t body = cache_node -> size - kept;
+    size_t filled = atomic_load_explicit(&cache_node -> filled,
+            memory_order_relaxed);
+    size_t at, index, skip, len;
+    int rc = 0;
+
+    /* only the filler writes it */
+    if (n > cache_node -> size - filled) {
+        return -1;
+    }
+    if (cache_node -> segments == 0) {
+        memcpy(cache_node_content(cache_node) + filled, data, n);
+        filled += n;
+        n = 0;
+    }
+    while (n > 0) {
+        at = filled - kept;
+        index = at / CACHE_SEGMENT_SIZE;
+        skip = at % CACHE_SEGMENT_SIZE;
+        /* the last segment gets a chunk of its size */
+        if (skip == 0 && (segments[index] = (char *) slab_alloc(
+                        index + 1 < cache_node -> segments ?
+                        CACHE_SEGMENT_SIZE : body - at)) == NULL) {
+            unix_error_non_exit("malloc for cache error");
+            rc = -1;
+            break;
+        }
+        len = CACHE_SEGMENT_SIZE - skip < n ? CACHE_SEGMENT_SIZE - skip : n;
+        memcpy(segments[index] + skip, data, len);
+        filled += len;
+        data += len;
+        n -= len;
+    }
+    /* published before the waiters are looked for, which register
+     * before they look at it again (see cache_tail_wait) */
+    atomic_store_explicit(&cache_node -> filled, filled,
+            memory_order_seq_cst);
+    if (atomic_load_explicit(&cache_node -> tails, memory_order_seq_cst)) {
+        pthread_mutex_lock(&tail_lock);
+        tail_wake(cache_node);
+        pthread_mutex_unlock(&tail_lock);
+    }
+    return rc;
+}
+
+/*
+ * cache_fill_end - the filler of cache_node is done with it. Unless its
+ *      body is complete, the fill broke off: it is deleted from the
+ *      cache if it is still there, and its readers are told. Drops the
+ *      pin of cache_fill_start.
+ */
+void cache_fill_end(CacheNode *cache_node) {
+    CacheShard *shard = cache_shard(cache_node -> hash);
+    EpochDeferred *ready;
+
+    if (atomic_load_explicit(&cache_node -> filled, memory_order_relaxed) <
+            cache_node -> size) {
+        atomic_store_explicit(&cache_node -> failed, 1,
+                memory_order_relaxed);
+        atomic_fetch_add_explicit(&fills_failed, 1, memory_order_relaxed);
+        cache_lock(&shard -> writer_lock);
+        if (find_cache_node(shard, cache_node_key(cache_node),
+                    cache_node -> hash) == cache_node) {
+            shard -> size -= cache_node -> charge;
+            delete_cache_node(shard, cache_node);
+        }
+        ready = epoch_detach(&shard -> retired);
+        cache_unlock(&shard -> writer_lock);
+        epoch_release(ready);
+    }
+    /* no reader waits on it from here on */
+    pthread_mutex_lock(&tail_lock);
+    tail_wake(cache_node);
+    pthread_mutex_unlock(&tail_lock);
+    cache_unpin(cache_node);
+}
+
+/*
+ * cache_node_failed - whether the fill of cache_node broke off, so the
+ *      rest of it never comes
+ */
+int cache_node_failed(CacheNode *cache_node) {
+    return atomic_load_explicit(&cache_node -> failed, memory_order_relaxed);
+}
+
+/*
+ * cache_mailbox_init - set up an empty mailbox, its eventfd to be
+ *      watched by the loop of its worker.
+ *      Returns 0 on success, -1 on failure.
+ */
+int cache_mailbox_init(CacheMailbox *mb) {
+    if ((mb -> fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        unix_error_non_exit("eventfd error");
+        return -1;
+    }
+    mb -> head = mb -> tail = NULL;
+    return 0;
+}
+
+/*
+ * cache_mailbox_bind - call back the tails of the calling worker thread
+ *      through mb
+ */
+void cache_mailbox_bind(CacheMailbox *mb) {
+    tail_mailbox = mb;
+}
+
+/*
+ * cache_mailbox_drain - the eventfd of mb was read, run the callbacks
+ *      of the tails more came for since
+ */
+void cache_mailbox_drain(CacheMailbox *mb) {
+    CacheTail *t;
+
+    while (1) {
+        pthread_mutex_lock(&tail_lock);
+        if ((t = mb -> head) == NULL) {
+            pthread_mutex_unlock(&tail_lock);
+            return;
+        }
+        if ((mb -> head = t -> next) == NULL) {
+            mb -> tail = NULL;
+        }
+        t -> state = CACHE_TAIL_IDLE;
+        pthread_mutex_unlock(&tail_lock);
+        /* one at a time, as a callback may cancel the others */
+        t -> callback(t);
+    }
+}
+
+/*
+ * cache_tail_init - get a tail ready, callback runs with it on the
+ *      worker once what it waits for comes
+ */
+void cache_tail_init(CacheTail *t, CacheTailCallback callback, void *data) {
+    t -> state = CACHE_TAIL_IDLE;
+    t -> callback = callback;
+    t -> data = data;
+    t -> node = NULL;
+    t -> mailbox = NULL;
+    t -> next = NULL;
+}
+
+/*
+ * cache_tail_wait - call t back on this worker once more than offset
+ *      bytes of cache_node, pinned by the caller, are filled, or its
+ *      fill broke off. Right away if that is so already. Does nothing
+ *      if t is waiting already.
+ */
+void cache_tail_wait(CacheTail *t, CacheNode *cache_node, size_t offset) {
+    pthread_mutex_lock(&tail_lock);
+    if (t -> state == CACHE_TAIL_IDLE) {
+        t -> state = CACHE_TAIL_WAITING;
+        t -> node = cache_node;
+        t -> mailbox = tail_mailbox;
+        t -> next = atomic_load_explicit(&cache_node -> tails,
+                memory_order_relaxed);
+        /* registered before filled is looked at, so the filler either
+         * sees it or wrote before the look (see cache_fill_write) */
+        atomic_store_explicit(&cache_node -> tails, t, memory_order_seq_cst);
+        if (atomic_load_explicit(&cache_node -> filled,
+                    memory_order_seq_cst) > offset ||
+                cache_node_failed(cache_node)) {
+            tail_wake(cache_node);
+        }
+    }
+    pthread_mutex_unlock(&tail_lock);
+}
+
+/*
+ * cache_tail_cancel - stop waiting, t is not called back anymore
+ */
+void cache_tail_cancel(CacheTail *t) {
+    CacheTail **pp, *prev, *p;
+
+    pthread_mutex_lock(&tail_lock);
+    if (t -> state == CACHE_TAIL_WAITING) {
+        /* the waiters only change under the lock */
+        p = atomic_load_explicit(&t -> node -> tails, memory_order_relaxed);
+        if (p == t) {
+            atomic_store_explicit(&t -> node -> tails, t -> next,
+                    memory_order_relaxed);
+        }
+        else {
+            for (; p -> next != t; p = p -> next) {
+            }
+            p -> next = t -> next;
+        }
+    }
+    else if (t -> state == CACHE_TAIL_DELIVERING) {
+        CacheMailbox *mb = t -> mailbox;
+        for (prev = NULL, pp = &mb -> head; *pp != t;
+                prev = *pp, pp = &(*pp) -> next) {
+        }
+        *pp = t -> next;
+        if (mb -> tail == t) {
+            mb -> tail = prev;
+        }
+    }
+    t -> state = CACHE_TAIL_IDLE;
+    pthread_mutex_unlock(&tail_lock);
+}
+
+/*
+ * cache_stats - append the cache metrics
+ */
+void cache_stats(Buffer *b) {
+    size_t bytes = 0, objects = 0, retired = 0;
+    size_t overhead = 0, logical = 0, retired_bytes = 0;
+    uint64_t acquires = 0, contended = 0, wait_ns = 0, wait_max_ns = 0;
+    uint64_t evictions = 0, ghost_hits = 0, admitted = 0, rejected = 0;
+    uint64_t reclaimed = 0;
+    unsigned long hits = 0, misses = 0, hit_bytes = 0, fill_readers = 0;
+    CacheCounters *t;
+    int i;
+
+    for (i = 0; i < shard_count; i++) {
+        CacheLock *lock = &shards[i].writer_lock;
+        cache_lock(lock);
+        bytes += shards[i].size;
+        overhead += shards[i].overhead;
+        logical += shards[i].logical;
+        objects += shards[i].index.count;
+        retired += shards[i].retired.count;
+        retired_bytes += atomic_load_explicit(&shards[i].retired_bytes,
+                memory_order_relaxed);
+        reclaimed += shards[i].reclaimed;
+        evictions += shards[i].evictions;
+        ghost_hits += shards[i].ghost_hits;
+        admitted += shards[i].admitted;
+        rejected += shards[i].rejected;
+        acquires += lock -> acquires;
+        contended += lock -> contended;
+        wait_ns += lock -> wait_ns;
+        if (lock -> wait_max_ns > wait_max_ns) {
+            wait_max_ns = lock -> wait_max_ns;
+        }
+        cache_unlock(lock);
+    }
+    /* written by their threads alone, a stale sum is good enough */
+    for (t = atomic_load_explicit(&counters, memory_order_acquire); t;
+            t = t -> next) {
+        hits += atomic_load_explicit(&t -> hits, memory_order_relaxed);
+        misses += atomic_load_explicit(&t -> misses, memory_order_relaxed);
+        hit_bytes += atomic_load_explicit(&t -> hit_bytes,
+                memory_order_relaxed);
+        fill_readers += atomic_load_explicit(&t -> fill_readers,
+                memory_order_relaxed);
+    }
+    buffer_printf(b, "cache_policy %s\n", policy -> name);
+    buffer_printf(b, "cache_admission %s\n", admission ? "tinylfu" : "none");
+    buffer_printf(b, "cache_shards %d\n", shard_count);
+    buffer_printf(b, "cache_capacity %zu\n", cache_capacity());
+    buffer_printf(b, "cache_effective_capacity %zu\n",
+            cache_effective_capacity());
+    buffer_printf(b, "cache_max_object %zu\n", cache_max_object());
+    buffer_printf(b, "cache_bytes %zu\n", bytes);
+    buffer_printf(b, "cache_logical_bytes %zu\n", logical);
+    buffer_printf(b, "cache_overhead_bytes %zu\n", overhead);
+    buffer_printf(b, "cache_budget_bytes %zu\n", bytes + overhead);
+    /* the slab pages hold the retired chunks and the slack too */
+    buffer_printf(b, "cache_physical_bytes %zu\n",
+            slab_footprint() + overhead);
+    buffer_printf(b, "cache_objects %zu\n", objects);
+    buffer_printf(b, "cache_retired %zu\n", retired);
+    buffer_printf(b, "cache_retired_bytes %zu\n", retired_bytes);
+    buffer_printf(b, "cache_hits %lu\n", hits);
+    buffer_printf(b, "cache_misses %lu\n", misses);
+    buffer_printf(b, "cache_hit_ratio %.4f\n",
+            hits + misses ? (double) hits / (hits + misses) : 0.0);
+    buffer_printf(b, "cache_evictions %llu\n",
+            (unsigned long long) evictions);
+    buffer_printf(b, "cache_reclaimed %llu\n",
+            (unsigned long long) reclaimed);
+    buffer_printf(b, "cache_ghost_hits %llu\n",
+            (unsigned long long) ghost_hits);
+    buffer_printf(b, "cache_hit_bytes %lu\n", hit_bytes);
+    buffer_printf(b, "cache_admitted %llu\n",
+            (unsigned long long) admitted);
+    buffer_printf(b, "cache_rejected %llu\n",
+            (unsigned long long) rejected);
+    buffer_printf(b, "cache_fills %lu\n",
+            atomic_load_explicit(&fills, memory_order_relaxed));
+    buffer_printf(b, "cache_fill_readers %lu\n", fill_readers);
+    buffer_printf(b, "cache_fills_failed %lu\n",
+            atomic_load_explicit(&fills_failed, memory_order_relaxed));
+    buffer_printf(b, "cache_lock_acquires %llu\n",
+            (unsigned long long) acquires);
+    buffer_printf(b, "cache_lock_contended %llu\n",
+            (unsigned long long) contended);
+    buffer_printf(b, "cache_lock_wait_us %llu\n",
+            (unsigned long long) (wait_ns / 1000));
+    buffer_printf(b, "cache_lock_wait_max_us %llu\n",
+            (unsigned long long) (wait_max_ns / 1000));
+}
+
+/*
+ * cache_queue_push - put cache_node at the head of q, as the newest
+ */
+void cache_queue_push(CacheQueue *q, CacheNode *cache_node) {
+    cache_node -> prev = NULL;
+    cache_node -> next = q -> head;
+    if (q -> head) {
+        q -> head -> prev = cache_node;
+    }
+    else {
+        q -> tail = cache_node;
+    }
+    q -> head = cache_node;
+    q -> size += cache_node -> size;
+    q -> count++;
+}
+
+/*
+ * cache_queue_append - put cache_node at the tail of q, as the oldest
+ */
+void cache_queue_append(CacheQueue *q, CacheNode *cache_node) {
+    cache_node -> next = NULL;
+    cache_node -> prev = q -> tail;
+    if (q -> tail) {
+        q -> tail -> next = cache_node;
+    }
+    else {
+        q -> head = cache_node;
+    }
+    q -> tail = cache_node;
+    q -> size += cache_node -> size;
+    q -> count++;
+}
+
+/*
+ * cache_queue_unlink - take cache_node out of q
+ */
+void cache_queue_unlink(CacheQueue *q, CacheNode *cache_node) {
+    if (cache_node -> prev) {
+        cache_node -> prev -> next = cache_node -> next;
+    }
+    else {
+        q -> head = cache_node -> next;
+    }
+    if (cache_node -> next) {
+        cache_node -> next -> prev = cache_node -> prev;
+    }
+    else {
+        q -> tail = cache_node -> prev;
+    }
+    q -> size -= cache_node -> size;
+    q -> count--;
+}
+
+/*
+ * cache_queue_remove - take cache_node out of the shard's queue it is in,
+ *      the unlink of the policies keeping queues
+ */
+void cache_queue_remove(CacheShard *shard, CacheNode *cache_node) {
+    cache_queue_unlink(&shard -> queues[cache_node -> queue], cache_node);
+}
+
+/*
+ * cache_queue_restore - put a victim back at the tail of its queue,
+ *      the restore of the policies keeping queues
+ */
+void cache_queue_restore(CacheShard *shard, CacheNode *cache_node) {
+    cache_queue_append(&shard -> queues[cache_node -> queue], cache_node);
+}
+
+/*
+ * cache_queue_move - move cache_node to the head of the shard's
+ *      queue-th queue, which may be the one it is in
+ */
+void cache_queue_move(CacheShard *shard, CacheNode *cache_node, int queue) {
+    cache_queue_unlink(&shard -> queues[cache_node -> queue], cache_node);
+    cache_node -> queue = queue;
+    cache_queue_push(&shard -> queues[queue], cache_node);
+}
+
+/*
+ * cache_queue_coldest - the node of q with the fewest hits counted, the
+ *      one nearest the tail of those, and its count in freq.
+ *      Returns the node, NULL if q is empty.
+ */
+CacheNode *cache_queue_coldest(CacheQueue *q, int *freq) {
+    CacheNode *coldest = NULL, *p;
+    int f;
+
+    *freq = INT_MAX;
+    for (p = q -> tail; p && *freq > 0; p = p -> prev) {
+        if ((f = atomic_load_explicit(&p -> freq,
+                        memory_order_relaxed)) < *freq) {
+            coldest = p;
+            *freq = f;
+        }
+    }
+    return coldest;
+}
+
+/*
+ * cache_ghost_add - remember the key of hash as evicted
+ */
+void cache_ghost_add(CacheGhost *g, uint64_t hash) {
+    CacheGhostSlot *slot = &g -> slots[hash & (g -> size - 1)];
+
+    /* 0 marks an empty slot */
+    if (++g -> seq == 0) {
+        g -> seq = 1;
+    }
+    slot -> tag = cache_ghost_tag(hash);
+    slot -> seq = g -> seq;
+}
+
+/*
+ * cache_ghost_take - forget the key of hash if it is among the last
+ *      limit keys remembered in g, counting it as a ghost hit.
+ *      Returns 1 if it was, 0 if not.
+ */
+int cache_ghost_take(CacheShard *shard, CacheGhost *g, uint64_t hash,
+        size_t limit) {
+    CacheGhostSlot *slot = &g -> slots[hash & (g -> size - 1)];
+
+    if (slot -> seq == 0 || slot -> tag != cache_ghost_tag(hash) ||
+            (uint32_t) (g -> seq - slot -> seq) >= limit) {
+        return 0;
+    }
+    slot -> seq = 0;
+    shard -> ghost_hits++;
+    return 1;
+}
+
+/*
+ * cache_ghost_count - about how many keys g remembers, of the last limit
+ */
+size_t cache_ghost_count(CacheGhost *g, size_t limit) {
+    size_t count = g -> seq < limit ? g -> seq : limit;
+
+    return count < g -> size ? count : g -> size;
+}
+
+/*
+ * cache_shard - the shard holding the keys of hash. The index uses the
+ *      low bits of the hash, so the shard is picked by the high ones.
+ */
+static CacheShard *cache_shard(uint64_t hash) {
+    return &shards[(hash >> 32) % shard_count];
+}
+
+/*
+ * cache_lock_init - initialize an unheld cache lock
+ */
+static void cache_lock_init(CacheLock *lock) {
+    memset(lock, 0, sizeof(CacheLock));
+    Sem_init(&lock -> mutex, 0, 1);
+}
+
+/*
+ * cache_lock - acquire the lock, after the threads already waiting for it
+ */
+static void cache_lock(CacheLock *lock) {
+    struct timespec start, end;
+    CacheWaiter waiter;
+    uint64_t waited;
+
+    P(&lock -> mutex);
+    if (!lock -> held) {
+        lock -> held = 1;
+        lock -> acquires++;
+        V(&lock -> mutex);
+        return;
+    }
+    /* queue up, the owner hands the lock over when it is done */
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Sem_init(&waiter.ready, 0, 0);
+    waiter.next = NULL;
+    if (lock -> tail) {
+        lock -> tail -> next = &waiter;
+    }
+    else {
+        lock -> head = &waiter;
+    }
+    lock -> tail = &waiter;
+    V(&lock -> mutex);
+    P(&waiter.ready);
+    sem_destroy(&waiter.ready);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    /* the lock is ours, and so are the metrics */
+    waited = (uint64_t) (end.tv_sec - start.tv_sec) * 1000000000ULL
+        + end.tv_nsec - start.tv_nsec;
+    lock -> acquires++;
+    lock -> contended++;
+    lock -> wait_ns += waited;
+    if (waited > lock -> wait_max_ns) {
+        lock -> wait_max_ns = waited;
+    }
+}
+
+/*
+ * cache_unlock - release the lock, handing it to the oldest waiter
+ */
+static void cache_unlock(CacheLock *lock) {
+    CacheWaiter *waiter;
+
+    P(&lock -> mutex);
+    if ((waiter = lock -> head) == NULL) {
+        lock -> held = 0;
+        V(&lock -> mutex);
+        return;
+    }
+    if ((lock -> head = waiter -> next) == NULL) {
+        lock -> tail = NULL;
+    }
+    V(&lock -> mutex);
+    /* held stays set, ownership passes straight to the waiter */
+    V(&waiter -> ready);
+}
+
+/*
+ * cache_trylock - take the lock unless it is held, never waiting,
+ *      not even for the mutex of its fields.
+ *      Returns 0 if it was taken, -1 if not.
+ */
+static int cache_trylock(CacheLock *lock) {
+    if (sem_trywait(&lock -> mutex) < 0) {
+        return -1;
+    }
+    if (lock -> held) {
+        V(&lock -> mutex);
+        return -1;
+    }
+    lock -> held = 1;
+    lock -> acquires++;
+    V(&lock -> mutex);
+    return 0;
+}
+
+/*
+ * cache_touch - buffer a hit on the node with hash for the policy and
+ *      the sketch, telling them the whole batch once it is full
+ */
+static void cache_touch(uint64_t hash) {
+    touches[touch_count++] = hash;
+    if (touch_count == CACHE_TOUCH_BATCH) {
+        touch_flush();
+    }
+}
+
+/*
+ * touch_flush - tell the policy and the sketch of the buffered hits, in
+ *      the order they came, a shard at a time. So the sketch of a shard
+ *      is written by its lock holder alone, but for the misses, rather
+ *      than by every hit on every core. The hits of a shard whose lock
+ *      is busy are dropped rather than waited for, the policy still
+ *      finds them counted in freq.
+ */
+static void touch_flush(void) {
+    char done[CACHE_TOUCH_BATCH];
+    CacheShard *shard;
+    CacheNode *p;
+    int i, j, locked;
+
+    memset(done, 0, sizeof(done));
+    for (i = 0; i < touch_count; i++) {
+        if (done[i]) {
+            continue;
+        }
+        shard = cache_shard(touches[i]);
+        locked = cache_trylock(&shard -> writer_lock) == 0;
+        for (j = i; j < touch_count; j++) {
+            if (done[j] || cache_shard(touches[j]) != shard) {
+                continue;
+            }
+            done[j] = 1;
+            if (!locked) {
+                continue;
+            }
+            if (admission) {
+                tinylfu_record(&shard -> sketch, touches[j]);
+            }
+            /* the node may have been evicted since */
+            if (policy -> touch && (p = index_find_hash(&shard -> index,
+                            touches[j])) != NULL) {
+                policy -> touch(shard, p);
+            }
+        }
+        if (locked) {
+            cache_unlock(&shard -> writer_lock);
+        }
+    }
+    touch_count = 0;
+}
+
+/*
+ * evict_victim - evict cache_node, a victim of the policy already out
+ *      of its queue and deducted from the size of the shard
+ */
+static void evict_victim(CacheShard *shard, CacheNode *cache_node) {
+    shard -> evictions++;
+    if (policy -> evicted) {
+        policy -> evicted(shard, cache_node);
+    }
+    index_remove(shard, cache_node);
+    atomic_fetch_add_explicit(&shard -> retired_bytes, cache_node -> charge,
+            memory_order_relaxed);
+    epoch_retire(&shard -> retired, &cache_node -> retire,
+            free_cache_node, cache_node);
+}
+
+/*
+ * shard_used - the bytes shard holds against its budget
+ */
+static size_t shard_used(CacheShard *shard) {
+    return shard -> size + shard -> overhead;
+}
+
+/*
+ * shard_mark - percent of the budget of shard, in bytes
+ */
+static size_t shard_mark(CacheShard *shard, int percent) {
+    return shard -> capacity / 100 * percent;
+}
+
+/*
+ * reclaimer_thread - evict from the shards the puts took past their high
+ *      watermark, for as long as the process runs
+ */
+static void *reclaimer_thread(void *arg) {
+    int i;
+
+    while (1) {
+        pthread_mutex_lock(&reclaim_lock);
+        while (!reclaim_pending) {
+            pthread_cond_wait(&reclaim_ready, &reclaim_lock);
+        }
+        reclaim_pending = 0;
+        pthread_mutex_unlock(&reclaim_lock);
+        for (i = 0; i < shard_count; i++) {
+            reclaim_shard(&shards[i]);
+        }
+    }
+    return NULL;
+}
+
+/*
+ * reclaim_shard - evict from shard down to its low watermark if it asked
+ *      for it, a batch per hold of the writer lock so the puts waiting
+ *      for the lock get their turn in between
+ */
+static void reclaim_shard(CacheShard *shard) {
+    CacheNode *victim;
+    EpochDeferred *ready;
+    int n;
+
+    while (1) {
+        cache_lock(&shard -> writer_lock);
+        for (n = 0; shard -> reclaim && n < CACHE_RECLAIM_BATCH; n++) {
+            if (shard -> size == 0 || shard_used(shard) <=
+                    shard_mark(shard, CACHE_LOW_WATERMARK)) {
+                shard -> reclaim = 0;
+                break;
+            }
+            victim = policy -> victim(shard);
+            policy -> unlink(shard, victim);
+            shard -> size -= victim -> charge;
+            shard -> reclaimed++;
+            evict_victim(shard, victim);
+        }
+        ready = epoch_detach(&shard -> retired);
+        cache_unlock(&shard -> writer_lock);
+        epoch_release(ready);
+        if (n < CACHE_RECLAIM_BATCH) {
+            return;
+        }
+    }
+}
+
+/*
+ * reclaim_wake - tell the reclaimer a shard is over its high watermark
+ */
+static void reclaim_wake(void) {
+    pthread_mutex_lock(&reclaim_lock);
+    reclaim_pending = 1;
+    pthread_cond_signal(&reclaim_ready);
+    pthread_mutex_unlock(&reclaim_lock);
+}
+
+/*
+ * cache_floor - the smallest budget giving every shard room for its
+ *      overhead and an object of max_object bytes, SIZE_MAX if the slab
+ *      cannot hold one. The overhead only changes under the writer
+ *      locks, a stale one will do.
+ */
+static size_t cache_floor(size_t max_object) {
+    size_t largest = object_charge(MAXLINE, 0, max_object);
+    size_t overhead = 0;
+    int i;
+
+    if (largest == 0) {
+        return SIZE_MAX;
+    }
+    for (i = 0; i < shard_count; i++) {
+        if (shards[i].overhead > overhead) {
+            overhead = shards[i].overhead;
+        }
+    }
+    return (overhead + largest) * shard_count;
+}
+
+/*
+ * cache_apply - give the shards their part of the budget in effect,
+ *      flagging those now over their high watermark for the reclaimer.
+ *      Called with resize_lock held.
+ *      Returns 1 if the reclaimer is to be woken, 0 if not.
+ */
+static int cache_apply(void) {
+    size_t capacity = pressure_cap < capacity_total ? pressure_cap :
+        capacity_total;
+    int i, wake = 0;
+
+    for (i = 0; i < shard_count; i++) {
+        CacheShard *shard = &shards[i];
+        cache_lock(&shard -> writer_lock);
+        shard -> capacity = capacity / shard_count;
+        if (!shard -> reclaim &&
+                shard_used(shard) > shard_mark(shard, CACHE_HIGH_WATERMARK)) {
+            shard -> reclaim = 1;
+            wake = 1;
+        }
+        cache_unlock(&shard -> writer_lock);
+    }
+    return wake;
+}
+
+/*
+ * cache_counters - give the calling thread its lookup counters, kept
+ *      for the life of the process
+ */
+static CacheCounters *cache_counters(void) {
+    CacheCounters *t;
+
+    if ((t = (CacheCounters *) aligned_alloc(64,
+                    sizeof(CacheCounters))) == NULL) {
+        unix_error("malloc for cache counters error");
+    }
+    atomic_init(&t -> hits, 0);
+    atomic_init(&t -> misses, 0);
+    atomic_init(&t -> hit_bytes, 0);
+    atomic_init(&t -> fill_readers, 0);
+    t -> next = atomic_load_explicit(&counters, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&counters, &t -> next, t,
+                memory_order_release, memory_order_relaxed)) {
+    }
+    self = t;
+    return t;
+}
+
+/*
+ * cache_insert - store cache_node, built and set up, in shard, as
+ *      put_cache tells.
+ *      Returns 0 if it was stored, -1 if not, and it is freed.
+ */
+static int cache_insert(CacheShard *shard, CacheNode *cache_node) {
+    CacheNode *victims = NULL, *next;
+    EpochDeferred *ready;
+    uint64_t hash = cache_node -> hash;
+    size_t charge = cache_node -> charge;
+    int candidate = -1, contested = 0, rejected = 0, wake = 0;
+
+    /* acquire writer lock */
+    cache_lock(&shard -> writer_lock);
+    if (admission) {
+        tinylfu_age(&shard -> sketch);
+    }
+    if ((victims = find_cache_node(shard, cache_node_key(cache_node),
+                    hash)) != NULL) {
+        /* if there exists an cache node with the same aboslute_uri
+         * delete the old cache object and update it using the new one*/
+        shard -> size -= victims -> charge;
+        delete_cache_node(shard, victims);
+        victims = NULL;
+    }
+    else if (admission) {
+        candidate = tinylfu_estimate(&shard -> sketch, hash);
+    }
+    if (shard_used(shard) > shard -> capacity) {
+        /* shrunk, and the reclaimer is on it. Evicting all the excess
+         * here would stall the puts behind this one */
+        cache_unlock(&shard -> writer_lock);
+        free_cache_chunks(cache_node);
+        return -1;
+    }
+    shard -> size += charge;
+    /* if the chunks and the overhead take more than the shard may, take
+     * out victims until this object can be stored in the cache */
+    while (shard -> size + shard -> overhead > shard -> capacity &&
+            shard -> size > charge) {
+        contested = 1;
+        /* a victim worth as much keeps its place, looked at with peek
+         * as victim would already reorder the queues for it */
+        if (candidate >= 0 && tinylfu_estimate(&shard -> sketch,
+                    policy -> peek(shard) -> hash) >= candidate) {
+            rejected = 1;
+            break;
+        }
+        next = policy -> victim(shard);
+        policy -> unlink(shard, next);
+        shard -> size -= next -> charge;
+        /* not retired yet, so its retire link is free */
+        next -> retire.next = (EpochDeferred *) victims;
+        victims = next;
+    }
+    if (candidate >= 0 && !contested && shard -> size > charge &&
+            shard_used(shard) > shard_mark(shard, CACHE_LOW_WATERMARK)) {
+        /* the reclaimer is to evict for it, so it has to be worth the
+         * next victim all the same. That one stays where it is */
+        contested = 1;
+        rejected = tinylfu_estimate(&shard -> sketch,
+                policy -> peek(shard) -> hash) >= candidate;
+    }
+    if (rejected) {
+        /* put the victims back, the first one taken last */
+        for (; victims; victims = next) {
+            next = (CacheNode *) victims -> retire.next;
+            shard -> size += victims -> charge;
+            policy -> restore(shard, victims);
+        }
+        shard -> size -= charge;
+        shard -> rejected++;
+        cache_unlock(&shard -> writer_lock);
+        /* no lookup ever saw it, and it was never retired */
+        free_cache_chunks(cache_node);
+        return -1;
+    }
+    if (candidate >= 0 && contested) {
+        shard -> admitted++;
+    }
+    for (; victims; victims = next) {
+        next = (CacheNode *) victims -> retire.next;
+        evict_victim(shard, victims);
+    }
+
+    policy -> insert(shard, cache_node);
+    /* publish it, complete, to the lookups */
+    index_insert(shard, cache_node);
+    if (!shard -> reclaim &&
+            shard_used(shard) > shard_mark(shard, CACHE_HIGH_WATERMARK)) {
+        shard -> reclaim = 1;
+        wake = 1;
+    }
+    /* take what the lookups are done with */
+    ready = epoch_detach(&shard -> retired);
+    /* release writer lock */
+    cache_unlock(&shard -> writer_lock);
+    /* and free it with no lock held */
+    epoch_release(ready);
+    if (wake) {
+        reclaim_wake();
+    }
+    return 0;
+}
+
+/*
+ * cache_node_new - build the node of the object of key, made of head
+ *      and the body collected in body, whose segments it takes. The
+ *      body is left empty.
+ *      Returns the node, NULL if out of memory.
+ */
+static CacheNode *cache_node_new(const char *key, size_t key_size,
+        const char *head, size_t head_size, CacheFill *body) {
+    size_t size = head_size + body -> size;
+    size_t count = object_segments(key_size, size, body -> size);
+    size_t last = body -> size - (count ? count - 1 : 0) * CACHE_SEGMENT_SIZE;
+    /* the last segment gets a chunk of its size, unless it is full */
+    int cut = count && (body -> count == 0 || last < CACHE_SEGMENT_SIZE);
+    CacheNode *cache_node;
+    char **segments, *tail = NULL;
+
+    if ((cache_node = (CacheNode *) slab_alloc(node_chunk_size(key_size,
+                        count ? head_size : size, count))) == NULL ||
+            (cut && (tail = (char *) slab_alloc(last)) == NULL)) {
+        /* if malloc for the cachenode fails, give up and return
+         * without exiting the program */
+        unix_error_non_exit("malloc for cache error");
+        if (cache_node) {
+            slab_free(cache_node, node_chunk_size(key_size, head_size,
+                        count));
+        }
+        cache_fill_free(body);
+        return NULL;
+    }
+    cache_node -> key_size = key_size;
+    cache_node -> size = size;
+    cache_node -> head_size = count ? head_size : 0;
+    cache_node -> segments = count;
+    memcpy(cache_node_key(cache_node), key, key_size);
+    memcpy(cache_node_content(cache_node), head, head_size);
+    if (count == 0) {
+        /* small enough to be in the chunk with its head */
+        memcpy(cache_node_content(cache_node) + head_size,
+                buffer_head(&body -> first), body -> size);
+        cache_fill_free(body);
+        return cache_node;
+    }
+    segments = cache_node_segments(cache_node);
+    if (body -> count == 0) {
+        /* a small body after a large head */
+        memcpy(tail, buffer_head(&body -> first), last);
+    }
+    else {
+        memcpy(segments, body -> segments, count * sizeof(char *));
+        body -> count = 0;
+        if (cut) {
+            /* the last segment is cut down to what it holds */
+            memcpy(tail, segments[count - 1], last);
+            slab_free(segments[count - 1], CACHE_SEGMENT_SIZE);
+        }
+    }
+    if (cut) {
+        segments[count - 1] = tail;
+    }
+    cache_fill_free(body);
+    return cache_node;
+}
+
+/*
+ * object_segments - the segments the body of body_size bytes of an
+ *      object of size bytes is split into, 0 if the object fits in the
+ *      chunk of its node with a key of key_size bytes
+ */
+static size_t object_segments(size_t key_size, size_t size,
+        size_t body_size) {
+    if (sizeof(CacheNode) + key_size + size <= CACHE_SEGMENT_SIZE) {
+        return 0;
+    }
+    return (body_size + CACHE_SEGMENT_SIZE - 1) / CACHE_SEGMENT_SIZE;
+}
+
+/*
+ * object_charge - the bytes of the chunks an object of size bytes, of
+ *      which head_size of head, takes with a key of key_size bytes,
+ *      0 if the slab cannot hold its node
+ */
+static size_t object_charge(size_t key_size, size_t head_size, size_t size) {
+    size_t count = object_segments(key_size, size, size - head_size);
+    size_t charge = slab_size(node_chunk_size(key_size,
+                count ? head_size : size, count));
+
+    if (charge == 0 || count == 0) {
+        return charge;
+    }
+    return charge + (count - 1) * slab_size(CACHE_SEGMENT_SIZE) +
+        slab_size(size - head_size - (count - 1) * CACHE_SEGMENT_SIZE);
+}
+
+/*
+ * node_chunk_size - the bytes of the chunk of a node with a key of
+ *      key_size bytes, kept bytes of its object after it, and count
+ *      segments for the rest
+ */
+static size_t node_chunk_size(size_t key_size, size_t kept, size_t count) {
+    if (count == 0) {
+        return sizeof(CacheNode) + key_size + kept;
+    }
+    return sizeof(CacheNode) + ((key_size + kept + 7) & ~(size_t) 7) +
+        count * sizeof(char *);
+}
+
+/*
+ * fill_segment - add an empty segment to the body in fill.
+ *      Returns 0 on success, -1 if out of memory.
+ */
+static int fill_segment(CacheFill *fill) {
+    size_t room = fill -> room ? fill -> room * 2 : 8;
+    char **segments;
+
+    if (fill -> count == fill -> room) {
+        if ((segments = (char **) realloc(fill -> segments,
+                        room * sizeof(char *))) == NULL) {
+            return -1;
+        }
+        fill -> segments = segments;
+        fill -> room = room;
+    }
+    if ((fill -> segments[fill -> count] =
+                (char *) slab_alloc(CACHE_SEGMENT_SIZE)) == NULL) {
+        return -1;
+    }
+    fill -> count++;
+    return 0;
+}
+
+/*
+ * free_cache_node - release the memory of a retired cache object node,
+ *      called by the writer of its shard, or leave it to its last
+ *      sender if it is pinned
+ */
+static void free_cache_node(void *arg) {
+    CacheNode *cache_node = (CacheNode *) arg;
+
+    if (atomic_fetch_or_explicit(&cache_node -> pins, CACHE_NODE_FREED,
+                memory_order_acq_rel) == 0) {
+        discard_cache_node(cache_node);
+    }
+}
+
+/*
+ * discard_cache_node - free a retired cache object node nobody reads
+ */
+static void discard_cache_node(CacheNode *cache_node) {
+    /* released with no lock held */
+    atomic_fetch_sub_explicit(&cache_shard(cache_node -> hash) ->
+            retired_bytes, cache_node -> charge, memory_order_relaxed);
+    free_cache_chunks(cache_node);
+}
+
+/*
+ * free_cache_chunks - free the chunk of cache_node and its segments
+ */
+static void free_cache_chunks(CacheNode *cache_node) {
+    char **segments = cache_node_segments(cache_node);
+    size_t body = cache_node -> size - cache_node -> head_size;
+    uint32_t i, count = cache_node -> segments;
+
+    for (i = 0; i < count; i++) {
+        slab_free(segments[i], i + 1 < count ? CACHE_SEGMENT_SIZE :
+                body - (size_t) i * CACHE_SEGMENT_SIZE);
+    }
+    slab_free(cache_node, node_chunk_size(cache_node -> key_size,
+                count ? cache_node -> head_size : cache_node -> size,
+                count));
+}
+
+/*
+ * cache_node_setup - set up the fields of cache_node, built for the key
+ *      of hash, which takes charge bytes of chunks, cost the origin
+ *      cost microseconds and has filled bytes of its object written
+ */
+static void cache_node_setup(CacheNode *cache_node, uint64_t hash,
+        size_t charge, unsigned long cost, size_t filled) {
+    cache_node -> charge = charge;
+    cache_node -> cost = cost < UINT32_MAX ? cost : UINT32_MAX;
+    cache_node -> hash = hash;
+    atomic_init(&cache_node -> freq, 0);
+    atomic_init(&cache_node -> pins, 0);
+    atomic_init(&cache_node -> filled, filled);
+    atomic_init(&cache_node -> failed, 0);
+    atomic_init(&cache_node -> tails, NULL);
+}
+
+/*
+ * tail_wake - hand the tails waiting on cache_node to the mailboxes of
+ *      their workers, with tail_lock held
+ */
+static void tail_wake(CacheNode *cache_node) {
+    CacheTail *t;
+
+    while ((t = atomic_load_explicit(&cache_node -> tails,
+                    memory_order_relaxed)) != NULL) {
+        CacheMailbox *mb = t -> mailbox;
+        uint64_t one = 1;
+
+        atomic_store_explicit(&cache_node -> tails, t -> next,
+                memory_order_relaxed);
+        t -> state = CACHE_TAIL_DELIVERING;
+        t -> next = NULL;
+        if (mb -> tail) {
+            mb -> tail -> next = t;
+            mb -> tail = t;
+            continue;
+        }
+        mb -> head = mb -> tail = t;
+        /* the first one in wakes the worker, which takes them all */
+        if (write(mb -> fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            unix_error_non_exit("eventfd write error");
+        }
+    }
+}
+
+/*
+ * cache_hash - the 64-bit FNV-1a hash of a cache key
+ */
+static uint64_t cache_hash(const char *key) {
+    uint64_t hash = 14695981039346656037ULL;
+
+    for (; *key; key++) {
+        hash ^= (unsigned char) *key;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * cache_ghost_tag - the bits of hash a ghost keeps, above those
+ *      choosing its slot
+ */
+static uint32_t cache_ghost_tag(uint64_t hash) {
+    return (uint32_t) (hash >> 24);
+}
+
+/*
+ * table_new - allocate an empty index table of size buckets.
+ *      Returns the table, NULL if malloc failed.
+ */
+static CacheTable *table_new(size_t size) {
+    CacheTable *table;
+    size_t i;
+
+    if ((table = (CacheTable *) malloc(table_bytes(size))) == NULL) {
+        unix_error_non_exit("malloc for cache index error");
+        return NULL;
+    }
+    table -> size = size;
+    for (i = 0; i < size; i++) {
+        atomic_init(&table -> buckets[i], NULL);
+    }
+    return table;
+}
+
+/*
+ * table_bytes - the bytes an index table of size buckets takes
+ */
+static size_t table_bytes(size_t size) {
+    return sizeof(CacheTable) + size * sizeof(_Atomic(CacheNode *));
+}
+
+/*
+ * index_insert - publish cache_node in the index, into the new table
+ *      if it is being resized, growing the index if it is too full
+ */
+static void index_insert(CacheShard *shard, CacheNode *cache_node) {
+    CacheIndex *index = &shard -> index;
+    CacheTable *table;
+    _Atomic(CacheNode *) *bucket;
+
+    index_rehash_step(shard);
+    if ((table = atomic_load_explicit(&index -> tables[1],
+                    memory_order_relaxed)) == NULL) {
+        table = atomic_load_explicit(&index -> tables[0],
+                memory_order_relaxed);
+    }
+    bucket = &table -> buckets[cache_node -> hash & (table -> size - 1)];
+    atomic_init(&cache_node -> hash_next,
+            atomic_load_explicit(bucket, memory_order_relaxed));
+    /* the node is complete before a lookup can reach it */
+    atomic_store_explicit(bucket, cache_node, memory_order_release);
+    index -> count++;
+    shard -> logical += cache_node -> key_size + cache_node -> size;
+
+    table = atomic_load_explicit(&index -> tables[0], memory_order_relaxed);
+    if (!atomic_load_explicit(&index -> tables[1], memory_order_relaxed) &&
+            index -> count > table -> size) {
+        index_resize(shard, table -> size * 2);
+    }
+}
+
+/*
+ * index_remove - unlink cache_node from the index, shrinking the index
+ *      if it is mostly empty. The node keeps its own link, so a lookup
+ *      standing on it goes on down the chain.
+ */
+static void index_remove(CacheShard *shard, CacheNode *cache_node) {
+    CacheIndex *index = &shard -> index;
+    CacheTable *table;
+    _Atomic(CacheNode *) *pp;
+    CacheNode *p;
+    int t;
+
+    for (t = 0; t < 2; t++) {
+        table = atomic_load_explicit(&index -> tables[t],
+                memory_order_relaxed);
+        if (table == NULL) {
+            break;
+        }
+        pp = &table -> buckets[cache_node -> hash & (table -> size - 1)];
+        while ((p = atomic_load_explicit(pp, memory_order_relaxed)) != NULL &&
+                p != cache_node) {
+            pp = &p -> hash_next;
+        }
+        if (p) {
+            atomic_store_explicit(pp, atomic_load_explicit(
+                        &cache_node -> hash_next, memory_order_relaxed),
+                    memory_order_release);
+            index -> count--;
+            shard -> logical -= cache_node -> key_size + cache_node -> size;
+            break;
+        }
+    }
+    index_rehash_step(shard);
+    table = atomic_load_explicit(&index -> tables[0], memory_order_relaxed);
+    if (!atomic_load_explicit(&index -> tables[1], memory_order_relaxed) &&
+            table -> size > CACHE_INDEX_MIN_BUCKETS &&
+            index -> count < table -> size / 8) {
+        index_resize(shard, table -> size / 2);
+    }
+}
+
+/*
+ * index_resize - start moving the nodes into a new table of size
+ *      buckets. If it cannot be allocated, the index stays as it is.
+ */
+static void index_resize(CacheShard *shard, size_t size) {
+    CacheIndex *index = &shard -> index;
+    CacheTable *table;
+
+    if ((table = table_new(size)) == NULL) {
+        return;
+    }
+    shard -> overhead += table_bytes(size);
+    index -> rehash_pos = 0;
+    atomic_store_explicit(&index -> tables[1], table, memory_order_release);
+}
+
+/*
+ * index_rehash_step - while resizing, move the next few buckets
+ *      to the new table, which replaces the old one once all are moved
+ */
+static void index_rehash_step(CacheShard *shard) {
+    CacheIndex *index = &shard -> index;
+    CacheTable *from = atomic_load_explicit(&index -> tables[0],
+            memory_order_relaxed);
+    CacheTable *to = atomic_load_explicit(&index -> tables[1],
+            memory_order_relaxed);
+    _Atomic(CacheNode *) *bucket;
+    CacheNode *p, *next;
+    size_t n;
+
+    if (to == NULL) {
+        return;
+    }
+    /* odd until the chains are moved, and table 1 is table 0 if the
+     * move is done, so the lookups meanwhile know to search again */
+    atomic_store_explicit(&index -> moving,
+            atomic_load_explicit(&index -> moving, memory_order_relaxed) + 1,
+            memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (n = 0; n < CACHE_REHASH_STEP && index -> rehash_pos < from -> size;
+            n++) {
+        bucket = &from -> buckets[index -> rehash_pos++];
+        p = atomic_load_explicit(bucket, memory_order_relaxed);
+        atomic_store_explicit(bucket, NULL, memory_order_release);
+        for (; p; p = next) {
+            _Atomic(CacheNode *) *dest =
+                &to -> buckets[p -> hash & (to -> size - 1)];
+            next = atomic_load_explicit(&p -> hash_next, memory_order_relaxed);
+            atomic_store_explicit(&p -> hash_next,
+                    atomic_load_explicit(dest, memory_order_relaxed),
+                    memory_order_relaxed);
+            atomic_store_explicit(dest, p, memory_order_release);
+        }
+    }
+    if (index -> rehash_pos == from -> size) {
+        /* lookups may still be walking the old table */
+        atomic_store_explicit(&index -> tables[0], to, memory_order_release);
+        atomic_store_explicit(&index -> tables[1], NULL, memory_order_release);
+        shard -> overhead -= table_bytes(from -> size);
+        epoch_retire(&shard -> retired, &from -> retire, free, from);
+    }
+    atomic_store_explicit(&index -> moving,
+            atomic_load_explicit(&index -> moving, memory_order_relaxed) + 1,
+            memory_order_release);
+}
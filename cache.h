@@ -1,28 +1,340 @@
-/*
- * cache.h - type declarations and function declarations for the proxy cache
- *
- * Author: Tian Xin
- * Andrew ID: txin
- */
-#include <stdlib.h>
-
-#define MAX_CACHE_SIZE 1049000
-#define MAX_OBJECT_SIZE 102400
-
-/* the cache object linked list node */
-typedef struct cache_node_type {
-    char *absolute_uri;
-    char *content;
-    size_t size;
-    time_t timestamp;
-    struct cache_node_type *next;
-    struct cache_node_type *prev;
-} CacheNode;
-
-void init_cache();
-CacheNode *find_cache_node(char *absolute_uri);
-void delete_cache_node(CacheNode *cache_node);
-void evict_cache();
-CacheNode *get_cache(char *absolute_uri);
-void put_cache(char *absolute_uri, char *content, size_t size);
-
+/*
+ * cache.h - type declarations and function declarations for the proxy cache
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ */
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/uio.h>
+#include "buffer.h"
+#include "epoch.h"
+#include "tinylfu.h"
+
+#define MAX_CACHE_SIZE 1049000     /* the budget unless told otherwise */
+#define MAX_OBJECT_SIZE 102400      /* the object limit unless told
+                                       otherwise */
+#define CACHE_MAX_OBJECT (64 * 1024 * 1024) /* and the most it can be */
+#define CACHE_SEGMENT_SIZE (32 * 1024 - 64) /* bytes of a body segment,
+                                               four fill a slab page */
+#define CACHE_DEFAULT_SHARDS 8      /* shards unless told otherwise */
+#define CACHE_INDEX_MIN_BUCKETS 64  /* smallest index table, a power of 2 */
+#define CACHE_REHASH_STEP 16        /* buckets moved per write while
+                                       resizing */
+#define CACHE_LOOKUP_RETRIES 4      /* searches of a miss racing a rehash
+                                       before it is taken as a miss */
+#define CACHE_FREQ_MAX 3            /* hits counted per node, see get_cache */
+#define CACHE_TOUCH_BATCH 64        /* hits a thread buffers for the policy
+                                       and the sketch, see cache_touch */
+#define CACHE_GHOST_OBJECT 512      /* object size ghosts are sized for */
+#define CACHE_QUEUES 2              /* queues a policy may keep per shard */
+#define CACHE_HIGH_WATERMARK 90     /* percent of a shard waking the
+                                       reclaimer */
+#define CACHE_LOW_WATERMARK 80      /* percent the reclaimer evicts down to */
+#define CACHE_RECLAIM_BATCH 32      /* evictions per hold of the writer lock */
+
+typedef struct cache_shard_type CacheShard;
+typedef struct cache_tail_type CacheTail;
+
+/* the cache object linked list node, in a single chunk with its key
+ * and the object after it. An object too large for one chunk keeps only
+ * its head there, followed by the segments its body is split into. What
+ * the lookups read comes first, packed in one cache line. The object is
+ * immutable once stored, but for one published while it is still
+ * relayed (cache_fill_start), whose bytes up to filled never change. It
+ * is freed once no reader can see it anymore, nor has it pinned */
+typedef struct cache_node_type {
+    uint64_t hash;                      /* hash of the key */
+    _Atomic(struct cache_node_type *) hash_next; /* next in the bucket */
+    uint32_t size;                      /* bytes of the object */
+    uint16_t key_size;                  /* bytes of the key, with its NUL */
+    atomic_uchar freq;                  /* hits, up to CACHE_FREQ_MAX, since
+                                           the policy last looked */
+    uint8_t queue;                      /* the policy queue it is in */
+    uint32_t cost;                      /* microseconds the origin took */
+    uint32_t charge;                    /* bytes of the chunks it takes */
+    uint32_t head_size;                 /* bytes of the head before the
+                                           segments, if it has any */
+    /* the place of the node in the policy, which keeps it either in a
+     * queue or in a heap */
+    union {
+        struct {
+            struct cache_node_type *next;
+            struct cache_node_type *prev;
+        };
+        struct {
+            double priority;            /* its value to the cache, GDSF */
+            uint32_t heap_pos;          /* where it is in the heap, GDSF */
+            uint32_t uses;              /* hits the policy took in, GDSF */
+        };
+    };
+    uint32_t segments;                  /* segments of the body, 0 if
+                                           the object is in the chunk */
+    atomic_uint pins;                   /* senders still reading it, and
+                                           CACHE_NODE_FREED once retired */
+    atomic_uint filled;                 /* bytes of the object written,
+                                           size once it is complete */
+    atomic_uchar failed;                /* whether its fill broke off */
+    _Atomic(CacheTail *) tails;         /* readers waiting for more of
+                                           it, see cache_tail_wait */
+    EpochDeferred retire;               /* its release after eviction, and
+                                           the list of victims before */
+    char data[];                        /* the key, then the object or
+                                           its head and segments */
+} CacheNode;
+
+#define CACHE_NODE_FREED (1u << 31)     /* pins of a node to be freed by
+                                           its last sender */
+
+/* the key of a cache node */
+#define cache_node_key(n) ((n) -> data)
+/* the object of a cache node, or the head of a segmented one */
+#define cache_node_content(n) ((n) -> data + (n) -> key_size)
+/* the bytes of the object of a cache node written so far */
+#define cache_node_filled(n) atomic_load_explicit(&(n) -> filled, \
+            memory_order_acquire)
+/* the segments of the body of a cache node, after the head, aligned */
+#define cache_node_segments(n) ((char **) ((n) -> data + \
+            (((n) -> key_size + (n) -> head_size + 7) & ~(size_t) 7)))
+
+/* a body on its way into the cache, collected as it is relayed. It
+ * stays in first while it fits in a segment, and is then written
+ * straight into segments, the last of them partly filled */
+typedef struct cache_fill_type {
+    Buffer first;                       /* the body while it is small */
+    char **segments;                    /* the segments, slab chunks of
+                                           CACHE_SEGMENT_SIZE bytes */
+    size_t count;                       /* segments in use */
+    size_t room;                        /* segments there is room for */
+    size_t size;                        /* bytes of the body */
+} CacheFill;
+
+typedef void (*CacheTailCallback)(CacheTail *t);
+
+/* where a tail is */
+typedef enum {
+    CACHE_TAIL_IDLE,                    /* not waiting, or called back */
+    CACHE_TAIL_WAITING,                 /* waiting on the node's fill */
+    CACHE_TAIL_DELIVERING,              /* more came, queued in its
+                                           worker's mailbox */
+} CacheTailState;
+
+/* the tails of a worker which more came for, signalled through an
+ * eventfd */
+typedef struct cache_mailbox_type {
+    int fd;                             /* the eventfd, read by the
+                                           worker's loop */
+    CacheTail *head;                    /* tails to call back, oldest
+                                           first */
+    CacheTail *tail;
+} CacheMailbox;
+
+/* a reader of a node still being filled, called back on its worker
+ * once more of the node is in or the fill broke off */
+struct cache_tail_type {
+    CacheTailState state;               /* where the tail is */
+    CacheTailCallback callback;         /* called by the worker */
+    void *data;                         /* owner of the tail */
+    CacheNode *node;                    /* the node waited on */
+    CacheMailbox *mailbox;              /* the worker to call back */
+    CacheTail *next;                    /* next waiter or next in the
+                                           mailbox */
+};
+
+/* a queue of cache nodes, the newest at the head */
+typedef struct cache_queue_type {
+    CacheNode *head;
+    CacheNode *tail;
+    size_t size;                        /* bytes of the nodes */
+    size_t count;                       /* the nodes */
+} CacheQueue;
+
+/* a remembered key, evicted in the ghost's seq-th eviction. Only a
+ * tag of its hash is kept, so a ghost takes 8 bytes per key */
+typedef struct cache_ghost_slot_type {
+    uint32_t tag;
+    uint32_t seq;
+} CacheGhostSlot;
+
+/* the hashes of recently evicted keys, one slot per hash value.
+ * A newer key may take the slot of an older one, so it forgets early */
+typedef struct cache_ghost_type {
+    CacheGhostSlot *slots;
+    size_t size;                        /* slots, a power of 2 */
+    uint32_t seq;                       /* evictions remembered so far,
+                                           wrapping around */
+} CacheGhost;
+
+/* an eviction policy, see cache_lru.c, cache_clock.c, cache_s3fifo.c,
+ * cache_arc.c and cache_gdsf.c. Called by the writer of the shard
+ * alone; lookups only count hits in the freq of the nodes, and buffer
+ * them for touch if the policy has it */
+typedef struct cache_policy_type {
+    const char *name;
+    int ghosts;                         /* ghosts it keeps in a shard */
+    /* take the new node in, into one of the shard's queues */
+    void (*insert)(CacheShard *shard, CacheNode *cache_node);
+    /* choose the node to evict, reordering the queues as it goes */
+    CacheNode *(*victim)(CacheShard *shard);
+    /* the node victim would choose if no more hits came in, leaving the
+     * queues and the counts as they are */
+    CacheNode *(*peek)(CacheShard *shard);
+    /* take a node being evicted or deleted out of the queues */
+    void (*unlink)(CacheShard *shard, CacheNode *cache_node);
+    /* put a victim taken out back where it was, as it is not evicted
+     * after all. The victims come back in the reverse order */
+    void (*restore)(CacheShard *shard, CacheNode *cache_node);
+    /* the victim is evicted, remember it in a ghost if the policy keeps
+     * them. May be NULL */
+    void (*evicted)(CacheShard *shard, CacheNode *cache_node);
+    /* a node was hit, told in batches some time after. May be NULL */
+    void (*touch)(CacheShard *shard, CacheNode *cache_node);
+} CachePolicy;
+
+/* a table of index buckets */
+typedef struct cache_table_type {
+    size_t size;                        /* buckets, a power of 2 */
+    EpochDeferred retire;               /* its release once replaced */
+    _Atomic(CacheNode *) buckets[];     /* the chains */
+} CacheTable;
+
+/* the hash index of the cache nodes, with chained buckets. While it is
+ * resized, the nodes move from table 0 to table 1 a few buckets at a time */
+typedef struct cache_index_type {
+    _Atomic(CacheTable *) tables[2];    /* the table, and the new one
+                                           while resizing */
+    atomic_uint moving;         /* odd while chains are being moved,
+                                   bumped twice by every move */
+    size_t rehash_pos;          /* next bucket of table 0 to move */
+    size_t count;               /* the nodes indexed */
+} CacheIndex;
+
+/* a thread waiting for a cache lock */
+typedef struct cache_waiter_type {
+    sem_t ready;                        /* posted when the lock is
+                                           handed over */
+    struct cache_waiter_type *next;
+} CacheWaiter;
+
+/* the writer lock of a shard. It is handed over to the waiters in the
+ * order they came, so no writer waits behind more than those before it */
+typedef struct cache_lock_type {
+    sem_t mutex;                        /* protects the fields below */
+    int held;                           /* whether a writer owns it */
+    CacheWaiter *head;                  /* the oldest waiter */
+    CacheWaiter *tail;                  /* the newest waiter */
+    /* metrics, updated by the owner */
+    uint64_t acquires;                  /* times it was taken */
+    uint64_t contended;                 /* of which had to wait */
+    uint64_t wait_ns;                   /* total time waited */
+    uint64_t wait_max_ns;               /* longest time waited */
+} CacheLock;
+
+/* a part of the cache, holding the keys of some hashes. Aligned so the
+ * locks of two shards never share a cache line */
+struct cache_shard_type {
+    _Alignas(64) CacheLock writer_lock;     /* the writer lock */
+    CacheQueue queues[CACHE_QUEUES];        /* the nodes, as the policy
+                                               orders them */
+    CacheGhost ghosts[CACHE_QUEUES];        /* keys the policy evicted */
+    size_t target;                          /* bytes the policy aims
+                                               queue 0 at, if it adapts */
+    CacheNode **heap;                       /* the nodes by priority */
+    size_t heap_count;                      /* nodes in the heap */
+    size_t heap_size;                       /* room in the heap */
+    double inflation;                       /* the priority of the last
+                                               victim, the GDSF clock */
+    size_t size;                            /* bytes of the chunks stored */
+    size_t overhead;                        /* bytes of the shard itself,
+                                               its index, ghosts, sketch
+                                               and heap */
+    size_t capacity;                        /* bytes the chunks and the
+                                               overhead may take */
+    size_t logical;                         /* bytes of the keys and
+                                               objects stored */
+    atomic_size_t retired_bytes;            /* bytes of the chunks
+                                               retired, not yet freed */
+    int reclaim;                            /* over the high watermark,
+                                               the reclaimer is told */
+    CacheIndex index;                       /* the hash index of the nodes */
+    EpochList retired;                      /* unlinked, not yet freed */
+    TinyLfu sketch;                         /* accesses to the keys */
+    uint64_t evictions;                     /* nodes evicted */
+    uint64_t reclaimed;                     /* of which by the reclaimer */
+    uint64_t admitted;                      /* new nodes worth the victims */
+    uint64_t rejected;                      /* new nodes not stored */
+    uint64_t ghost_hits;                    /* inserts of keys in a ghost */
+};
+
+/* the lookups of a thread, on a cache line of its own */
+typedef struct cache_counters_type {
+    _Alignas(64) atomic_ulong hits;
+    atomic_ulong misses;
+    atomic_ulong hit_bytes;                 /* bytes served from the cache */
+    atomic_ulong fill_readers;              /* hits on objects still being
+                                               filled */
+    struct cache_counters_type *next;       /* all the threads */
+} CacheCounters;
+
+extern CachePolicy lru_policy;
+extern CachePolicy clock_policy;
+extern CachePolicy s3fifo_policy;
+extern CachePolicy arc_policy;
+extern CachePolicy gdsf_policy;
+
+int init_cache(int nshards, size_t capacity, size_t max_object,
+        CachePolicy *policy, int admit);
+int cache_resize(size_t capacity, size_t max_object);
+size_t cache_pressure(size_t cap);
+size_t cache_capacity(void);
+size_t cache_effective_capacity(void);
+size_t cache_max_object(void);
+CachePolicy *cache_find_policy(const char *name);
+CacheNode *find_cache_node(CacheShard *shard, char *absolute_uri,
+        uint64_t hash);
+void delete_cache_node(CacheShard *shard, CacheNode *cache_node);
+void evict_cache(CacheShard *shard);
+CacheNode *get_cache(char *absolute_uri);
+void release_cache(CacheNode *cache_node);
+void cache_pin(CacheNode *cache_node);
+void cache_unpin(CacheNode *cache_node);
+int cache_node_iov(CacheNode *cache_node, size_t offset, struct iovec *iov,
+        int max);
+void put_cache(const char *absolute_uri, const char *head, size_t head_size,
+        CacheFill *body, unsigned long cost);
+void cache_fill_init(CacheFill *fill);
+int cache_fill_append(CacheFill *fill, const char *data, size_t n);
+void cache_fill_free(CacheFill *fill);
+CacheNode *cache_fill_start(const char *absolute_uri, const char *head,
+        size_t head_size, size_t size, unsigned long cost);
+int cache_fill_write(CacheNode *cache_node, const char *data, size_t n);
+void cache_fill_end(CacheNode *cache_node);
+int cache_node_failed(CacheNode *cache_node);
+int cache_mailbox_init(CacheMailbox *mb);
+void cache_mailbox_bind(CacheMailbox *mb);
+void cache_mailbox_drain(CacheMailbox *mb);
+void cache_tail_init(CacheTail *t, CacheTailCallback callback, void *data);
+void cache_tail_wait(CacheTail *t, CacheNode *cache_node, size_t offset);
+void cache_tail_cancel(CacheTail *t);
+void cache_stats(Buffer *b);
+
+/* queues and ghosts, used by the policies */
+void cache_queue_push(CacheQueue *q, CacheNode *cache_node);
+void cache_queue_append(CacheQueue *q, CacheNode *cache_node);
+void cache_queue_unlink(CacheQueue *q, CacheNode *cache_node);
+void cache_queue_remove(CacheShard *shard, CacheNode *cache_node);
+void cache_queue_restore(CacheShard *shard, CacheNode *cache_node);
+void cache_queue_move(CacheShard *shard, CacheNode *cache_node, int queue);
+CacheNode *cache_queue_coldest(CacheQueue *q, int *freq);
+void cache_ghost_add(CacheGhost *g, uint64_t hash);
+int cache_ghost_take(CacheShard *shard, CacheGhost *g, uint64_t hash,
+        size_t limit);
+size_t cache_ghost_count(CacheGhost *g, size_t limit);
+
+#endif /* __CACHE_H__ */
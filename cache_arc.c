@@ -0,0 +1,141 @@
+/*
+ * cache_arc.c - the ARC eviction policy of the cache
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * Adaptive replacement splits the nodes into those seen once lately
+ * (queue 0, T1) and those seen at least twice (queue 1, T2), and keeps
+ * a ghost of the keys recently evicted from each (B1 and B2). A key
+ * coming back while in B1 shows T1 was too small, so the target size of
+ * T1 grows, and one in B2 shrinks it; either way the key goes to T2.
+ * Eviction takes from T1 while it is over its target, else from T2.
+ *
+ * Lookups do not move their hits from T1 to T2, as that would need the
+ * writer lock. As in CAR, the clock variant of ARC, a node found at the
+ * tail of T1 with hits counted moves to T2 then, and one found at the
+ * tail of T2 goes back to its head, with its count cleared. Sizes are
+ * in bytes, and the ghosts remember as many keys as the shard holds.
+ */
+#include "cache.h"
+
+/* function declarations */
+static void arc_insert(CacheShard *shard, CacheNode *cache_node);
+static CacheNode *arc_victim(CacheShard *shard);
+static CacheNode *arc_peek(CacheShard *shard);
+static void arc_evicted(CacheShard *shard, CacheNode *cache_node);
+
+/* end function declarations */
+
+CachePolicy arc_policy = {
+    "arc",
+    2,
+    arc_insert,
+    arc_victim,
+    arc_peek,
+    cache_queue_remove,
+    cache_queue_restore,
+    arc_evicted,
+    NULL,
+};
+
+/*
+ * arc_insert - a new node goes to T1, unless its key is in a ghost,
+ *      which then moves the target of T1 toward that ghost's side
+ */
+static void arc_insert(CacheShard *shard, CacheNode *cache_node) {
+    size_t count = shard -> queues[0].count + shard -> queues[1].count;
+    size_t b1 = cache_ghost_count(&shard -> ghosts[0], count);
+    size_t b2 = cache_ghost_count(&shard -> ghosts[1], count);
+    size_t delta;
+
+    cache_node -> queue = 1;
+    if (cache_ghost_take(shard, &shard -> ghosts[0], cache_node -> hash,
+                count)) {
+        delta = cache_node -> size * (b2 > b1 ? b2 / b1 : 1);
+        shard -> target = shard -> capacity - shard -> target > delta ?
+            shard -> target + delta : shard -> capacity;
+    }
+    else if (cache_ghost_take(shard, &shard -> ghosts[1],
+                cache_node -> hash, count)) {
+        delta = cache_node -> size * (b1 > b2 ? b1 / b2 : 1);
+        shard -> target = shard -> target > delta ?
+            shard -> target - delta : 0;
+    }
+    else {
+        cache_node -> queue = 0;
+    }
+    cache_queue_push(&shard -> queues[cache_node -> queue], cache_node);
+}
+
+/*
+ * arc_victim - evict from T1 while it is over its target, moving the
+ *      nodes hit there to T2, else from T2
+ */
+static CacheNode *arc_victim(CacheShard *shard) {
+    CacheQueue *t1 = &shard -> queues[0];
+    CacheQueue *t2 = &shard -> queues[1];
+    size_t moves = t2 -> count;
+    CacheNode *tail;
+
+    for (;;) {
+        if (t1 -> count && (t2 -> count == 0 ||
+                    t1 -> size > shard -> target)) {
+            tail = t1 -> tail;
+            if (atomic_load_explicit(&tail -> freq, memory_order_relaxed)) {
+                /* shrinks T1, so this ends */
+                atomic_store_explicit(&tail -> freq, 0,
+                        memory_order_relaxed);
+                cache_queue_move(shard, tail, 1);
+                moves++;
+                continue;
+            }
+            return tail;
+        }
+        tail = t2 -> tail;
+        /* once round T2 at most, should lookups keep hitting */
+        if (atomic_load_explicit(&tail -> freq, memory_order_relaxed) &&
+                moves-- > 0) {
+            atomic_store_explicit(&tail -> freq, 0, memory_order_relaxed);
+            cache_queue_move(shard, tail, 1);
+            continue;
+        }
+        return tail;
+    }
+}
+
+/*
+ * arc_peek - the node arc_victim comes to, passing over the nodes hit in
+ *      T1 as if they had moved to T2
+ */
+static CacheNode *arc_peek(CacheShard *shard) {
+    CacheQueue *t1 = &shard -> queues[0];
+    CacheQueue *t2 = &shard -> queues[1];
+    size_t size = t1 -> size, count = t2 -> count;
+    CacheNode *p, *moved = NULL, *coldest;
+    int freq;
+
+    for (p = t1 -> tail; p && (count == 0 || size > shard -> target);
+            p = p -> prev) {
+        if (atomic_load_explicit(&p -> freq, memory_order_relaxed) == 0) {
+            return p;
+        }
+        if (moved == NULL) {
+            moved = p;
+        }
+        size -= p -> size;
+        count++;
+    }
+    if ((coldest = cache_queue_coldest(t2, &freq)) != NULL && freq == 0) {
+        return coldest;
+    }
+    /* with all of T2 hit, the nodes moved come round to its tail first */
+    return moved ? moved : t2 -> tail;
+}
+
+/*
+ * arc_evicted - remember the key in the ghost of the queue it was in
+ */
+static void arc_evicted(CacheShard *shard, CacheNode *cache_node) {
+    cache_ghost_add(&shard -> ghosts[cache_node -> queue], cache_node -> hash);
+}
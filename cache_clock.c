@@ -0,0 +1,69 @@
+/*
+ * cache_clock.c - the CLOCK eviction policy of the cache
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * The nodes are kept on a circle, which the queue holds with the hand
+ * at the tail: new nodes go in just behind the hand, at the head, and
+ * moving the hand over a node moves it from the tail to the head. The
+ * hit count of a node is its clock counter. The hand takes one off the
+ * count of every node it passes, and evicts the first one found with
+ * none left, so a node hit often survives a few rounds of the hand.
+ */
+#include "cache.h"
+
+/* function declarations */
+static void clock_insert(CacheShard *shard, CacheNode *cache_node);
+static CacheNode *clock_victim(CacheShard *shard);
+static CacheNode *clock_peek(CacheShard *shard);
+
+/* end function declarations */
+
+CachePolicy clock_policy = {
+    "clock",
+    0,
+    clock_insert,
+    clock_victim,
+    clock_peek,
+    cache_queue_remove,
+    cache_queue_restore,
+    NULL,
+    NULL,
+};
+
+/*
+ * clock_insert - a new node goes in just behind the hand
+ */
+static void clock_insert(CacheShard *shard, CacheNode *cache_node) {
+    cache_node -> queue = 0;
+    cache_queue_push(&shard -> queues[0], cache_node);
+}
+
+/*
+ * clock_victim - move the hand on to the first node with no hits left
+ */
+static CacheNode *clock_victim(CacheShard *shard) {
+    CacheQueue *q = &shard -> queues[0];
+    size_t moves = q -> count * CACHE_FREQ_MAX;
+    CacheNode *tail;
+    int freq;
+
+    /* every count is used up by then, unless lookups keep hitting */
+    while ((freq = atomic_load_explicit(&(tail = q -> tail) -> freq,
+                    memory_order_relaxed)) > 0 && moves-- > 0) {
+        atomic_store_explicit(&tail -> freq, freq - 1, memory_order_relaxed);
+        cache_queue_move(shard, tail, 0);
+    }
+    return tail;
+}
+
+/*
+ * clock_peek - the node the hand finds with no hits left first: the one
+ *      with the fewest, nearest the hand of those
+ */
+static CacheNode *clock_peek(CacheShard *shard) {
+    int freq;
+
+    return cache_queue_coldest(&shard -> queues[0], &freq);
+}
@@ -0,0 +1,221 @@
+/*
+ * cache_gdsf.c - the GreedyDual-Size-Frequency eviction policy
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * Not every object costs the same to miss: a small object from a slow
+ * origin is worth more of the cache than a large one from a fast origin.
+ * Every node gets the priority
+ *
+ *      inflation + uses * cost / size
+ *
+ * where cost is how long its origin took to send it, uses how often it
+ * was asked for, and size its bytes, and the node with the lowest
+ * priority is evicted, so the cache keeps what would take the longest
+ * to fetch again per byte it holds. The inflation is the priority of
+ * the last victim: raising it ages the nodes not hit for a while, which
+ * keep their old, lower, priority.
+ *
+ * The nodes are kept in a binary min-heap by priority. Lookups only
+ * count their hits in the node, so the priority of a node is brought up
+ * to date when it comes to the top of the heap with hits counted, and it
+ * sinks back down to where its new priority puts it.
+ */
+#include <math.h>
+#include "csapp.h"
+#include "cache.h"
+#include "proxylib.h"
+
+#define GDSF_HEAP_MIN 64    /* nodes the heap has room for at first */
+
+/* function declarations */
+static void gdsf_insert(CacheShard *shard, CacheNode *cache_node);
+static CacheNode *gdsf_victim(CacheShard *shard);
+static CacheNode *gdsf_peek(CacheShard *shard);
+static void gdsf_unlink(CacheShard *shard, CacheNode *cache_node);
+
+/* helpers */
+static double gdsf_priority(CacheShard *shard, CacheNode *cache_node,
+        uint32_t uses);
+static void heap_lowest(CacheShard *shard, size_t pos, CacheNode **lowest,
+        double *priority);
+static void heap_push(CacheShard *shard, CacheNode *cache_node);
+static void heap_set(CacheShard *shard, size_t pos, CacheNode *cache_node);
+static void heap_up(CacheShard *shard, size_t pos);
+static void heap_down(CacheShard *shard, size_t pos);
+
+/* end function declarations */
+
+CachePolicy gdsf_policy = {
+    "gdsf",
+    0,
+    gdsf_insert,
+    gdsf_victim,
+    gdsf_peek,
+    gdsf_unlink,
+    heap_push,
+    NULL,
+    NULL,
+};
+
+/*
+ * gdsf_insert - a new node was asked for once, by the miss storing it
+ */
+static void gdsf_insert(CacheShard *shard, CacheNode *cache_node) {
+    cache_node -> uses = 1;
+    cache_node -> priority = gdsf_priority(shard, cache_node, 1);
+    heap_push(shard, cache_node);
+}
+
+/*
+ * gdsf_victim - the node of the lowest priority, taking in the hits of
+ *      the nodes found at the top on the way
+ */
+static CacheNode *gdsf_victim(CacheShard *shard) {
+    size_t moves = shard -> heap_count;
+    CacheNode *top;
+    int freq;
+
+    /* once for each node at most, should lookups keep hitting */
+    while ((freq = atomic_load_explicit(&(top = shard -> heap[0]) -> freq,
+                    memory_order_relaxed)) > 0 && moves-- > 0) {
+        atomic_store_explicit(&top -> freq, 0, memory_order_relaxed);
+        top -> uses += freq;
+        top -> priority = gdsf_priority(shard, top, top -> uses);
+        heap_down(shard, 0);
+    }
+    shard -> inflation = top -> priority;
+    return top;
+}
+
+/*
+ * gdsf_unlink - take cache_node out of the heap
+ */
+static void gdsf_unlink(CacheShard *shard, CacheNode *cache_node) {
+    size_t pos = cache_node -> heap_pos;
+    CacheNode *last = shard -> heap[--shard -> heap_count];
+
+    if (last == cache_node) {
+        return;
+    }
+    /* the last node fills the hole, and moves whichever way it must */
+    heap_set(shard, pos, last);
+    heap_up(shard, pos);
+    heap_down(shard, last -> heap_pos);
+}
+
+/*
+ * gdsf_peek - the node gdsf_victim comes to, the one of the lowest
+ *      priority once the hits counted are taken in
+ */
+static CacheNode *gdsf_peek(CacheShard *shard) {
+    CacheNode *lowest = NULL;
+    double priority = HUGE_VAL;
+
+    heap_lowest(shard, 0, &lowest, &priority);
+    return lowest;
+}
+
+/*
+ * gdsf_priority - the priority of cache_node as of now, were it asked
+ *      for uses times
+ */
+static double gdsf_priority(CacheShard *shard, CacheNode *cache_node,
+        uint32_t uses) {
+    unsigned long cost = cache_node -> cost ? cache_node -> cost : 1;
+
+    return shard -> inflation + (double) uses * cost / cache_node -> size;
+}
+
+/*
+ * heap_push - add cache_node to the heap by the priority it has,
+ *      the restore of victims too
+ */
+static void heap_push(CacheShard *shard, CacheNode *cache_node) {
+    if (shard -> heap_count == shard -> heap_size) {
+        /* the heap is part of the overhead of the shard */
+        shard -> overhead -= shard -> heap_size * sizeof(CacheNode *);
+        shard -> heap_size = shard -> heap_size ?
+            shard -> heap_size * 2 : GDSF_HEAP_MIN;
+        shard -> heap = (CacheNode **) Realloc(shard -> heap,
+                shard -> heap_size * sizeof(CacheNode *));
+        shard -> overhead += shard -> heap_size * sizeof(CacheNode *);
+    }
+    heap_set(shard, shard -> heap_count++, cache_node);
+    heap_up(shard, cache_node -> heap_pos);
+}
+
+/*
+ * heap_set - put cache_node at pos of the heap
+ */
+static void heap_set(CacheShard *shard, size_t pos, CacheNode *cache_node) {
+    shard -> heap[pos] = cache_node;
+    cache_node -> heap_pos = pos;
+}
+
+/*
+ * heap_up - move the node at pos up while its parent is of a higher
+ *      priority
+ */
+static void heap_up(CacheShard *shard, size_t pos) {
+    CacheNode *cache_node = shard -> heap[pos];
+
+    while (pos > 0 && shard -> heap[(pos - 1) / 2] -> priority >
+            cache_node -> priority) {
+        heap_set(shard, pos, shard -> heap[(pos - 1) / 2]);
+        pos = (pos - 1) / 2;
+    }
+    heap_set(shard, pos, cache_node);
+}
+
+/*
+ * heap_down - move the node at pos down while a child is of a lower
+ *      priority
+ */
+static void heap_down(CacheShard *shard, size_t pos) {
+    CacheNode *cache_node = shard -> heap[pos];
+    size_t child;
+
+    while ((child = 2 * pos + 1) < shard -> heap_count) {
+        if (child + 1 < shard -> heap_count && shard -> heap[child + 1]
+                -> priority < shard -> heap[child] -> priority) {
+            child++;
+        }
+        if (shard -> heap[child] -> priority >= cache_node -> priority) {
+            break;
+        }
+        heap_set(shard, pos, shard -> heap[child]);
+        pos = child;
+    }
+    heap_set(shard, pos, cache_node);
+}
+
+/*
+ * heap_lowest - look below pos for a node of a priority under priority
+ *      once its hits are taken in, and make it the lowest. Taking in
+ *      hits only raises a priority, so a node already at priority or
+ *      over is passed over with all the nodes below it.
+ */
+static void heap_lowest(CacheShard *shard, size_t pos, CacheNode **lowest,
+        double *priority) {
+    CacheNode *cache_node;
+    double p;
+    int freq;
+
+    if (pos >= shard -> heap_count ||
+            (cache_node = shard -> heap[pos]) -> priority >= *priority) {
+        return;
+    }
+    p = cache_node -> priority;
+    if ((freq = atomic_load_explicit(&cache_node -> freq,
+                    memory_order_relaxed)) > 0) {
+        p = gdsf_priority(shard, cache_node, cache_node -> uses + freq);
+    }
+    if (p < *priority) {
+        *lowest = cache_node;
+        *priority = p;
+    }
+    heap_lowest(shard, 2 * pos + 1, lowest, priority);
+    heap_lowest(shard, 2 * pos + 2, lowest, priority);
+}
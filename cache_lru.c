@@ -0,0 +1,82 @@
+/*
+ * cache_lru.c - the LRU eviction policy of the cache
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * The nodes are kept in one queue in recency order, the newest at the
+ * head, and the node at the tail is evicted. Lookups do not move their
+ * hits up, as that would need the writer lock. Each thread buffers its
+ * hits instead, and moves them up in a batch once it has
+ * CACHE_TOUCH_BATCH of them (cache_touch). A hit not moved up yet,
+ * still buffered or dropped as the lock was busy, has its count set, so
+ * a node found at the tail with hits counted is moved up then, with its
+ * count cleared.
+ */
+#include "cache.h"
+
+/* function declarations */
+static void lru_insert(CacheShard *shard, CacheNode *cache_node);
+static CacheNode *lru_victim(CacheShard *shard);
+static CacheNode *lru_peek(CacheShard *shard);
+static void lru_touch(CacheShard *shard, CacheNode *cache_node);
+
+/* end function declarations */
+
+CachePolicy lru_policy = {
+    "lru",
+    0,
+    lru_insert,
+    lru_victim,
+    lru_peek,
+    cache_queue_remove,
+    cache_queue_restore,
+    NULL,
+    lru_touch,
+};
+
+/*
+ * lru_insert - a new node is the most recently used
+ */
+static void lru_insert(CacheShard *shard, CacheNode *cache_node) {
+    cache_node -> queue = 0;
+    cache_queue_push(&shard -> queues[0], cache_node);
+}
+
+/*
+ * lru_victim - the least recently used node, moving up the nodes
+ *      hit whose move up is still to come
+ */
+static CacheNode *lru_victim(CacheShard *shard) {
+    CacheQueue *q = &shard -> queues[0];
+    size_t moves = q -> count;
+    CacheNode *tail;
+
+    /* once round the queue at most, should lookups keep hitting */
+    while (atomic_load_explicit(&(tail = q -> tail) -> freq,
+                memory_order_relaxed) && moves-- > 0) {
+        atomic_store_explicit(&tail -> freq, 0, memory_order_relaxed);
+        cache_queue_move(shard, tail, 0);
+    }
+    return tail;
+}
+
+/*
+ * lru_peek - the node nearest the tail with no hits counted, else the
+ *      tail, which comes back there once the others moved up
+ */
+static CacheNode *lru_peek(CacheShard *shard) {
+    CacheNode *coldest;
+    int freq;
+
+    coldest = cache_queue_coldest(&shard -> queues[0], &freq);
+    return freq == 0 ? coldest : shard -> queues[0].tail;
+}
+
+/*
+ * lru_touch - a hit node is the most recently used
+ */
+static void lru_touch(CacheShard *shard, CacheNode *cache_node) {
+    atomic_store_explicit(&cache_node -> freq, 0, memory_order_relaxed);
+    cache_queue_move(shard, cache_node, 0);
+}
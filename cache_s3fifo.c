@@ -0,0 +1,128 @@
+/*
+ * cache_s3fifo.c - the S3-FIFO eviction policy of the cache
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * Most objects are only ever asked for once, so new nodes go to a small
+ * FIFO queue (queue 0) of a tenth of the shard, which filters them out
+ * quickly: a node reaching its tail without a hit is evicted and its key
+ * remembered in a ghost, the others move on to the main FIFO queue
+ * (queue 1). Keys coming back while still remembered skip the small
+ * queue. The main queue evicts like CLOCK, putting nodes with hits left
+ * back at its head with one hit taken off.
+ *
+ * A burst of objects seen once, a crawler scan say, thus only flushes
+ * the small queue and never the nodes proven to be hit.
+ */
+#include "cache.h"
+
+#define S3FIFO_SMALL_PERCENT 10     /* share of the shard for new nodes */
+
+/* function declarations */
+static void s3fifo_insert(CacheShard *shard, CacheNode *cache_node);
+static CacheNode *s3fifo_victim(CacheShard *shard);
+static CacheNode *s3fifo_peek(CacheShard *shard);
+static void s3fifo_evicted(CacheShard *shard, CacheNode *cache_node);
+
+/* end function declarations */
+
+CachePolicy s3fifo_policy = {
+    "s3fifo",
+    1,
+    s3fifo_insert,
+    s3fifo_victim,
+    s3fifo_peek,
+    cache_queue_remove,
+    cache_queue_restore,
+    s3fifo_evicted,
+    NULL,
+};
+
+/*
+ * s3fifo_insert - a new node goes to the small queue, unless its key
+ *      was evicted from there lately. The ghost remembers as many keys
+ *      as the shard holds nodes, which the main queue mostly does.
+ */
+static void s3fifo_insert(CacheShard *shard, CacheNode *cache_node) {
+    size_t count = shard -> queues[0].count + shard -> queues[1].count;
+
+    cache_node -> queue = cache_ghost_take(shard, &shard -> ghosts[0],
+            cache_node -> hash, count) ? 1 : 0;
+    cache_queue_push(&shard -> queues[cache_node -> queue], cache_node);
+}
+
+/*
+ * s3fifo_victim - evict from the small queue while it is over its share,
+ *      moving the nodes hit there to the main queue, else from the main
+ */
+static CacheNode *s3fifo_victim(CacheShard *shard) {
+    CacheQueue *small_q = &shard -> queues[0];
+    CacheQueue *main_q = &shard -> queues[1];
+    size_t moves = main_q -> count * CACHE_FREQ_MAX;
+    CacheNode *tail;
+    int freq;
+
+    for (;;) {
+        if (small_q -> count && (main_q -> count == 0 || small_q -> size >
+                    shard -> capacity / 100 * S3FIFO_SMALL_PERCENT)) {
+            tail = small_q -> tail;
+            if (atomic_load_explicit(&tail -> freq, memory_order_relaxed)) {
+                /* shrinks the small queue, so this ends */
+                atomic_store_explicit(&tail -> freq, 0,
+                        memory_order_relaxed);
+                cache_queue_move(shard, tail, 1);
+                moves += CACHE_FREQ_MAX;
+                continue;
+            }
+            return tail;
+        }
+        tail = main_q -> tail;
+        /* every count is used up by then, unless lookups keep hitting */
+        if ((freq = atomic_load_explicit(&tail -> freq,
+                        memory_order_relaxed)) > 0 && moves-- > 0) {
+            atomic_store_explicit(&tail -> freq, freq - 1,
+                    memory_order_relaxed);
+            cache_queue_move(shard, tail, 1);
+            continue;
+        }
+        return tail;
+    }
+}
+
+/*
+ * s3fifo_peek - the node s3fifo_victim comes to, passing over the nodes
+ *      hit in the small queue as if they had moved to the main queue
+ */
+static CacheNode *s3fifo_peek(CacheShard *shard) {
+    CacheQueue *small_q = &shard -> queues[0];
+    CacheQueue *main_q = &shard -> queues[1];
+    size_t size = small_q -> size, count = main_q -> count;
+    CacheNode *p, *moved = NULL, *coldest;
+    int freq;
+
+    for (p = small_q -> tail; p && (count == 0 || size >
+                shard -> capacity / 100 * S3FIFO_SMALL_PERCENT);
+            p = p -> prev) {
+        if (atomic_load_explicit(&p -> freq, memory_order_relaxed) == 0) {
+            return p;
+        }
+        if (moved == NULL) {
+            moved = p;
+        }
+        size -= p -> size;
+        count++;
+    }
+    /* the nodes moved would be at the head with no hits left */
+    coldest = cache_queue_coldest(main_q, &freq);
+    return freq == 0 || moved == NULL ? coldest : moved;
+}
+
+/*
+ * s3fifo_evicted - remember the keys evicted from the small queue
+ */
+static void s3fifo_evicted(CacheShard *shard, CacheNode *cache_node) {
+    if (cache_node -> queue == 0) {
+        cache_ghost_add(&shard -> ghosts[0], cache_node -> hash);
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ * cgroup.c - finding the proxy's own cgroup
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * The limits the proxy runs under are set in the files of its own
+ * cgroup, not in those at the root of the hierarchy, which in a
+ * container without a cgroup namespace belong to the host. The cgroup
+ * is the one /proc/self/cgroup names, in the unified hierarchy (v2) or
+ * in the v1 hierarchy of a controller.
+ */
+#include "csapp.h"
+#include "cgroup.h"
+#include "proxylib.h"
+
+/*
+ * cgroup_self - the proxy's own cgroup as /proc/self/cgroup names it:
+ *      into v2 its path in the unified hierarchy, into v1 the one in
+ *      the v1 hierarchy of controller, each MAXLINE bytes and left ""
+ *      if there is none.
+ *      Returns 0 on success, -1 if the process's cgroups are unknown.
+ */
+int cgroup_self(const char *controller, char *v1, char *v2) {
+    char line[MAXLINE], *controllers, *name, *token, *save;
+    FILE *f;
+
+    v1[0] = v2[0] = '\0';
+    if ((f = fopen("/proc/self/cgroup", "r")) == NULL) {
+        return -1;
+    }
+    /* id:controllers:path, the controllers empty for v2 */
+    while (fgets(line, MAXLINE, f)) {
+        line[strcspn(line, "\n")] = '\0';
+        if ((controllers = strchr(line, ':')) == NULL ||
+                (name = strchr(++controllers, ':')) == NULL) {
+            continue;
+        }
+        *name++ = '\0';
+        if (*controllers == '\0') {
+            snprintf(v2, MAXLINE, "%s", name);
+            continue;
+        }
+        /* "cpu" is not "cpuset", the whole name is compared */
+        for (token = strtok_r(controllers, ",", &save); token;
+                token = strtok_r(NULL, ",", &save)) {
+            if (!strcmp(token, controller)) {
+                snprintf(v1, MAXLINE, "%s", name);
+            }
+        }
+    }
+    fclose(f);
+    return 0;
+}
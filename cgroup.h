@@ -0,0 +1,14 @@
+/*
+ * cgroup.h - declarations for finding the proxy's own cgroup
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ */
+#ifndef __CGROUP_H__
+#define __CGROUP_H__
+
+#define CGROUP_ROOT "/sys/fs/cgroup"    /* where the hierarchies are */
+
+int cgroup_self(const char *controller, char *v1, char *v2);
+
+#endif /* __CGROUP_H__ */
@@ -0,0 +1,1472 @@
+/*
+ * conn.c - the per-connection proxy state machine
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * Every client connection is a Conn driven by the I/O events of its
+ * worker, so one thread serves any number of connections and a slow
+ * client or origin only ever holds up its own Conn. A connection moves
+ * through the states
+ *
+ *   CONN_READ_REQUEST - buffer the request until the headers are complete,
+ *                       then validate it and look it up in the cache
+ *   CONN_RESOLVE      - on a cache miss, wait for the resolver unless an
+ *                       idle connection to the origin is left in the
+ *                       upstream pool or its name is in the DNS cache
+ *   CONN_CONNECT      - connect to the origin in progress
+ *   CONN_RELAY        - write the rewritten request to the origin and relay
+ *                       the response to the client, keeping a copy for
+ *                       the cache
+ *   CONN_FLUSH        - write what is left to the client, then close
+ *
+ * Client connections are persistent: every response is framed with its
+ * Content-length (or re-chunked for an HTTP/1.1 client when the origin
+ * did not tell the length), and once it is queued the connection goes
+ * back to CONN_READ_REQUEST for the next request instead of CONN_FLUSH.
+ * The client may pipeline. Requests keep being read into the request
+ * buffer while one is served, and are started one after the other by
+ * conn_advance, so the responses go out in order. No further request
+ * is started while too many response bytes wait for the client.
+ *
+ * A hit is copied to the client buffer, except the body of a large
+ * object, which the engine writes straight from the segments of the
+ * cache with vectored writes (conn_client_iov), after the bytes queued
+ * before it. It stays pinned in the cache until then, and no further
+ * request is started meanwhile, so nothing can be queued behind it.
+ *
+ * A response whose length the origin told is published to the cache as
+ * soon as its head is relayed (conn_start_fill), and its body is written
+ * into the cache as it comes. The requests for it meanwhile are hits on
+ * an object still being filled, written out as far as it is filled:
+ * once a reader caught up, it waits for more (cache_tail_wait), and the
+ * engine is called back with conn_tailed. So concurrent misses on a
+ * popular object cost a single fetch. The client which asked first is
+ * one of these readers too: the body goes to the cache alone, and the
+ * origin is read as fast as it sends, whatever the pace of any client.
+ * Should that client leave, its connection stays to fill the cache
+ * without it (conn_drop_client). Only if the origin fails, or memory
+ * runs out, does the fetch break off, and its readers are closed,
+ * having got part of it. A chunked or close-delimited response, whose
+ * length is not known until its end, is not published early: it is
+ * stored whole once it is in (put_cache), and concurrent misses on it
+ * each fetch it from the origin meanwhile.
+ *
+ * A request goes through the stages
+ *
+ *   parse   (doit)                - validate the request line and the URI
+ *   lookup  (serve_proxy)         - answer a hit from the cache
+ *   reuse   (conn_connect_origin) - take an idle connection to the origin
+ *   resolve (conn_resolve)        - otherwise look the origin name up
+ *                                   in the DNS cache (dns.c), at most
+ *                                   once per request
+ *   connect (conn_connect_next)   - connect to the resolved addresses
+ *   relay   (conn_origin_data)    - pass the response on
+ *
+ * so a hit is served straight from memory, and neither a hit nor a miss
+ * on a pooled origin connection waits for the resolver. Nor does the
+ * worker ever: a name missing from the DNS cache is looked up by
+ * a resolver thread, and the connection sits in CONN_RESOLVE until the
+ * engine hands the answer back with conn_resolved.
+ *
+ * Every connection has a deadline: the worker sweeps its connections
+ * about once a second (conn_expire), and one which made no progress
+ * for too long is timed out. A client may sit idle between requests
+ * for CONN_IDLE_TIMEOUT seconds, and the rest gets CONN_READ_TIMEOUT
+ * seconds without progress: a client sending its request, which is
+ * due whole from its first byte on however it trickles in, a client
+ * taking its response, and an origin resolving, connecting or sending
+ * the response. An origin which
+ * stalls before the head of its response gets the client a 504.
+ *
+ * The origin is asked for a persistent HTTP/1.1 connection. Its response
+ * is framed by the parser in http.c, so once the last byte is in, the
+ * connection goes back to the upstream pool (upstream.c) for the next
+ * miss on the same origin instead of being closed.
+ *
+ * This file only holds the protocol. It never touches a descriptor
+ * itself: an engine (epoll readiness in conn_epoll.c, io_uring
+ * completions in conn_uring.c) feeds it the bytes read with
+ * conn_client_data and conn_origin_data, writes out whatever the protocol
+ * queued in the per-direction buffers, and asks conn_wants_client_read and
+ * conn_wants_origin_read whether to read any further. The origin is not
+ * read while too much of its response is still waiting for the client,
+ * unless it fills the cache.
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "conn.h"
+#include "dns.h"
+#include "upstream.h"
+#include "proxylib.h"
+
+#define HTTP_PROTOCOL "http://"
+#define HTTP_PROTOCOL_LEN 7
+#define PORT_NUM_MIN 0
+#define PORT_NUM_MAX 65535
+#define DEFAULT_HTTP_PORT_STR "80"
+#define STATS_URI "/proxy-stats"   /* asks the proxy itself for metrics */
+#define RESIZE_URI "/proxy-cache"  /* POST ?size=&object= resizes the
+                                      cache */
+#define RESIZE_URI_LEN 12
+
+/* You won't lose style points for including this long line in your code */
+static const char *user_agent_hdr = "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n";
+/* Connection header values toward the client */
+static const char *connection_hdr = "Connection: close\r\n";
+static const char *keep_alive_hdr = "Connection: keep-alive\r\n";
+/* Connection header value toward the origin */
+static const char *origin_connection_hdr = "Connection: keep-alive\r\n";
+
+static __thread Conn *conns = NULL;  /* this worker's connections */
+
+/* function declarations */
+
+/* proxy core functions */
+static void conn_next_request(Conn *c);
+static void doit(Conn *c);
+static int client_keep_alive(char *headers, int http11);
+static void serve_proxy(Conn *c, char *hostname, char *port,
+        char *uri, char *headers);
+static void parse_uri(char *request_uri, char *hostname,
+        char *port, char *uri);
+static void serve_stats(Conn *c);
+static void serve_resize(Conn *c, char *query);
+static int client_is_local(Conn *c);
+static void serve_text(Conn *c, Buffer *body);
+static void conn_connect_origin(Conn *c);
+static void conn_resolve(Conn *c);
+static void conn_connect_next(Conn *c);
+static void conn_connected(Conn *c);
+static int conn_relay_head(Conn *c);
+static void conn_start_fill(Conn *c);
+static void conn_drop_client(Conn *c);
+static int conn_relay_body(Conn *c, Buffer *out);
+static void conn_finish_origin(Conn *c);
+static void conn_response_done(Conn *c);
+static void conn_reset_request(Conn *c);
+static const char *client_connection_hdr(Conn *c);
+static unsigned long monotonic_us(void);
+static void conn_touch(Conn *c);
+static int conn_timeout(Conn *c);
+static int conn_waits_origin(Conn *c);
+
+/* client error response functions */
+static void clienterror(Conn *c, char *cause, char *errnum,
+        char *shortmsg, char *longmsg);
+static void internal_server_error(Conn *c);
+static void gateway_timeout(Conn *c);
+
+/* end function declarations */
+
+/*
+ * conn_new - set up the state of a freshly accepted client fd,
+ *      served by engine from its loop.
+ *      Returns the connection, or NULL after closing fd on failure.
+ */
+Conn *conn_new(ConnEngine *engine, void *loop, int fd) {
+    Conn *c;
+    if ((c = (Conn *) calloc(1, sizeof(Conn))) == NULL) {
+        /* if malloc failure, drop this connection and carry on */
+        unix_error_non_exit("malloc for connection error");
+        if (close(fd) < 0) {
+            fprintf(stderr, "close failure\n");
+        }
+        return NULL;
+    }
+    c -> engine = engine;
+    c -> loop = loop;
+    c -> state = CONN_READ_REQUEST;
+    c -> clientfd = fd;
+    c -> originfd = -1;
+    buffer_init(&c -> request);
+    buffer_init(&c -> to_client);
+    buffer_init(&c -> to_origin);
+    buffer_init(&c -> client_tx);
+    buffer_init(&c -> origin_tx);
+    buffer_init(&c -> origin_request);
+    buffer_init(&c -> body);
+    cache_fill_init(&c -> cache_fill);
+    http_response_init(&c -> response);
+    conn_touch(c);
+    c -> next = conns;
+    if (conns) {
+        conns -> prev = c;
+    }
+    conns = c;
+    return c;
+}
+
+/*
+ * conn_client_data - n bytes of requests arrived from the client,
+ *      0 if it closed, -1 on a read error
+ */
+void conn_client_data(Conn *c, char *buf, ssize_t n) {
+    if (n < 0) {
+        conn_close(c);
+        return;
+    }
+    if (n == 0) {
+        /* no more requests, but the ones buffered are still served */
+        c -> client_eof = 1;
+        if (c -> state == CONN_READ_REQUEST && c -> hit == NULL) {
+            conn_next_request(c);
+        }
+        return;
+    }
+    if (c -> state == CONN_FLUSH) {
+        /* nothing more is expected from this client */
+        return;
+    }
+    if (c -> state == CONN_READ_REQUEST &&
+            buffer_pending(&c -> request) == 0) {
+        /* the whole request is due from its first byte on */
+        conn_touch(c);
+    }
+    /* keep one more byte to terminate the requests as a string */
+    if (buffer_append(&c -> request, buf, n) < 0 ||
+            buffer_reserve(&c -> request, 1) < 0) {
+        unix_error_non_exit("malloc for request error");
+        conn_close(c);
+        return;
+    }
+    c -> request.data[c -> request.len] = '\0';
+    /* a large hit still being written goes out before anything else */
+    if (c -> state == CONN_READ_REQUEST && c -> hit == NULL) {
+        conn_next_request(c);
+    }
+}
+
+/*
+ * conn_advance - start the next pipelined request once the last
+ *      response is queued, unless too much of it waits for the client
+ *      or a large hit is still written out from the cache.
+ *      Returns 1 if a request was started, 0 if not.
+ */
+int conn_advance(Conn *c) {
+    int started = 0;
+
+    while (!c -> closed && c -> state == CONN_READ_REQUEST &&
+            c -> request_ready && c -> hit == NULL &&
+            buffer_pending(&c -> to_client) +
+            buffer_pending(&c -> client_tx) < CONN_RELAY_HIGH_WATER) {
+        c -> request_ready = 0;
+        conn_next_request(c);
+        started = 1;
+    }
+    return started;
+}
+
+/*
+ * conn_client_iov - point iov at up to max pieces of what is to be
+ *      written to the client: the bytes of b, followed by the rest of
+ *      the large hit once b holds all the bytes queued before it, as
+ *      far as it is filled. With nothing to write but more of the hit to
+ *      come, the engine is called back with conn_tailed once it comes.
+ *      Returns the pieces, 0 if there is nothing to write.
+ */
+int conn_client_iov(Conn *c, Buffer *b, struct iovec *iov, int max) {
+    int count = 0, n;
+
+    if (c -> clientfd < 0) {
+        /* nobody to write to */
+        return 0;
+    }
+    if (buffer_pending(b) > 0) {
+        iov[count].iov_base = buffer_head(b);
+        iov[count++].iov_len = buffer_pending(b);
+    }
+    if (c -> hit && (b == &c -> to_client ||
+                buffer_pending(&c -> to_client) == 0)) {
+        n = cache_node_iov(c -> hit, c -> hit_offset, iov + count,
+                max - count);
+        if (count == 0 && n == 0 && !c -> hit_waiting) {
+            /* caught up with the fill, the engine hears of more */
+            c -> hit_waiting = 1;
+            cache_tail_wait(&c -> tail, c -> hit, c -> hit_offset);
+        }
+        count += n;
+    }
+    return count;
+}
+
+/*
+ * conn_client_sent - n bytes of the pieces of conn_client_iov were
+ *      written, those of b first. The hit is let go once it is written.
+ */
+void conn_client_sent(Conn *c, Buffer *b, size_t n) {
+    size_t queued = buffer_pending(b) < n ? buffer_pending(b) : n;
+
+    if (n > 0) {
+        conn_touch(c);
+    }
+    buffer_consume(b, queued);
+    if (n == queued) {
+        return;
+    }
+    c -> hit_offset += n - queued;
+    if (c -> hit_offset == c -> hit -> size) {
+        cache_unpin(c -> hit);
+        c -> hit = NULL;
+    }
+}
+
+/*
+ * conn_next_request - serve the next buffered request if its headers
+ *      are complete
+ */
+static void conn_next_request(Conn *c) {
+    char *end;
+
+    if (buffer_pending(&c -> request) > 0) {
+        /* only the new bytes and the 3 before can complete "\r\n\r\n" */
+        if ((end = strstr(buffer_head(&c -> request) + c -> request_scan,
+                        "\r\n\r\n")) != NULL) {
+            c -> request_size = end + 4 - buffer_head(&c -> request);
+            /* the origin is due from here on */
+            conn_touch(c);
+            /* a NUL would cut the head short for the string parsing */
+            if (memchr(buffer_head(&c -> request), '\0',
+                        c -> request_size) != NULL) {
+                clienterror(c, "", "400", "Bad Request",
+                            "Request headers contain a NUL byte.");
+                return;
+            }
+            doit(c);
+            return;
+        }
+        c -> request_scan = buffer_pending(&c -> request) > 3 ?
+            buffer_pending(&c -> request) - 3 : 0;
+        if (buffer_pending(&c -> request) > CONN_MAX_REQUEST) {
+            clienterror(c, "", "400", "Bad Request",
+                        "Request headers are too large.");
+            return;
+        }
+    }
+    if (c -> client_eof) {
+        /* the client is done, so are we once the responses are out */
+        c -> state = CONN_FLUSH;
+    }
+}
+
+/*
+ * doit - handle an HTTP GET request in the proxy
+ */
+static void doit(Conn *c) {
+    char method[MAXLINE];       /* the request method */
+    char request_uri[MAXLINE];  /* the request uri */
+    char version[MAXLINE];      /* the request http version */
+    int post;                   /* whether it is a POST */
+
+    char hostname[MAXLINE];     /* the requested server hostname */
+    char port[MAXLINE];         /* the requested server port */
+    char uri[MAXLINE];          /* the requested resource uri */
+
+    /* split the request line from the header lines */
+    char *line = buffer_head(&c -> request);
+    char *headers = strstr(line, "\r\n");
+    if (headers == NULL) {
+        clienterror(c, "", "400", "Bad Request",
+                    "Malformed request line.");
+        return;
+    }
+    if (headers - line >= MAXLINE) {
+        clienterror(c, "", "400", "Bad Request",
+                    "Request line is too long.");
+        return;
+    }
+    *headers = '\0';
+    headers += 2;
+
+    printf("%s\n", line);
+    if (sscanf(line, "%s %s %s", method, request_uri, version) != 3) {
+        clienterror(c, line, "400", "Bad Request",
+                    "Malformed request line.");
+        printf("Rejected request %s\n", line);
+        return;
+    }
+    /* check if is GET method, or POST to change the proxy itself */
+    post = !strcasecmp(method, "POST");
+    if (strcasecmp(method, "GET") && !post) {
+        clienterror(c, method, "501", "Not Implemented",
+                    "This proxy does not implement this method");
+        printf("Rejected method %s\n", method);
+        return;
+    }
+    /* check if http version is HTTP/1.0 or HTTP/1.1 */
+    if (strcmp(version, "HTTP/1.0") && strcmp(version, "HTTP/1.1")) {
+        clienterror(c, version, "501", "Not Implemented",
+                    "This HTTP version is not supported.");
+        printf("Rejected version %s\n", version);
+        return;
+    }
+    /* the request is understood, the connection may carry on after it */
+    c -> client_http11 = !strcmp(version, "HTTP/1.1");
+    c -> keep_alive = client_keep_alive(headers, c -> client_http11);
+
+    /* requests for the proxy itself */
+    if (!strcmp(request_uri, STATS_URI) && !post) {
+        serve_stats(c);
+        return;
+    }
+    if (!strncmp(request_uri, RESIZE_URI, RESIZE_URI_LEN) &&
+            (request_uri[RESIZE_URI_LEN] == '\0' ||
+             request_uri[RESIZE_URI_LEN] == '?')) {
+        /* a GET must not change anything, a link followed by mistake
+         * or a prefetch would empty the cache */
+        if (!post) {
+            clienterror(c, method, "405", "Method Not Allowed",
+                    "The cache is only resized with POST.");
+            printf("Rejected resize with %s\n", method);
+            return;
+        }
+        /* only the host the proxy runs on may resize its cache */
+        if (!client_is_local(c)) {
+            clienterror(c, RESIZE_URI, "403", "Forbidden",
+                    "The cache can only be resized from the proxy host.");
+            printf("Rejected resize from a remote client\n");
+            return;
+        }
+        serve_resize(c, request_uri + RESIZE_URI_LEN);
+        return;
+    }
+    if (post) {
+        clienterror(c, method, "501", "Not Implemented",
+                    "This proxy does not implement this method");
+        printf("Rejected method %s\n", method);
+        return;
+    }
+    /* check if the protocol is http */
+    if (strstr(request_uri, HTTP_PROTOCOL) != request_uri) {
+        clienterror(c, request_uri, "400", "Bad Request",
+                    "Request URI does not lead with \"http://\".");
+        printf("Rejected URI %s\n", request_uri);
+        return;
+    }
+    /* parse the hostname, port and uri from request_uri */
+    parse_uri(request_uri, hostname, port, uri);
+
+    /* the name is only resolved on a miss, see conn_resolve */
+    serve_proxy(c, hostname, port, uri, headers);
+}
+
+/*
+ * client_keep_alive - whether the client wants to keep the connection
+ *      after the request with these headers
+ */
+static int client_keep_alive(char *headers, int http11) {
+    char *p, *key, *value;
+    size_t keylen, valuelen;
+    int keep_alive = http11;
+
+    for (p = headers; (p = http_next_header(p, &key, &keylen,
+                    &value, &valuelen)) != NULL; ) {
+        if ((keylen == 10 && !strncasecmp("Connection", key, keylen)) ||
+                (keylen == 16 &&
+                 !strncasecmp("Proxy-Connection", key, keylen))) {
+            if (http_has_token(value, valuelen, "close")) {
+                return 0;
+            }
+            if (http_has_token(value, valuelen, "keep-alive")) {
+                keep_alive = 1;
+            }
+        }
+        else if ((keylen == 14 &&
+                    !strncasecmp("Content-Length", key, keylen) &&
+                    strtol(value, NULL, 10) != 0) ||
+                (keylen == 17 &&
+                 !strncasecmp("Transfer-Encoding", key, keylen))) {
+            /* a request body is not read, so nothing can follow it */
+            return 0;
+        }
+    }
+    return keep_alive;
+}
+
+/*
+ * serve_proxy - serve requested content as a proxy.
+ *      A cache hit is answered right away, a miss starts the connect
+ *      to the origin with the rewritten request queued.
+ */
+static void serve_proxy(Conn *c, char *hostname, char *port,
+        char *uri, char *headers) {
+    if ((c -> cache_key = (char *) malloc(MAXLINE)) == NULL) {
+        /* if malloc failure, ignore this request, keep calm and carry on */
+        internal_server_error(c);
+        return;
+    }
+    /* construct the cache key */
+    snprintf(c -> cache_key, MAXLINE, "%s:%s%s", hostname, port, uri);
+
+    CacheNode *cache_node;
+
+    if ((cache_node = get_cache(c -> cache_key)) != NULL) {
+        /* cache hit, return the result directly, with our connection
+         * header after the status line. A segmented one only has its
+         * head copied, the engine writes the segments out as they are,
+         * and so the rest of one still being filled as it comes */
+        char *content = cache_node_content(cache_node);
+        size_t copied = cache_node -> segments ? cache_node -> head_size :
+            cache_node_filled(cache_node);
+        char *eol = memchr(content, '\n', copied);
+        size_t line = eol ? eol + 1 - content : 0;
+        int rc = buffer_append(&c -> to_client, content, line) < 0 ||
+            buffer_printf(&c -> to_client, "%s",
+                    client_connection_hdr(c)) < 0 ||
+            buffer_append(&c -> to_client, content + line,
+                    copied - line) < 0;
+        if (!rc && copied < cache_node -> size) {
+            cache_pin(cache_node);
+            c -> hit = cache_node;
+            c -> hit_offset = copied;
+        }
+        /* the hit was in a read section for the copy, no lock is held */
+        release_cache(cache_node);
+        if (rc) {
+            internal_server_error(c);
+            return;
+        }
+        conn_response_done(c);
+        return;
+    }
+
+    /* transmit first line of request */
+    Buffer *req = &c -> origin_request;
+    int rc = buffer_printf(req, "GET %s HTTP/1.1\r\n", uri);
+
+    /* transmit request headers, rewriting the ones we own */
+    int host_set = 0;
+    char *p, *eol;
+    for (p = headers; (eol = strstr(p, "\r\n")) != NULL && eol != p;
+            p = eol + 2) {
+        char *colon = memchr(p, ':', eol - p);
+        if (colon) {
+            size_t keylen = colon - p;
+            if (keylen == 4 && !strncasecmp("Host", p, keylen)) {
+                host_set = 1;
+            }
+            if (keylen == 10 && !strncasecmp("User-Agent", p, keylen)) {
+                /* ignore user-agent header */
+                continue;
+            }
+            if (keylen == 10 && !strncasecmp("Connection", p, keylen)) {
+                /* ignore connection header */
+                continue;
+            }
+            if (keylen == 10 && !strncasecmp("Keep-Alive", p, keylen)) {
+                /* ignore keep-alive header */
+                continue;
+            }
+            if (keylen == 16 &&
+                    !strncasecmp("Proxy-Connection", p, keylen)) {
+                /* ignore proxy-connection header */
+                continue;
+            }
+        }
+        rc |= buffer_append(req, p, eol + 2 - p);
+    }
+    /* write host-header */
+    if (!host_set) {
+        rc |= buffer_printf(req, "Host: %s\r\n", hostname);
+    }
+    /* write user-agent and connection headers */
+    rc |= buffer_printf(req, "%s%s\r\n",
+            user_agent_hdr, origin_connection_hdr);
+
+    if (rc < 0 || (c -> origin_key = (char *) malloc(MAXLINE)) == NULL ||
+            (c -> origin_host = strdup(hostname)) == NULL ||
+            (c -> origin_port = strdup(port)) == NULL) {
+        /* if malloc failure, ignore this request and carry on */
+        internal_server_error(c);
+        return;
+    }
+    snprintf(c -> origin_key, MAXLINE, "%s:%s", hostname, port);
+    /* the time to the end of the response is what a miss costs */
+    c -> fetch_start = monotonic_us();
+    /* a resize meanwhile does not change what this response may store */
+    c -> cache_limit = cache_max_object();
+    conn_connect_origin(c);
+}
+
+/*
+ * conn_connect_origin - queue the request and get a connection to
+ *      the origin, an idle one from the upstream pool if there is one
+ */
+static void conn_connect_origin(Conn *c) {
+    int fd;
+
+    buffer_consume(&c -> to_origin, buffer_pending(&c -> to_origin));
+    if (buffer_append(&c -> to_origin, buffer_head(&c -> origin_request),
+                buffer_pending(&c -> origin_request)) < 0) {
+        internal_server_error(c);
+        return;
+    }
+    if (!c -> origin_reused && (fd = upstream_get(c -> origin_key)) >= 0) {
+        c -> origin_reused = 1;
+        c -> engine -> adopt_origin(c, fd);
+        c -> state = CONN_RELAY;
+        return;
+    }
+    c -> origin_reused = 0;
+    conn_resolve(c);
+}
+
+/*
+ * conn_resolve - resolve the origin of the request unless that
+ *      was done already, then connect to it
+ */
+static void conn_resolve(Conn *c) {
+    if (c -> addrs) {
+        c -> next_addr = c -> addrs;
+        conn_connect_next(c);
+        return;
+    }
+    if (!dns_resolve(&c -> dns, c -> origin_host, c -> origin_port)) {
+        /* a resolver has it, conn_resolved goes on */
+        c -> state = CONN_RESOLVE;
+        return;
+    }
+    conn_resolved(c);
+}
+
+/*
+ * conn_resolved - the origin name was looked up, connect to its
+ *      addresses or tell the client it cannot be
+ */
+void conn_resolved(Conn *c) {
+    int rc = c -> dns.err;
+
+    if (c -> closed) {
+        return;
+    }
+    conn_touch(c);
+    if (rc != 0) {
+        /* if something's wrong with getaddrinfo, the request is bad. */
+        char cause[MAXLINE];
+        snprintf(cause, MAXLINE, "hostname: %.*s, port: %.*s",
+                 MAXLINE / 4, c -> origin_host, MAXLINE / 4, c -> origin_port);
+        clienterror(c, cause, "400", "Bad Request",
+                    "Malformed hostname or port number.");
+        gai_error_non_exit(rc, "Getaddrinfo error");
+        return;
+    }
+    c -> addrs = c -> next_addr = c -> dns.addrs;
+    c -> dns.addrs = NULL;
+    conn_connect_next(c);
+}
+
+/*
+ * conn_tailed - more of the hit still being filled came, or its fill
+ *      broke off and the client cannot get the rest of it
+ */
+void conn_tailed(Conn *c) {
+    c -> hit_waiting = 0;
+    if (c -> closed) {
+        return;
+    }
+    conn_touch(c);
+    if (c -> hit && cache_node_failed(c -> hit)) {
+        fprintf(stderr, "cached response of %s broke off\n",
+                cache_node_key(c -> hit));
+        conn_close(c);
+    }
+}
+
+/*
+ * serve_stats - respond with the proxy metrics as plain text
+ */
+static void serve_stats(Conn *c) {
+    Buffer body;
+
+    buffer_init(&body);
+    report_stats(&body);
+    serve_text(c, &body);
+    buffer_free(&body);
+}
+
+/*
+ * serve_resize - resize the cache as the query asks, size= for the
+ *      budget and object= for the object limit in bytes, each with an
+ *      optional k, m or g suffix, and respond with the cache metrics
+ */
+static void serve_resize(Conn *c, char *query) {
+    size_t capacity = 0, max_object = 0;
+    char *param, *save;
+    Buffer body;
+
+    if (*query == '?') {
+        query++;
+    }
+    for (param = strtok_r(query, "&", &save); param;
+            param = strtok_r(NULL, "&", &save)) {
+        if ((strncmp(param, "size=", 5) ||
+                    parse_size(param + 5, &capacity) < 0) &&
+                (strncmp(param, "object=", 7) ||
+                 parse_size(param + 7, &max_object) < 0)) {
+            clienterror(c, RESIZE_URI, "400", "Bad Request",
+                    "Expected size= or object= with a byte count.");
+            return;
+        }
+    }
+    if (cache_resize(capacity, max_object) < 0) {
+        clienterror(c, RESIZE_URI, "400", "Bad Request",
+                "The cache cannot hold its largest objects at that size.");
+        return;
+    }
+    buffer_init(&body);
+    cache_stats(&body);
+    serve_text(c, &body);
+    buffer_free(&body);
+}
+
+/*
+ * client_is_local - whether the client connected over the loopback
+ *      interface.
+ *      Returns 1 if so, 0 otherwise or if its address is unknown.
+ */
+static int client_is_local(Conn *c) {
+    struct sockaddr_storage addr;
+    socklen_t len = sizeof(addr);
+
+    if (getpeername(c -> clientfd, (struct sockaddr *) &addr, &len) < 0) {
+        return 0;
+    }
+    if (addr.ss_family == AF_INET) {
+        struct sockaddr_in *in = (struct sockaddr_in *) &addr;
+        return (ntohl(in -> sin_addr.s_addr) >> 24) == IN_LOOPBACKNET;
+    }
+    if (addr.ss_family == AF_INET6) {
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6 *) &addr;
+        if (IN6_IS_ADDR_V4MAPPED(&in6 -> sin6_addr)) {
+            return in6 -> sin6_addr.s6_addr[12] == IN_LOOPBACKNET;
+        }
+        return IN6_IS_ADDR_LOOPBACK(&in6 -> sin6_addr);
+    }
+    return addr.ss_family == AF_UNIX;
+}
+
+/*
+ * serve_text - respond with body as plain text
+ */
+static void serve_text(Conn *c, Buffer *body) {
+    if (buffer_printf(&c -> to_client,
+                "HTTP/1.1 200 OK\r\n"
+                "Content-type: text/plain\r\n"
+                "Content-length: %zu\r\n%s\r\n",
+                buffer_pending(body), client_connection_hdr(c)) < 0 ||
+            buffer_append(&c -> to_client,
+                buffer_head(body), buffer_pending(body)) < 0) {
+        conn_close(c);
+    }
+    else {
+        conn_response_done(c);
+    }
+}
+
+/*
+ * parse_uri - parse the request uri into hostname, port and the relative uri
+ */
+static void parse_uri(char *request_uri, char *hostname,
+        char *port, char *uri) {
+    char *p;
+    /* Parse hostname */
+    strncpy(hostname, request_uri, MAXLINE);
+    if (strstr(hostname, HTTP_PROTOCOL)) {
+        /* truncate leading "http://" */
+        memmove(hostname, hostname + HTTP_PROTOCOL_LEN,
+                strlen(hostname + HTTP_PROTOCOL_LEN) + 1);
+    }
+    if ((p = strstr(hostname, ":")) != NULL) {
+        /* truncate port */
+        *p = '\0';
+    }
+    if ((p = strstr(hostname, "/")) != NULL) {
+        /* truncate uri after '/' */
+        *p = '\0';
+    }
+
+    /* Parse port number */
+    strncpy(port, request_uri, MAXLINE);
+    if (strstr(port, HTTP_PROTOCOL)) {
+        /* truncate leading "http://" */
+        memmove(port, port + HTTP_PROTOCOL_LEN,
+                strlen(port + HTTP_PROTOCOL_LEN) + 1);
+    }
+    if ((p = strstr(port, "/")) != NULL) {
+        /* truncate uri after '/' */
+        *p = '\0';
+    }
+
+    if ((p = strstr(port, ":")) != NULL) {
+        /* truncate port */
+        memmove(port, p + 1, strlen(p + 1) + 1);
+        /* convert string port number to int, truncating illegal chars */
+        int port_num = atoi(port);
+        if (port_num < PORT_NUM_MIN || port_num > PORT_NUM_MAX) {
+            strncpy(port, DEFAULT_HTTP_PORT_STR, MAXLINE);
+        }
+    }
+    else {
+        /* If there is no port found, specify port num as 80 */
+        strncpy(port, DEFAULT_HTTP_PORT_STR, MAXLINE);
+    }
+
+    /* Parse uri */
+    strncpy(uri, request_uri, MAXLINE);
+    if (strstr(uri, HTTP_PROTOCOL)) {
+        /* truncate leading "http://" */
+        memmove(uri, uri + HTTP_PROTOCOL_LEN,
+                strlen(uri + HTTP_PROTOCOL_LEN) + 1);
+    }
+    if ((p = strstr(uri, "/")) != NULL) {
+        /* get uri after '/' */
+        memmove(uri, p, strlen(p) + 1);
+    }
+    else {
+        /* if no uri is set in the request, set the uri as "/" (the root) */
+        strncpy(uri, "/", MAXLINE);
+    }
+}
+
+/*
+ * conn_connect_next - start connecting to the next resolved
+ *      origin address
+ */
+static void conn_connect_next(Conn *c) {
+    struct addrinfo *p;
+    int rc;
+
+    while ((p = c -> next_addr) != NULL) {
+        c -> next_addr = p -> ai_next;
+        c -> connect_addr = p;
+        if ((rc = c -> engine -> connect(c, p)) < 0) {
+            continue; /* Connect failed, try another */
+        }
+        if (rc == 0) {
+            /* wait for the engine to report the outcome */
+            c -> state = CONN_CONNECT;
+            return;
+        }
+        conn_connected(c);
+        return;
+    }
+    /* all connects failed */
+    internal_server_error(c);
+}
+
+/*
+ * conn_connect_done - the connect to the origin finished,
+ *      with err set to the errno if it failed
+ */
+void conn_connect_done(Conn *c, int err) {
+    if (c -> closed || c -> state != CONN_CONNECT) {
+        return;
+    }
+    conn_touch(c);
+    if (err) {
+        /* this address refused us, try the next one */
+        c -> engine -> close_origin(c);
+        conn_connect_next(c);
+    }
+    else {
+        conn_connected(c);
+    }
+}
+
+/*
+ * conn_connected - the origin accepted the connection, start relaying
+ */
+static void conn_connected(Conn *c) {
+    dns_free(c -> addrs);
+    c -> addrs = c -> next_addr = c -> connect_addr = NULL;
+    c -> state = CONN_RELAY;
+}
+
+/*
+ * conn_origin_data - n bytes of the response arrived from the origin,
+ *      0 if it closed, -1 on a read error. Relay them to the client as
+ *      the parser frames them and keep a copy of the body for the cache.
+ */
+void conn_origin_data(Conn *c, char *buf, ssize_t n) {
+    HttpResponse *r = &c -> response;
+    HttpState was;
+    ssize_t used;
+    size_t pending, body;
+    int rc;
+
+    if (c -> state != CONN_RELAY) {
+        return;
+    }
+    conn_touch(c);
+    if (n < 0) {
+        conn_origin_failed(c);
+        return;
+    }
+    if (n == 0) {
+        if (r -> state == HTTP_UNTIL_CLOSE) {
+            /* the close is what ends this response */
+            conn_finish_origin(c);
+        }
+        else {
+            conn_origin_failed(c);
+        }
+        return;
+    }
+    while (n > 0 && c -> state == CONN_RELAY) {
+        /* a body to re-chunk is decoded aside first */
+        Buffer *out = c -> rechunk ? &c -> body : &c -> to_client;
+        was = r -> state;
+        pending = buffer_pending(out);
+        body = r -> body_size;
+        if ((used = http_response_feed(r, buf, n, out)) < 0) {
+            fprintf(stderr, "bad response from %s\n", c -> origin_key);
+            r -> keep_alive = 0;
+            conn_origin_failed(c);
+            return;
+        }
+        buf += used;
+        n -= used;
+        if (was == HTTP_HEAD && r -> state != HTTP_HEAD &&
+                conn_relay_head(c) < 0) {
+            return;
+        }
+        /* the new body bytes are at the tail of out. They go to the
+         * cache alone if it is being filled, the client reads them
+         * there. Otherwise the copy grows with the body, a segment at a
+         * time, and is dropped once it is too large to cache */
+        c -> cache_object_size += r -> body_size - body;
+        if (c -> filling) {
+            rc = cache_fill_write(c -> filling, buffer_head(out) + pending,
+                    r -> body_size - body);
+            buffer_trim(out, r -> body_size - body);
+            if (rc < 0) {
+                /* out of memory, the readers and this client give up */
+                cache_fill_end(c -> filling);
+                c -> filling = NULL;
+                conn_close(c);
+                return;
+            }
+        }
+        else if (c -> cache_object_size > c -> cache_limit) {
+            cache_fill_free(&c -> cache_fill);
+        }
+        else if (cache_fill_append(&c -> cache_fill,
+                    buffer_head(out) + pending, r -> body_size - body) < 0) {
+            /* not worth failing the response, it is just not cached */
+            c -> cache_object_size = c -> cache_limit + 1;
+            cache_fill_free(&c -> cache_fill);
+        }
+        if (out == &c -> body && conn_relay_body(c, out) < 0) {
+            return;
+        }
+        if (r -> state == HTTP_DONE) {
+            if (n > 0) {
+                /* more than the response, the connection is unusable */
+                r -> keep_alive = 0;
+            }
+            conn_finish_origin(c);
+        }
+    }
+}
+
+/*
+ * conn_relay_head - pass the head of the response on to the client,
+ *      framed so the client can tell where the body ends: by its
+ *      length, by chunks, or failing both by the close.
+ *      Returns 0 on success, -1 after closing the connection.
+ */
+static int conn_relay_head(Conn *c) {
+    HttpResponse *r = &c -> response;
+    size_t before = buffer_pending(&c -> to_client);
+
+    if (r -> content_length < 0 && r -> state != HTTP_DONE) {
+        if (r -> chunked && c -> client_http11) {
+            c -> rechunk = 1;
+        }
+        else {
+            /* only the close can end this body */
+            c -> keep_alive = 0;
+        }
+    }
+    if (buffer_append(&c -> to_client, buffer_head(&r -> head),
+                buffer_pending(&r -> head)) < 0 ||
+            (c -> rechunk && buffer_printf(&c -> to_client,
+                "Transfer-Encoding: chunked\r\n") < 0) ||
+            buffer_printf(&c -> to_client, "%s\r\n",
+                client_connection_hdr(c)) < 0) {
+        unix_error_non_exit("malloc for relay error");
+        conn_close(c);
+        return -1;
+    }
+    c -> cache_object_size += buffer_pending(&c -> to_client) - before;
+    if (r -> content_length >= 0) {
+        conn_start_fill(c);
+    }
+    return 0;
+}
+
+/*
+ * conn_start_fill - publish the response, whose length is known, to
+ *      the cache as its head is relayed, so the requests for it are
+ *      served from the cache while its body is still coming. The
+ *      chunks of the node are sized up front, so a response framed by
+ *      chunks or by the close is not, and waits for put_cache.
+ */
+static void conn_start_fill(Conn *c) {
+    HttpResponse *r = &c -> response;
+    size_t body = r -> state == HTTP_DONE ? 0 : r -> content_length;
+    Buffer head;
+    size_t head_size;
+
+    /* the connection header is added for each client when it is
+     * served */
+    buffer_init(&head);
+    if (buffer_append(&head, buffer_head(&r -> head),
+                buffer_pending(&r -> head)) == 0 &&
+            buffer_append(&head, "\r\n", 2) == 0 &&
+            buffer_pending(&head) + body <= c -> cache_limit) {
+        c -> filling = cache_fill_start(c -> cache_key, buffer_head(&head),
+                buffer_pending(&head), buffer_pending(&head) + body,
+                monotonic_us() - c -> fetch_start);
+    }
+    head_size = buffer_pending(&head);
+    buffer_free(&head);
+    if (c -> filling == NULL) {
+        /* not stored now, so not at the end either */
+        c -> cache_object_size = c -> cache_limit + 1;
+        return;
+    }
+    if (body > 0) {
+        /* the client reads the body from the cache like the others */
+        cache_pin(c -> filling);
+        c -> hit = c -> filling;
+        c -> hit_offset = head_size;
+    }
+}
+
+/*
+ * conn_drop_client - the client of a response still filling the cache
+ *      is gone. Its readers may be many, so the origin is read on into
+ *      the cache, and the connection closes once the response is in.
+ */
+static void conn_drop_client(Conn *c) {
+    if (c -> hit_waiting) {
+        cache_tail_cancel(&c -> tail);
+        c -> hit_waiting = 0;
+    }
+    /* the hit stays pinned until conn_free, an engine may still be
+     * sending from it */
+    c -> keep_alive = 0;
+    c -> client_eof = 1;
+    c -> request_ready = 0;
+    buffer_consume(&c -> to_client, buffer_pending(&c -> to_client));
+    c -> engine -> close_client(c);
+}
+
+/*
+ * conn_relay_body - pass the body bytes decoded into out on to the
+ *      client as a chunk, followed by the last chunk at the end.
+ *      Returns 0 on success, -1 after closing the connection.
+ */
+static int conn_relay_body(Conn *c, Buffer *out) {
+    size_t n = buffer_pending(out);
+
+    if ((n > 0 && (buffer_printf(&c -> to_client, "%zx\r\n", n) < 0 ||
+                    buffer_append(&c -> to_client, buffer_head(out), n) < 0 ||
+                    buffer_append(&c -> to_client, "\r\n", 2) < 0)) ||
+            (c -> response.state == HTTP_DONE &&
+             buffer_append(&c -> to_client, "0\r\n\r\n", 5) < 0)) {
+        unix_error_non_exit("malloc for relay error");
+        conn_close(c);
+        return -1;
+    }
+    buffer_consume(out, n);
+    return 0;
+}
+
+/*
+ * conn_finish_origin - the origin finished its response, park the
+ *      connection for the next request if the origin keeps it, cache
+ *      the response and flush the rest to the client
+ */
+static void conn_finish_origin(Conn *c) {
+    HttpResponse *r = &c -> response;
+    int fd;
+
+    if (r -> keep_alive && (fd = c -> engine -> detach_origin(c)) >= 0) {
+        upstream_put(c -> origin_key, fd);
+    }
+    else {
+        c -> engine -> close_origin(c);
+    }
+
+    /* the cached copy always carries its length, even if the client
+     * got the body chunked or framed by the close. The connection
+     * header is added for each client when it is served. */
+    Buffer head;
+    buffer_init(&head);
+    if (c -> filling) {
+        /* complete, its readers get the rest */
+        cache_fill_end(c -> filling);
+        c -> filling = NULL;
+    }
+    else if (c -> cache_object_size <= c -> cache_limit &&
+            buffer_append(&head, buffer_head(&r -> head),
+                buffer_pending(&r -> head)) == 0 &&
+            (r -> content_length >= 0 ||
+             buffer_printf(&head, "Content-length: %zu\r\n",
+                 r -> body_size) == 0) &&
+            buffer_append(&head, "\r\n", 2) == 0 &&
+            buffer_pending(&head) + c -> cache_fill.size <= c -> cache_limit) {
+        /* put cache object into cache only if its size is small enough,
+         * the cache takes the segments of the body */
+        put_cache(c -> cache_key, buffer_head(&head), buffer_pending(&head),
+                &c -> cache_fill, monotonic_us() - c -> fetch_start);
+    }
+    buffer_free(&head);
+    conn_response_done(c);
+}
+
+/*
+ * monotonic_us - microseconds on the monotonic clock
+ */
+static unsigned long monotonic_us(void) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long) now.tv_sec * 1000000UL + now.tv_nsec / 1000;
+}
+
+/*
+ * conn_touch - the connection made progress, or a new wait began.
+ *      The coarse clock is enough for deadlines of seconds, and cheap
+ *      enough to read on every event.
+ */
+static void conn_touch(Conn *c) {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    c -> active = now.tv_sec;
+}
+
+/*
+ * conn_response_done - the whole response is queued for the client,
+ *      get ready for the next request or close once it is written
+ */
+static void conn_response_done(Conn *c) {
+    if (!c -> keep_alive) {
+        c -> state = CONN_FLUSH;
+        return;
+    }
+    conn_reset_request(c);
+    c -> state = CONN_READ_REQUEST;
+    /* started by conn_advance, which bounds the queued responses */
+    c -> request_ready = 1;
+    conn_touch(c);
+}
+
+/*
+ * conn_reset_request - forget the request just served
+ */
+static void conn_reset_request(Conn *c) {
+    buffer_consume(&c -> request, c -> request_size);
+    c -> request_size = 0;
+    c -> request_scan = 0;
+    c -> keep_alive = 0;
+    c -> client_http11 = 0;
+    buffer_consume(&c -> to_origin, buffer_pending(&c -> to_origin));
+    buffer_consume(&c -> origin_request, buffer_pending(&c -> origin_request));
+    buffer_consume(&c -> body, buffer_pending(&c -> body));
+    c -> origin_reused = 0;
+    c -> rechunk = 0;
+    http_response_free(&c -> response);
+    http_response_init(&c -> response);
+    if (c -> addrs) {
+        dns_free(c -> addrs);
+    }
+    c -> addrs = c -> next_addr = c -> connect_addr = NULL;
+    free(c -> origin_key);
+    free(c -> origin_host);
+    free(c -> origin_port);
+    c -> origin_host = c -> origin_port = NULL;
+    free(c -> cache_key);
+    cache_fill_free(&c -> cache_fill);
+    c -> origin_key = c -> cache_key = NULL;
+    c -> cache_object_size = 0;
+}
+
+/*
+ * client_connection_hdr - the connection header for the response
+ */
+static const char *client_connection_hdr(Conn *c) {
+    return c -> keep_alive ? keep_alive_hdr : connection_hdr;
+}
+
+/*
+ * conn_origin_failed - the origin connection broke. An idle connection
+ *      the origin closed in the meantime is replaced by a fresh one. If
+ *      the client has not seen any of the response yet, tell it,
+ *      otherwise just close.
+ */
+void conn_origin_failed(Conn *c) {
+    if (c -> filling) {
+        /* its readers and this client give up */
+        cache_fill_end(c -> filling);
+        c -> filling = NULL;
+    }
+    if (c -> origin_reused && c -> response.received == 0) {
+        upstream_retried();
+        c -> engine -> close_origin(c);
+        conn_connect_origin(c);
+        return;
+    }
+    if (c -> cache_object_size == 0) {
+        internal_server_error(c);
+    }
+    else {
+        conn_close(c);
+    }
+}
+
+/*
+ * conn_wants_client_read - whether the engine should read the client,
+ *      which it keeps doing while a request is served, for the ones
+ *      pipelined after it, until the request buffer is full
+ */
+int conn_wants_client_read(Conn *c) {
+    return !c -> closed && c -> clientfd >= 0 && !c -> client_eof &&
+        c -> state != CONN_FLUSH &&
+        buffer_pending(&c -> request) <= CONN_MAX_REQUEST;
+}
+
+/*
+ * conn_wants_client_write - whether the engine should wait for the
+ *      client to take more, which it need not while only more of a hit
+ *      still being filled is to come
+ */
+int conn_wants_client_write(Conn *c) {
+    return c -> clientfd >= 0 && (buffer_pending(&c -> to_client) > 0 ||
+            (c -> hit && !c -> hit_waiting));
+}
+
+/*
+ * conn_wants_origin_read - whether the engine should read the origin,
+ *      which it should not while too much is still waiting for the
+ *      client, unless the response goes to the cache, which takes it
+ *      all whatever its readers do
+ */
+int conn_wants_origin_read(Conn *c) {
+    return !c -> closed && c -> state == CONN_RELAY && (c -> filling ||
+            buffer_pending(&c -> to_client) + buffer_pending(&c -> client_tx)
+            < CONN_RELAY_HIGH_WATER);
+}
+
+/*
+ * conn_done - whether the response is completely written, or the
+ *      client is gone, so the connection can be closed
+ */
+int conn_done(Conn *c) {
+    return c -> state == CONN_FLUSH && (c -> clientfd < 0 ||
+            (buffer_pending(&c -> to_client) == 0 &&
+             buffer_pending(&c -> client_tx) == 0 && c -> hit == NULL));
+}
+
+/*
+ * conn_close - tear the connection down, the engine releases it
+ *      once nothing refers to it anymore. A connection filling the
+ *      cache only loses its client, and closes once the fill is done.
+ */
+void conn_close(Conn *c) {
+    if (c -> closed) {
+        return;
+    }
+    if (c -> filling && c -> clientfd >= 0) {
+        conn_drop_client(c);
+        return;
+    }
+    c -> closed = 1;
+    if (c -> state == CONN_RESOLVE) {
+        dns_cancel(&c -> dns);
+    }
+    if (c -> hit_waiting) {
+        cache_tail_cancel(&c -> tail);
+    }
+    if (c -> filling) {
+        /* the engine failed it, its readers give up */
+        cache_fill_end(c -> filling);
+        c -> filling = NULL;
+    }
+    c -> engine -> close(c);
+}
+
+/*
+ * conn_expire - time out the connections of the calling worker which
+ *      made no progress for too long, called by the worker about once
+ *      a second
+ */
+void conn_expire(void) {
+    struct timespec now;
+    Conn *c, *next;
+    int timeout;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+    for (c = conns; c != NULL; c = next) {
+        /* the engine may free c right away */
+        next = c -> next;
+        if (!c -> closed && (timeout = conn_timeout(c)) > 0 &&
+                now.tv_sec - c -> active >= timeout) {
+            c -> engine -> expire(c);
+        }
+    }
+}
+
+/*
+ * conn_timeout - how long the connection may make no progress in its
+ *      current state.
+ *      Returns the seconds, 0 if it may wait for ever.
+ */
+static int conn_timeout(Conn *c) {
+    if (c -> hit_waiting) {
+        /* the fill it waits for has a deadline of its own */
+        return 0;
+    }
+    if (c -> state == CONN_READ_REQUEST &&
+            buffer_pending(&c -> request) == 0 &&
+            buffer_pending(&c -> client_tx) == 0 &&
+            !conn_wants_client_write(c)) {
+        return CONN_IDLE_TIMEOUT;
+    }
+    return CONN_READ_TIMEOUT;
+}
+
+/*
+ * conn_waits_origin - whether the connection waits for the origin
+ *      rather than the client
+ */
+static int conn_waits_origin(Conn *c) {
+    return c -> state == CONN_RESOLVE || c -> state == CONN_CONNECT ||
+        (c -> state == CONN_RELAY && conn_wants_origin_read(c));
+}
+
+/*
+ * conn_timed_out - the connection made no progress for too long.
+ *      A client idle, or too slow to send its request or to take the
+ *      response, is closed. An origin which stalls is given up, and the
+ *      client told so if it has not seen any of the response yet.
+ */
+void conn_timed_out(Conn *c) {
+    if (c -> closed) {
+        return;
+    }
+    if (!conn_waits_origin(c)) {
+        /* a connection filling the cache only loses its client */
+        conn_close(c);
+        return;
+    }
+    fprintf(stderr, "origin %s timed out\n", c -> origin_key);
+    if (c -> state == CONN_RESOLVE) {
+        dns_cancel(&c -> dns);
+    }
+    if (c -> filling) {
+        /* its readers and this client give up */
+        cache_fill_end(c -> filling);
+        c -> filling = NULL;
+    }
+    if (c -> clientfd >= 0 && (c -> state != CONN_RELAY ||
+                c -> response.state == HTTP_HEAD)) {
+        /* no head was relayed yet */
+        gateway_timeout(c);
+    }
+    else {
+        conn_close(c);
+    }
+}
+
+/*
+ * conn_free - release the memory of a closed connection
+ */
+void conn_free(Conn *c) {
+    if (c -> prev) {
+        c -> prev -> next = c -> next;
+    }
+    else {
+        conns = c -> next;
+    }
+    if (c -> next) {
+        c -> next -> prev = c -> prev;
+    }
+    buffer_free(&c -> request);
+    buffer_free(&c -> to_client);
+    buffer_free(&c -> to_origin);
+    buffer_free(&c -> client_tx);
+    buffer_free(&c -> origin_tx);
+    buffer_free(&c -> origin_request);
+    buffer_free(&c -> body);
+    http_response_free(&c -> response);
+    free(c -> origin_key);
+    free(c -> origin_host);
+    free(c -> origin_port);
+    if (c -> addrs) {
+        dns_free(c -> addrs);
+    }
+    free(c -> cache_key);
+    cache_fill_free(&c -> cache_fill);
+    if (c -> hit) {
+        /* nothing writes it anymore */
+        cache_unpin(c -> hit);
+    }
+    free(c);
+}
+
+/*
+ * clienterror - respond with an error message to the client, then
+ *      carry on with the next request if this one was understood,
+ *      or close the connection once the response is written
+ */
+static void clienterror(Conn *c, char *cause, char *errnum,
+        char *shortmsg, char *longmsg)
+{
+    char body[MAXBUF];
+
+    /* Build the HTTP response body */
+    snprintf(body, MAXBUF,
+             "<html><title>Proxy Error</title>"
+             "<body bgcolor=""ffffff"">\r\n"
+             "%s: %s\r\n"
+             "<p>%s: %.*s\r\n"
+             "<hr><em>The Proxy Server</em>\r\n",
+             errnum, shortmsg, longmsg, MAXBUF / 2, cause);
+
+    /* the origin will not be needed anymore */
+    c -> engine -> close_origin(c);
+
+    /* Print the HTTP response */
+    if (buffer_printf(&c -> to_client,
+                "HTTP/1.1 %s %s\r\n"
+                "Content-type: text/html\r\n"
+                "Content-length: %d\r\n%s\r\n%s",
+                errnum, shortmsg, (int) strlen(body),
+                client_connection_hdr(c), body) < 0) {
+        conn_close(c);
+        return;
+    }
+    conn_response_done(c);
+}
+
+/*
+ * internal_server_error -
+ *      respond the client with an internal server error message.
+ */
+static void internal_server_error(Conn *c) {
+    clienterror(c, "", "500", "Internal Server Error",
+                "The proxy server encountered a problem");
+}
+
+/*
+ * gateway_timeout -
+ *      respond the client that the origin did not answer in time.
+ */
+static void gateway_timeout(Conn *c) {
+    clienterror(c, c -> origin_key, "504", "Gateway Timeout",
+                "The origin server did not respond in time");
+}
@@ -0,0 +1,168 @@
+/*
+ * conn.h - the per-connection proxy state machine
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ */
+#ifndef __CONN_H__
+#define __CONN_H__
+
+#include <netdb.h>
+#include <sys/uio.h>
+#include <time.h>
+#include "buffer.h"
+#include "cache.h"
+#include "dns.h"
+#include "event.h"
+#include "http.h"
+#include "uring.h"
+
+#define CONN_MAX_REQUEST 65536      /* max size of the request headers */
+#define CONN_RELAY_HIGH_WATER 65536 /* stop reading the origin above this,
+                                       or starting pipelined requests */
+#define CONN_IOVS 16                /* pieces written to the client at once */
+#define CONN_IDLE_TIMEOUT 60        /* seconds a client may sit idle between
+                                       requests */
+#define CONN_READ_TIMEOUT 30        /* seconds a request or a response may
+                                       make no progress */
+
+/* the states of a proxied connection */
+typedef enum {
+    CONN_READ_REQUEST,  /* waiting for the next request from the client */
+    CONN_RESOLVE,       /* waiting for the origin name to be resolved */
+    CONN_CONNECT,       /* connect to the origin in progress */
+    CONN_RELAY,         /* forwarding the request, relaying the response */
+    CONN_FLUSH,         /* draining the last response, then closing */
+} ConnState;
+
+/* the io_uring operations of a connection */
+typedef enum {
+    CONN_OP_CLIENT_RECV,
+    CONN_OP_CLIENT_SEND,
+    CONN_OP_ORIGIN_RECV,
+    CONN_OP_ORIGIN_SEND,
+    CONN_OP_CONNECT,
+    CONN_OPS
+} ConnOp;
+
+typedef struct conn_type Conn;
+
+/* an I/O engine moving the bytes of connections, see conn_epoll.c
+ * and conn_uring.c */
+typedef struct conn_engine_type {
+    const char *name;
+    /* start connecting the origin to addr.
+     * Returns 1 if connected, 0 if in progress, -1 on failure */
+    int (*connect)(Conn *c, struct addrinfo *addr);
+    /* start the I/O the current state of the connection needs */
+    void (*update)(Conn *c);
+    /* take over fd, an idle connection to the origin */
+    void (*adopt_origin)(Conn *c, int fd);
+    /* hand the origin descriptor back once its response is read.
+     * Returns the fd, or -1 after closing it if it cannot be reused */
+    int (*detach_origin)(Conn *c);
+    /* close the origin descriptor */
+    void (*close_origin)(Conn *c);
+    /* close the client descriptor alone, the origin is still read */
+    void (*close_client)(Conn *c);
+    /* close both descriptors, release the connection once it is idle */
+    void (*close)(Conn *c);
+    /* the connection missed its deadline, time it out */
+    void (*expire)(Conn *c);
+} ConnEngine;
+
+/* a client connection and the origin connection serving it */
+struct conn_type {
+    ConnEngine *engine;         /* the engine driving this connection */
+    void *loop;                 /* the engine's loop of this connection */
+    ConnState state;            /* the current state */
+    int closed;                 /* set once the connection is torn down */
+    int clientfd;               /* the client descriptor, -1 once the
+                                   client is gone but the origin is
+                                   still read into the cache */
+    int originfd;               /* the origin descriptor, -1 if none */
+    Buffer request;             /* request bytes read from the client */
+    size_t request_size;        /* the size of the request being served */
+    size_t request_scan;        /* bytes searched for the end of a request */
+    int request_ready;          /* whether buffered requests may be started */
+    int keep_alive;             /* whether the client keeps the connection */
+    int client_http11;          /* whether the client speaks HTTP/1.1 */
+    int client_eof;             /* whether the client stopped sending */
+    Buffer to_client;           /* bytes pending to the client */
+    Buffer to_origin;           /* bytes pending to the origin */
+    Buffer client_tx;           /* bytes the engine is sending the client */
+    Buffer origin_tx;           /* bytes the engine is sending the origin */
+    Buffer origin_request;      /* the request for the origin, for a retry */
+    char *origin_key;           /* "host:port" of the origin */
+    char *origin_host;          /* the origin name, resolved on a miss */
+    char *origin_port;          /* the origin port */
+    int origin_reused;          /* whether the origin connection was idle */
+    HttpResponse response;      /* the response read from the origin */
+    Buffer body;                /* body bytes waiting to be re-chunked */
+    int rechunk;                /* whether the body goes out chunked */
+    DnsQuery dns;               /* the lookup of the origin name */
+    struct addrinfo *addrs;     /* the resolved origin addresses */
+    struct addrinfo *next_addr; /* the next address to try */
+    struct addrinfo *connect_addr; /* the address being connected */
+    char *cache_key;            /* the cache key of the request */
+    CacheFill cache_fill;       /* the body collected for the cache */
+    size_t cache_object_size;   /* the response size relayed so far */
+    unsigned long fetch_start;  /* when the miss went to the origin, us */
+    size_t cache_limit;         /* the object limit when it went */
+    CacheNode *filling;         /* the response published to the cache
+                                   while it is read, pinned. The client
+                                   gets it as a hit like the others */
+    CacheNode *hit;             /* a large hit written out from the cache
+                                   after to_client, or one still being
+                                   filled, pinned meanwhile */
+    size_t hit_offset;          /* bytes of it written */
+    CacheTail tail;             /* the wait for more of the hit */
+    int hit_waiting;            /* whether the hit waits for its fill */
+    time_t active;              /* when the current wait began or last
+                                   made progress, monotonic seconds */
+    Conn *prev;                 /* the other connections of the worker, */
+    Conn *next;                 /* swept for missed deadlines */
+
+    /* epoll engine */
+    EventHandler client_ev;     /* the client descriptor registration */
+    EventHandler origin_ev;     /* the origin descriptor registration */
+    EventDeferred reclaim;      /* deferred release of this connection */
+
+    /* io_uring engine */
+    UringOp ops[CONN_OPS];      /* the operations, at most one in flight */
+    int refs;                   /* in-flight operations and callbacks */
+    int connect_err;            /* failed connect waiting for its send */
+    unsigned stale_ops;         /* ops still in flight on a closed origin */
+    struct addrinfo *pending_addr; /* connect waiting for the stale ops */
+    struct msghdr client_msg;   /* the pieces of the client send */
+    struct iovec client_iov[CONN_IOVS];
+};
+
+extern ConnEngine epoll_engine;
+extern ConnEngine uring_engine;
+
+/* protocol, called by the engines */
+Conn *conn_new(ConnEngine *engine, void *loop, int fd);
+void conn_client_data(Conn *c, char *buf, ssize_t n);
+void conn_origin_data(Conn *c, char *buf, ssize_t n);
+void conn_resolved(Conn *c);
+void conn_tailed(Conn *c);
+void conn_timed_out(Conn *c);
+void conn_connect_done(Conn *c, int err);
+void conn_origin_failed(Conn *c);
+int conn_advance(Conn *c);
+int conn_client_iov(Conn *c, Buffer *b, struct iovec *iov, int max);
+void conn_client_sent(Conn *c, Buffer *b, size_t n);
+int conn_wants_client_read(Conn *c);
+int conn_wants_client_write(Conn *c);
+int conn_wants_origin_read(Conn *c);
+int conn_done(Conn *c);
+void conn_close(Conn *c);
+void conn_free(Conn *c);
+void conn_expire(void);
+
+/* engine entry points */
+void conn_epoll_start(EventLoop *loop, int fd);
+void conn_uring_start(Uring *ring, int fd);
+
+#endif /* __CONN_H__ */
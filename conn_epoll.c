@@ -0,0 +1,410 @@
+/*
+ * conn_epoll.c - the epoll engine of the connection state machine
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * Descriptors are non-blocking and registered level triggered in the
+ * worker's event loop. When a descriptor is readable, it is read until
+ * it would block or the protocol does not want any more. Writes are
+ * attempted right away whenever the protocol queued bytes, and EPOLLOUT
+ * is only asked for when the socket buffer is full. The client is
+ * written with writev, so a large hit goes out from the cache in place.
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "conn.h"
+#include "proxylib.h"
+
+/* function declarations */
+
+/* event callbacks */
+static void client_event(EventHandler *h, uint32_t events);
+static void origin_event(EventHandler *h, uint32_t events);
+static void epoll_resolved(DnsQuery *q);
+static void epoll_tailed(CacheTail *t);
+static void epoll_expire(Conn *c);
+
+/* engine operations */
+static int epoll_connect(Conn *c, struct addrinfo *addr);
+static void epoll_update(Conn *c);
+static void epoll_adopt_origin(Conn *c, int fd);
+static int epoll_detach_origin(Conn *c);
+static void epoll_close_origin(Conn *c);
+static void epoll_close_client(Conn *c);
+static void epoll_close(Conn *c);
+
+/* helpers */
+static void epoll_read_client(Conn *c);
+static void epoll_read_origin(Conn *c);
+static int epoll_flush(int fd, Buffer *b, char *what);
+static int epoll_flush_client(Conn *c);
+static void epoll_release(void *arg);
+
+/* end function declarations */
+
+ConnEngine epoll_engine = {
+    "epoll",
+    epoll_connect,
+    epoll_update,
+    epoll_adopt_origin,
+    epoll_detach_origin,
+    epoll_close_origin,
+    epoll_close_client,
+    epoll_close,
+    epoll_expire,
+};
+
+/*
+ * conn_epoll_start - start serving a client fd in loop
+ */
+void conn_epoll_start(EventLoop *loop, int fd) {
+    Conn *c;
+
+    /* the worker must never block on the descriptor */
+    if (set_nonblocking(fd) < 0) {
+        unix_error_non_exit("fcntl error");
+        if (close(fd) < 0) {
+            fprintf(stderr, "close failure\n");
+        }
+        return;
+    }
+    if ((c = conn_new(&epoll_engine, loop, fd)) == NULL) {
+        return;
+    }
+    event_handler_init(&c -> client_ev, fd, client_event, c);
+    event_handler_init(&c -> origin_ev, -1, origin_event, c);
+    dns_query_init(&c -> dns, epoll_resolved, c);
+    cache_tail_init(&c -> tail, epoll_tailed, c);
+    if (event_add(loop, &c -> client_ev, EPOLLIN) < 0) {
+        conn_close(c);
+    }
+}
+
+/*
+ * client_event - the client descriptor is ready
+ */
+static void client_event(EventHandler *h, uint32_t events) {
+    Conn *c = (Conn *) h -> data;
+
+    if ((events & EPOLLERR) ||
+            ((events & EPOLLHUP) && !(events & EPOLLIN))) {
+        /* the client is gone, nobody is left to serve, but the cache
+         * may still be filled from the origin */
+        conn_close(c);
+    }
+    else if (events & EPOLLIN) {
+        epoll_read_client(c);
+    }
+    epoll_update(c);
+}
+
+/*
+ * origin_event - the origin descriptor is ready
+ */
+static void origin_event(EventHandler *h, uint32_t events) {
+    Conn *c = (Conn *) h -> data;
+
+    if (c -> state == CONN_CONNECT) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        if (getsockopt(h -> fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0) {
+            err = errno;
+        }
+        conn_connect_done(c, err);
+    }
+    else if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+        /* a reset origin reports its error through the read */
+        epoll_read_origin(c);
+    }
+    epoll_update(c);
+}
+
+/*
+ * epoll_resolved - the resolver answered the lookup of the origin name
+ */
+static void epoll_resolved(DnsQuery *q) {
+    Conn *c = (Conn *) q -> data;
+
+    conn_resolved(c);
+    epoll_update(c);
+}
+
+/*
+ * epoll_tailed - more of the hit the connection waited for is in the
+ *      cache
+ */
+static void epoll_tailed(CacheTail *t) {
+    Conn *c = (Conn *) t -> data;
+
+    conn_tailed(c);
+    epoll_update(c);
+}
+
+/*
+ * epoll_expire - the connection missed its deadline
+ */
+static void epoll_expire(Conn *c) {
+    conn_timed_out(c);
+    epoll_update(c);
+}
+
+/*
+ * epoll_read_client - read the client while the protocol wants more
+ */
+static void epoll_read_client(Conn *c) {
+    char buf[MAXBUF];
+    ssize_t n;
+
+    while (conn_wants_client_read(c)) {
+        if ((n = read(c -> clientfd, buf, MAXBUF)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            unix_error_non_exit("client read error");
+        }
+        conn_client_data(c, buf, n);
+    }
+}
+
+/*
+ * epoll_read_origin - read the origin while the protocol wants more,
+ *      writing to the client as the bytes come in
+ */
+static void epoll_read_origin(Conn *c) {
+    char buf[MAXBUF];
+    ssize_t n;
+
+    while (conn_wants_origin_read(c)) {
+        if ((n = read(c -> originfd, buf, MAXBUF)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return;
+            }
+            unix_error_non_exit("origin read error");
+        }
+        conn_origin_data(c, buf, n);
+        if (!c -> closed && epoll_flush_client(c) < 0) {
+            conn_close(c);
+        }
+    }
+}
+
+/*
+ * epoll_connect - start a non-blocking connect to addr
+ */
+static int epoll_connect(Conn *c, struct addrinfo *p) {
+    int fd, rc;
+
+    if ((fd = socket(p -> ai_family,
+                    p -> ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+                    p -> ai_protocol)) < 0) {
+        return -1;
+    }
+    if ((rc = connect(fd, p -> ai_addr, p -> ai_addrlen)) == 0 ||
+            errno == EINPROGRESS) {
+        c -> originfd = fd;
+        event_handler_init(&c -> origin_ev, fd, origin_event, c);
+        /* wait for the descriptor to become writable if in progress */
+        return rc == 0;
+    }
+    if (close(fd) < 0) {
+        fprintf(stderr, "close failure\n");
+    }
+    return -1;
+}
+
+/*
+ * epoll_update - write what the protocol queued and register the
+ *      interest sets the current state needs, closing the connection
+ *      once everything is written
+ */
+static void epoll_update(Conn *c) {
+    uint32_t events;
+
+    if (c -> closed) {
+        return;
+    }
+    /* try the writes right away, most of the time they just succeed,
+     * and start the pipelined requests the written bytes made room for */
+    while (1) {
+        if (epoll_flush_client(c) < 0) {
+            /* the origin may still be read into the cache */
+            conn_close(c);
+            if (c -> closed) {
+                return;
+            }
+        }
+        if (!conn_advance(c)) {
+            break;
+        }
+        if (c -> closed) {
+            return;
+        }
+    }
+    if (c -> state == CONN_RELAY &&
+            epoll_flush(c -> originfd, &c -> to_origin, "origin") < 0) {
+        conn_origin_failed(c);
+        if (c -> closed) {
+            return;
+        }
+    }
+    if (conn_done(c)) {
+        conn_close(c);
+        return;
+    }
+
+    events = 0;
+    if (conn_wants_client_read(c)) {
+        events |= EPOLLIN;
+    }
+    if (conn_wants_client_write(c)) {
+        events |= EPOLLOUT;
+    }
+    if (c -> clientfd >= 0 &&
+            event_mod((EventLoop *) c -> loop, &c -> client_ev, events) < 0) {
+        conn_close(c);
+        if (c -> closed) {
+            return;
+        }
+    }
+
+    if (c -> originfd < 0) {
+        return;
+    }
+    events = 0;
+    if (c -> state == CONN_CONNECT || buffer_pending(&c -> to_origin) > 0) {
+        events |= EPOLLOUT;
+    }
+    if (conn_wants_origin_read(c)) {
+        events |= EPOLLIN;
+    }
+    if (event_mod((EventLoop *) c -> loop, &c -> origin_ev, events) < 0) {
+        conn_close(c);
+    }
+}
+
+/*
+ * epoll_flush - write as much of b to fd as it takes without blocking.
+ *      Returns 0 on success, -1 on a write error.
+ */
+static int epoll_flush(int fd, Buffer *b, char *what) {
+    char msg[MAXLINE];
+    ssize_t n;
+
+    while (buffer_pending(b) > 0) {
+        if ((n = write(fd, buffer_head(b), buffer_pending(b))) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            snprintf(msg, MAXLINE, "%s write error", what);
+            unix_error_non_exit(msg);
+            return -1;
+        }
+        buffer_consume(b, n);
+    }
+    return 0;
+}
+
+/*
+ * epoll_flush_client - write as much of what is queued for the client,
+ *      and of the large hit after it, as it takes without blocking.
+ *      Returns 0 on success, -1 on a write error.
+ */
+static int epoll_flush_client(Conn *c) {
+    struct iovec iov[CONN_IOVS];
+    ssize_t n;
+    int count;
+
+    while ((count = conn_client_iov(c, &c -> to_client, iov,
+                    CONN_IOVS)) > 0) {
+        if ((n = writev(c -> clientfd, iov, count)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            unix_error_non_exit("client write error");
+            return -1;
+        }
+        conn_client_sent(c, &c -> to_client, n);
+    }
+    return 0;
+}
+
+/*
+ * epoll_adopt_origin - take over fd, a non-blocking idle connection
+ *      to the origin
+ */
+static void epoll_adopt_origin(Conn *c, int fd) {
+    c -> originfd = fd;
+    event_handler_init(&c -> origin_ev, fd, origin_event, c);
+}
+
+/*
+ * epoll_detach_origin - unregister the origin descriptor and hand it back
+ */
+static int epoll_detach_origin(Conn *c) {
+    int fd = c -> originfd;
+
+    event_del((EventLoop *) c -> loop, &c -> origin_ev);
+    c -> originfd = -1;
+    c -> origin_ev.fd = -1;
+    return fd;
+}
+
+/*
+ * epoll_close_origin - close the origin descriptor if there is one
+ */
+static void epoll_close_origin(Conn *c) {
+    if (c -> originfd < 0) {
+        return;
+    }
+    event_del((EventLoop *) c -> loop, &c -> origin_ev);
+    if (close(c -> originfd) < 0) {
+        fprintf(stderr, "close failure\n");
+    }
+    c -> originfd = -1;
+    c -> origin_ev.fd = -1;
+}
+
+/*
+ * epoll_close_client - close the client descriptor if there is one
+ */
+static void epoll_close_client(Conn *c) {
+    if (c -> clientfd < 0) {
+        return;
+    }
+    event_del((EventLoop *) c -> loop, &c -> client_ev);
+    if (close(c -> clientfd) < 0) {
+        fprintf(stderr, "close failure\n");
+    }
+    c -> clientfd = -1;
+    c -> client_ev.fd = -1;
+}
+
+/*
+ * epoll_close - close both descriptors and release the connection
+ *      once the current batch of events is handled
+ */
+static void epoll_close(Conn *c) {
+    epoll_close_client(c);
+    epoll_close_origin(c);
+    event_defer((EventLoop *) c -> loop, &c -> reclaim, epoll_release, c);
+}
+
+/*
+ * epoll_release - free a closed connection
+ */
+static void epoll_release(void *arg) {
+    conn_free((Conn *) arg);
+}
@@ -0,0 +1,505 @@
+/*
+ * conn_uring.c - the io_uring engine of the connection state machine
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * Instead of waiting for readiness and then doing the I/O with a system
+ * call per chunk, this engine hands whole operations to the kernel and
+ * gets their results back as completions, all batched into the one
+ * io_uring_enter per loop iteration.
+ *
+ *   - receives pick their buffer from the ring of provided buffers, and
+ *     at most one receive per direction is in flight, only while the
+ *     protocol wants to read
+ *   - sends take the whole pending buffer. It is swapped out of the
+ *     protocol's way (to_client becomes client_tx), so the protocol can
+ *     keep queueing while the kernel still reads the old bytes. The
+ *     client is sent to with sendmsg, so a large hit follows client_tx
+ *     from the segments of the cache in the same send, as far as it is
+ *     filled
+ *   - the connect to the origin is linked to the send of the request,
+ *     so both go out in the same submission. If the connect fails the
+ *     send completes with -ECANCELED and the request is put back for
+ *     the next address
+ *
+ * A completion may still arrive after the connection is closed, so a
+ * connection counts its in-flight operations and is only freed when
+ * the last one has completed. Closing cancels whatever is in flight.
+ * Likewise the operations of a closed origin are marked stale, and a new
+ * origin connection waits until they are gone, so their late completions
+ * cannot be taken for those of the new one.
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "conn.h"
+#include "proxylib.h"
+
+/* function declarations */
+
+/* completion callback */
+static void op_done(UringOp *op, int res, uint32_t flags);
+static void uring_resolved(DnsQuery *q);
+static void uring_tailed(CacheTail *t);
+static void uring_expire(Conn *c);
+
+/* engine operations */
+static int uring_connect(Conn *c, struct addrinfo *addr);
+static void uring_update(Conn *c);
+static void uring_adopt_origin(Conn *c, int fd);
+static int uring_detach_origin(Conn *c);
+static void uring_close_origin(Conn *c);
+static void uring_close_client(Conn *c);
+static void uring_close(Conn *c);
+
+/* helpers */
+static void conn_recv(Conn *c, ConnOp op, int fd);
+static void conn_send(Conn *c, ConnOp op, int fd, Buffer *from, Buffer *tx);
+static void conn_send_client(Conn *c);
+static void conn_send_client_tx(Conn *c);
+static int conn_start_connect(Conn *c, struct addrinfo *addr);
+static void conn_stale_done(Conn *c, ConnOp op, uint32_t flags);
+static void conn_put(Conn *c);
+static void buffer_swap(Buffer *a, Buffer *b);
+
+/* end function declarations */
+
+ConnEngine uring_engine = {
+    "io_uring",
+    uring_connect,
+    uring_update,
+    uring_adopt_origin,
+    uring_detach_origin,
+    uring_close_origin,
+    uring_close_client,
+    uring_close,
+    uring_expire,
+};
+
+/*
+ * conn_uring_start - start serving a blocking client fd in ring
+ */
+void conn_uring_start(Uring *ring, int fd) {
+    Conn *c;
+    int i;
+
+    if ((c = conn_new(&uring_engine, ring, fd)) == NULL) {
+        return;
+    }
+    for (i = 0; i < CONN_OPS; i++) {
+        uring_op_init(&c -> ops[i], op_done, c);
+    }
+    dns_query_init(&c -> dns, uring_resolved, c);
+    cache_tail_init(&c -> tail, uring_tailed, c);
+    uring_update(c);
+}
+
+/*
+ * op_done - an operation of a connection completed with result res
+ */
+static void op_done(UringOp *op, int res, uint32_t flags) {
+    Conn *c = (Conn *) op -> data;
+    Uring *r = (Uring *) c -> loop;
+    ConnOp which = (ConnOp) (op - c -> ops);
+
+    if (c -> stale_ops & (1u << which)) {
+        conn_stale_done(c, which, flags);
+        uring_update(c);
+        conn_put(c);
+        return;
+    }
+
+    switch (which) {
+    case CONN_OP_CLIENT_RECV:
+        if (res == -ENOBUFS || res == -EAGAIN) {
+            /* nothing received, uring_update tries again */
+        }
+        else if (!c -> closed && c -> clientfd >= 0) {
+            if (res < 0) {
+                errno = -res;
+                unix_error_non_exit("client recv error");
+            }
+            conn_client_data(c, res > 0 ? uring_buffer(r, flags) : NULL,
+                    res < 0 ? -1 : res);
+        }
+        uring_recycle(r, flags);
+        break;
+
+    case CONN_OP_ORIGIN_RECV:
+        if (res == -ENOBUFS || res == -EAGAIN) {
+            /* nothing received, uring_update tries again */
+        }
+        else if (!c -> closed && c -> state == CONN_RELAY) {
+            if (res < 0) {
+                errno = -res;
+                unix_error_non_exit("origin recv error");
+            }
+            conn_origin_data(c, res > 0 ? uring_buffer(r, flags) : NULL,
+                    res < 0 ? -1 : res);
+        }
+        uring_recycle(r, flags);
+        break;
+
+    case CONN_OP_CLIENT_SEND:
+        if (c -> clientfd < 0) {
+            /* the client was dropped while the cache is filled */
+            break;
+        }
+        if (res < 0) {
+            if (!c -> closed) {
+                errno = -res;
+                unix_error_non_exit("client send error");
+                conn_close(c);
+            }
+            break;
+        }
+        conn_client_sent(c, &c -> client_tx, res);
+        if (!c -> closed) {
+            /* short send, carry on with the rest */
+            conn_send_client_tx(c);
+        }
+        break;
+
+    case CONN_OP_ORIGIN_SEND:
+        if (res < 0) {
+            if (c -> closed) {
+                break;
+            }
+            if (c -> state == CONN_CONNECT) {
+                /* the linked connect failed, keep the request for the
+                 * next address */
+                buffer_swap(&c -> to_origin, &c -> origin_tx);
+                if (!c -> ops[CONN_OP_CONNECT].busy && c -> connect_err) {
+                    int err = c -> connect_err;
+                    c -> connect_err = 0;
+                    conn_connect_done(c, err);
+                }
+            }
+            else if (c -> state == CONN_RELAY) {
+                errno = -res;
+                unix_error_non_exit("origin send error");
+                /* the rest of the request is lost with the connection */
+                buffer_consume(&c -> origin_tx,
+                        buffer_pending(&c -> origin_tx));
+                conn_origin_failed(c);
+            }
+            break;
+        }
+        buffer_consume(&c -> origin_tx, res);
+        if (buffer_pending(&c -> origin_tx) > 0 && !c -> closed &&
+                c -> originfd >= 0) {
+            /* short send, carry on with the rest */
+            uring_prep_send(r, op, c -> originfd,
+                    buffer_head(&c -> origin_tx),
+                    buffer_pending(&c -> origin_tx));
+            c -> refs++;
+        }
+        break;
+
+    case CONN_OP_CONNECT:
+        if (c -> closed) {
+            break;
+        }
+        if (res < 0 && c -> ops[CONN_OP_ORIGIN_SEND].busy) {
+            /* wait for the linked send to be cancelled */
+            c -> connect_err = -res;
+            break;
+        }
+        conn_connect_done(c, res < 0 ? -res : 0);
+        break;
+
+    default:
+        break;
+    }
+
+    uring_update(c);
+    conn_put(c);
+}
+
+/*
+ * uring_resolved - the resolver answered the lookup of the origin name
+ */
+static void uring_resolved(DnsQuery *q) {
+    Conn *c = (Conn *) q -> data;
+
+    /* the connection may be closed on the way, keep it until the end */
+    c -> refs++;
+    conn_resolved(c);
+    uring_update(c);
+    conn_put(c);
+}
+
+/*
+ * uring_tailed - more of the hit the connection waited for is in the
+ *      cache
+ */
+static void uring_tailed(CacheTail *t) {
+    Conn *c = (Conn *) t -> data;
+
+    /* the connection may be closed on the way, keep it until the end */
+    c -> refs++;
+    conn_tailed(c);
+    uring_update(c);
+    conn_put(c);
+}
+
+/*
+ * uring_expire - the connection missed its deadline
+ */
+static void uring_expire(Conn *c) {
+    /* the connection may be closed on the way, keep it until the end */
+    c -> refs++;
+    conn_timed_out(c);
+    uring_update(c);
+    conn_put(c);
+}
+
+/*
+ * uring_connect - queue the connect to addr together with the
+ *      request, linked so the request is only sent once connected
+ */
+static int uring_connect(Conn *c, struct addrinfo *p) {
+    if (c -> stale_ops) {
+        /* start once the operations of the last origin are gone */
+        c -> pending_addr = p;
+        return 0;
+    }
+    return conn_start_connect(c, p);
+}
+
+/*
+ * conn_start_connect - open a socket for addr and queue the connect
+ *      and the request.
+ *      Returns 0 on success, -1 on failure.
+ */
+static int conn_start_connect(Conn *c, struct addrinfo *p) {
+    Uring *r = (Uring *) c -> loop;
+    int fd;
+
+    if ((fd = socket(p -> ai_family, p -> ai_socktype | SOCK_CLOEXEC,
+                    p -> ai_protocol)) < 0) {
+        return -1;
+    }
+    c -> originfd = fd;
+    uring_prep_connect(r, &c -> ops[CONN_OP_CONNECT], fd,
+            p -> ai_addr, p -> ai_addrlen,
+            buffer_pending(&c -> to_origin) > 0);
+    c -> refs++;
+    conn_send(c, CONN_OP_ORIGIN_SEND, fd, &c -> to_origin, &c -> origin_tx);
+    return 0;
+}
+
+/*
+ * uring_update - queue the operations the current state needs which
+ *      are not in flight yet, closing the connection once everything
+ *      is written
+ */
+static void uring_update(Conn *c) {
+    if (c -> closed) {
+        return;
+    }
+    /* start pipelined requests the sent bytes made room for */
+    conn_advance(c);
+    if (c -> closed) {
+        return;
+    }
+    if (conn_done(c)) {
+        conn_close(c);
+        return;
+    }
+    if (conn_wants_client_read(c)) {
+        conn_recv(c, CONN_OP_CLIENT_RECV, c -> clientfd);
+    }
+    if (c -> clientfd >= 0) {
+        conn_send_client(c);
+    }
+    if (c -> originfd >= 0 && c -> state == CONN_RELAY) {
+        conn_send(c, CONN_OP_ORIGIN_SEND, c -> originfd,
+                &c -> to_origin, &c -> origin_tx);
+        if (conn_wants_origin_read(c)) {
+            conn_recv(c, CONN_OP_ORIGIN_RECV, c -> originfd);
+        }
+    }
+}
+
+/*
+ * conn_recv - queue a receive on fd unless one is in flight
+ */
+static void conn_recv(Conn *c, ConnOp op, int fd) {
+    if (c -> ops[op].busy) {
+        return;
+    }
+    uring_prep_recv((Uring *) c -> loop, &c -> ops[op], fd);
+    c -> refs++;
+}
+
+/*
+ * conn_send - queue a send of everything pending in from on fd unless
+ *      a send is in flight. The bytes move to tx for the time of the send.
+ */
+static void conn_send(Conn *c, ConnOp op, int fd, Buffer *from, Buffer *tx) {
+    if (c -> ops[op].busy || buffer_pending(from) == 0) {
+        return;
+    }
+    /* tx is drained whenever no send is in flight */
+    buffer_swap(from, tx);
+    uring_prep_send((Uring *) c -> loop, &c -> ops[op], fd,
+            buffer_head(tx), buffer_pending(tx));
+    c -> refs++;
+}
+
+/*
+ * conn_send_client - queue a send of everything pending for the client,
+ *      and of the large hit after it, unless a send is in flight
+ */
+static void conn_send_client(Conn *c) {
+    if (c -> ops[CONN_OP_CLIENT_SEND].busy ||
+            (buffer_pending(&c -> to_client) == 0 && c -> hit == NULL)) {
+        return;
+    }
+    /* client_tx is drained whenever no send is in flight */
+    buffer_swap(&c -> to_client, &c -> client_tx);
+    conn_send_client_tx(c);
+}
+
+/*
+ * conn_send_client_tx - queue a send of client_tx, followed by the
+ *      large hit if nothing is queued before it anymore
+ */
+static void conn_send_client_tx(Conn *c) {
+    int count = conn_client_iov(c, &c -> client_tx, c -> client_iov,
+            CONN_IOVS);
+
+    if (count == 0) {
+        return;
+    }
+    memset(&c -> client_msg, 0, sizeof(c -> client_msg));
+    c -> client_msg.msg_iov = c -> client_iov;
+    c -> client_msg.msg_iovlen = count;
+    uring_prep_sendmsg((Uring *) c -> loop, &c -> ops[CONN_OP_CLIENT_SEND],
+            c -> clientfd, &c -> client_msg);
+    c -> refs++;
+}
+
+/*
+ * conn_stale_done - the last completion of an operation on a closed
+ *      origin arrived, start the connect which waited for it
+ */
+static void conn_stale_done(Conn *c, ConnOp op, uint32_t flags) {
+    struct addrinfo *p;
+
+    c -> stale_ops &= ~(1u << op);
+    uring_recycle((Uring *) c -> loop, flags);
+    if (op == CONN_OP_ORIGIN_SEND) {
+        buffer_consume(&c -> origin_tx, buffer_pending(&c -> origin_tx));
+    }
+    if (c -> stale_ops || (p = c -> pending_addr) == NULL) {
+        return;
+    }
+    c -> pending_addr = NULL;
+    if (!c -> closed && conn_start_connect(c, p) < 0) {
+        conn_connect_done(c, errno);
+    }
+}
+
+/*
+ * uring_adopt_origin - take over fd, a blocking idle connection
+ *      to the origin
+ */
+static void uring_adopt_origin(Conn *c, int fd) {
+    c -> originfd = fd;
+}
+
+/*
+ * uring_detach_origin - hand the origin descriptor back, unless an
+ *      operation on it is still in flight
+ */
+static int uring_detach_origin(Conn *c) {
+    int fd = c -> originfd;
+
+    if (c -> stale_ops || c -> ops[CONN_OP_ORIGIN_RECV].busy ||
+            c -> ops[CONN_OP_ORIGIN_SEND].busy ||
+            c -> ops[CONN_OP_CONNECT].busy) {
+        uring_close_origin(c);
+        return -1;
+    }
+    c -> originfd = -1;
+    return fd;
+}
+
+/*
+ * uring_close_origin - cancel the origin operations and close
+ *      the origin descriptor if there is one
+ */
+static void uring_close_origin(Conn *c) {
+    Uring *r = (Uring *) c -> loop;
+    ConnOp ops[] = {CONN_OP_ORIGIN_RECV, CONN_OP_ORIGIN_SEND, CONN_OP_CONNECT};
+    size_t i;
+
+    if (c -> originfd < 0) {
+        return;
+    }
+    for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+        if (c -> ops[ops[i]].busy) {
+            uring_prep_cancel(r, &c -> ops[ops[i]]);
+            c -> stale_ops |= 1u << ops[i];
+        }
+    }
+    if (close(c -> originfd) < 0) {
+        fprintf(stderr, "close failure\n");
+    }
+    c -> originfd = -1;
+}
+
+/*
+ * uring_close_client - cancel the client operations and close
+ *      the client descriptor if there is one
+ */
+static void uring_close_client(Conn *c) {
+    Uring *r = (Uring *) c -> loop;
+
+    if (c -> clientfd < 0) {
+        return;
+    }
+    if (c -> ops[CONN_OP_CLIENT_RECV].busy) {
+        uring_prep_cancel(r, &c -> ops[CONN_OP_CLIENT_RECV]);
+    }
+    if (c -> ops[CONN_OP_CLIENT_SEND].busy) {
+        uring_prep_cancel(r, &c -> ops[CONN_OP_CLIENT_SEND]);
+    }
+    if (close(c -> clientfd) < 0) {
+        fprintf(stderr, "close failure\n");
+    }
+    c -> clientfd = -1;
+}
+
+/*
+ * uring_close - cancel everything in flight and close both
+ *      descriptors, the last completion frees the connection
+ */
+static void uring_close(Conn *c) {
+    uring_close_client(c);
+    uring_close_origin(c);
+    if (c -> refs == 0) {
+        conn_free(c);
+    }
+}
+
+/*
+ * conn_put - an operation of the connection is done with it,
+ *      free the connection if it was the last one after the close
+ */
+static void conn_put(Conn *c) {
+    if (--c -> refs == 0 && c -> closed) {
+        conn_free(c);
+    }
+}
+
+/*
+ * buffer_swap - exchange the contents of two buffers
+ */
+static void buffer_swap(Buffer *a, Buffer *b) {
+    Buffer tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
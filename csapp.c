@@ -1012,6 +1012,64 @@ int open_listenfd(char *port)
 }
 /* $end open_listenfd */
 
+/*
+ * open_reuseport_listenfd - Open and return a non-blocking listening
+ *     socket on port with SO_REUSEPORT set, so several of them can be
+ *     bound to the same port and the kernel spreads incoming
+ *     connections among them.
+ *
+ *     On error, returns -1 and sets errno.
+ */
+int open_reuseport_listenfd(char *port)
+{
+    struct addrinfo hints, *listp, *p;
+    int listenfd, optval=1;
+
+    /* Get a list of potential server addresses */
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;             /* Accept connections */
+    hints.ai_flags = AI_PASSIVE | AI_ADDRCONFIG; /* ... on any IP address */
+    hints.ai_flags |= AI_NUMERICSERV;            /* ... using port number */
+    Getaddrinfo(NULL, port, &hints, &listp);
+
+    /* Walk the list for one that we can bind to */
+    for (p = listp; p; p = p->ai_next) {
+        /* Create a non-blocking socket descriptor */
+        if ((listenfd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK,
+                               p->ai_protocol)) < 0)
+            continue;  /* Socket failed, try the next */
+
+        /* Eliminates "Address already in use" error from bind */
+        Setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR,
+                   (const void *)&optval , sizeof(int));
+
+        /* Share the port with the other listeners */
+        if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEPORT,
+                       (const void *)&optval , sizeof(int)) < 0) {
+            Close(listenfd);
+            Freeaddrinfo(listp);
+            return -1; /* Not supported here, no use trying the others */
+        }
+
+        /* Bind the descriptor to the address */
+        if (bind(listenfd, p->ai_addr, p->ai_addrlen) == 0)
+            break; /* Success */
+        Close(listenfd); /* Bind failed, try the next */
+    }
+
+    /* Clean up */
+    Freeaddrinfo(listp);
+    if (!p) /* No address worked */
+        return -1;
+
+    /* Make it a listening socket ready to accept connection requests */
+    if (listen(listenfd, LISTENQ) < 0) {
+        Close(listenfd);
+        return -1;
+    }
+    return listenfd;
+}
+
 /****************************************************
  * Wrappers for reentrant protocol-independent helpers
  ****************************************************/
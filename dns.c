@@ -0,0 +1,492 @@
+/*
+ * dns.c - the shared resolver cache
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * getaddrinfo blocks, and a worker blocked on it stalls every connection
+ * of its loop. So the workers never call it: names are looked up in a
+ * cache shared by all the workers, and a miss is handed to a few resolver
+ * threads. The query waits on the entry of its name, so concurrent misses
+ * on one name cost a single lookup, and the answer is posted back to the
+ * mailbox of the worker which asked, whose loop watches the mailbox's
+ * eventfd and runs the callback of the query (dns_mailbox_drain).
+ *
+ * getaddrinfo does not tell the TTL of the records, so an answer is
+ * fresh for DNS_TTL seconds. After that it is still served for up to
+ * DNS_STALE_TTL seconds while a resolver refreshes it in the background,
+ * so a popular name never makes a request wait. A name which does not
+ * exist is remembered for DNS_NEGATIVE_TTL seconds; other failures are
+ * not cached, and a stale answer is kept over them.
+ *
+ * The names are resolved without the port, which is put into the copy
+ * of the addresses each query gets. At most DNS_MAX_ENTRIES names are
+ * kept, the least recently used idle one giving way to a new one. All
+ * the state is guarded by one mutex, held only for the table operations
+ * and never across a lookup.
+ */
+#include <ctype.h>
+#include <pthread.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include "csapp.h"
+#include "dns.h"
+#include "proxylib.h"
+
+/* an address copied for a query, with room for the socket address */
+typedef struct dns_addr_type {
+    struct addrinfo ai;
+    struct sockaddr_storage addr;
+} DnsAddr;
+
+static DnsEntry *table[DNS_BUCKETS];    /* the names, by hash */
+static DnsEntry *jobs = NULL;           /* names to resolve, oldest first */
+static DnsEntry *jobs_tail = NULL;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobs_ready = PTHREAD_COND_INITIALIZER;
+static __thread DnsMailbox *mailbox = NULL; /* this worker's mailbox */
+
+/* counters, guarded by lock */
+static unsigned long entry_count;   /* names in the table */
+static unsigned long hits;          /* answered fresh from the cache */
+static unsigned long stale_hits;    /* answered stale, while refreshed */
+static unsigned long negative_hits; /* answered by a cached nonexistence */
+static unsigned long misses;        /* had to wait for a resolver */
+static unsigned long refreshes;     /* background refreshes started */
+static unsigned long failures;      /* lookups failing, but not NXDOMAIN */
+
+/* function declarations */
+static void *resolver_thread(void *arg);
+static void resolved(DnsEntry *e, struct addrinfo *res, int rc);
+static void answer(DnsQuery *q, DnsEntry *e, int err);
+static DnsEntry *find_entry(const char *host, time_t now);
+static void evict_entry(void);
+static void queue_job(DnsEntry *e);
+static struct addrinfo *copy_addrs(struct addrinfo *addrs, int port);
+static int parse_port(const char *port);
+static unsigned int hash_host(const char *host);
+
+/*
+ * dns_init - start the resolver threads.
+ *      Returns 0 on success, -1 on failure.
+ */
+int dns_init(void) {
+    pthread_t tid;
+    int i, rc;
+
+    for (i = 0; i < DNS_THREADS; i++) {
+        if ((rc = pthread_create(&tid, NULL, resolver_thread, NULL)) != 0) {
+            posix_error_non_exit(rc, "pthread_create error");
+            return -1;
+        }
+        pthread_detach(tid);
+    }
+    return 0;
+}
+
+/*
+ * dns_mailbox_init - set up an empty mailbox, its eventfd to be
+ *      watched by the loop of its worker.
+ *      Returns 0 on success, -1 on failure.
+ */
+int dns_mailbox_init(DnsMailbox *mb) {
+    if ((mb -> fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        unix_error_non_exit("eventfd error");
+        return -1;
+    }
+    mb -> head = mb -> tail = NULL;
+    return 0;
+}
+
+/*
+ * dns_mailbox_bind - answer the queries of the calling worker thread
+ *      through mb
+ */
+void dns_mailbox_bind(DnsMailbox *mb) {
+    mailbox = mb;
+}
+
+/*
+ * dns_mailbox_drain - the eventfd of mb was read, run the callbacks
+ *      of the queries answered since
+ */
+void dns_mailbox_drain(DnsMailbox *mb) {
+    DnsQuery *q;
+
+    while (1) {
+        pthread_mutex_lock(&lock);
+        if ((q = mb -> head) == NULL) {
+            pthread_mutex_unlock(&lock);
+            return;
+        }
+        if ((mb -> head = q -> next) == NULL) {
+            mb -> tail = NULL;
+        }
+        q -> state = DNS_IDLE;
+        pthread_mutex_unlock(&lock);
+        /* one at a time, as a callback may cancel the others */
+        q -> callback(q);
+    }
+}
+
+/*
+ * dns_query_init - get a query ready, callback runs with it on the
+ *      worker once an answer which was not at hand comes
+ */
+void dns_query_init(DnsQuery *q, DnsCallback callback, void *data) {
+    q -> state = DNS_IDLE;
+    q -> callback = callback;
+    q -> data = data;
+    q -> err = 0;
+    q -> addrs = NULL;
+    q -> entry = NULL;
+    q -> mailbox = NULL;
+    q -> next = NULL;
+}
+
+/*
+ * dns_resolve - look host up for connections to port, on a worker.
+ *      Returns 1 if answered right away, with q -> err set to 0 and the
+ *      addresses in q -> addrs or to the getaddrinfo error, or 0 if the
+ *      callback of q will be run once a resolver answers.
+ */
+int dns_resolve(DnsQuery *q, const char *host, const char *port) {
+    time_t now = time(NULL);
+    DnsEntry *e;
+
+    q -> addrs = NULL;
+    if ((q -> port = parse_port(port)) < 0) {
+        q -> err = EAI_SERVICE;
+        return 1;
+    }
+    pthread_mutex_lock(&lock);
+    if ((e = find_entry(host, now)) == NULL) {
+        pthread_mutex_unlock(&lock);
+        q -> err = EAI_MEMORY;
+        return 1;
+    }
+    e -> used = now;
+    if (e -> valid && now < e -> expires) {
+        if (e -> addrs) {
+            hits++;
+        }
+        else {
+            negative_hits++;
+        }
+        answer(q, e, e -> err);
+        pthread_mutex_unlock(&lock);
+        return 1;
+    }
+    if (e -> valid && e -> addrs && now < e -> expires + DNS_STALE_TTL) {
+        /* good enough for now, but have it refreshed */
+        stale_hits++;
+        if (!e -> resolving) {
+            refreshes++;
+            queue_job(e);
+        }
+        answer(q, e, 0);
+        pthread_mutex_unlock(&lock);
+        return 1;
+    }
+    /* wait for the answer */
+    misses++;
+    q -> state = DNS_WAITING;
+    q -> entry = e;
+    q -> mailbox = mailbox;
+    q -> next = e -> waiters;
+    e -> waiters = q;
+    if (!e -> resolving) {
+        queue_job(e);
+    }
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+/*
+ * dns_cancel - forget q, whose owner goes away, wherever it waits
+ */
+void dns_cancel(DnsQuery *q) {
+    DnsQuery **pp, *prev;
+
+    pthread_mutex_lock(&lock);
+    if (q -> state == DNS_WAITING) {
+        for (pp = &q -> entry -> waiters; *pp != q; pp = &(*pp) -> next) {
+        }
+        *pp = q -> next;
+    }
+    else if (q -> state == DNS_DELIVERING) {
+        DnsMailbox *mb = q -> mailbox;
+        for (prev = NULL, pp = &mb -> head; *pp != q;
+                prev = *pp, pp = &(*pp) -> next) {
+        }
+        *pp = q -> next;
+        if (mb -> tail == q) {
+            mb -> tail = prev;
+        }
+    }
+    q -> state = DNS_IDLE;
+    pthread_mutex_unlock(&lock);
+    dns_free(q -> addrs);
+    q -> addrs = NULL;
+}
+
+/*
+ * dns_free - release the addresses of an answer
+ */
+void dns_free(struct addrinfo *addrs) {
+    struct addrinfo *next;
+
+    for (; addrs; addrs = next) {
+        next = addrs -> ai_next;
+        free(addrs);
+    }
+}
+
+/*
+ * dns_stats - append the resolver cache metrics
+ */
+void dns_stats(Buffer *b) {
+    pthread_mutex_lock(&lock);
+    buffer_printf(b, "dns_ttl %d\n", DNS_TTL);
+    buffer_printf(b, "dns_stale_ttl %d\n", DNS_STALE_TTL);
+    buffer_printf(b, "dns_negative_ttl %d\n", DNS_NEGATIVE_TTL);
+    buffer_printf(b, "dns_entries %lu\n", entry_count);
+    buffer_printf(b, "dns_hits %lu\n", hits);
+    buffer_printf(b, "dns_stale_hits %lu\n", stale_hits);
+    buffer_printf(b, "dns_negative_hits %lu\n", negative_hits);
+    buffer_printf(b, "dns_misses %lu\n", misses);
+    buffer_printf(b, "dns_refreshes %lu\n", refreshes);
+    buffer_printf(b, "dns_failures %lu\n", failures);
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * resolver_thread - the thread function of a resolver: look the queued
+ *      names up one after the other
+ */
+static void *resolver_thread(void *arg) {
+    struct addrinfo hints, *res;
+    DnsEntry *e;
+    int rc;
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_socktype = SOCK_STREAM;  /* Open a connection */
+    hints.ai_flags = AI_ADDRCONFIG;   /* Recommended for connections */
+    while (1) {
+        pthread_mutex_lock(&lock);
+        while ((e = jobs) == NULL) {
+            pthread_cond_wait(&jobs_ready, &lock);
+        }
+        if ((jobs = e -> job_next) == NULL) {
+            jobs_tail = NULL;
+        }
+        pthread_mutex_unlock(&lock);
+
+        /* the entry stays while it is resolving, and so does its name */
+        res = NULL;
+        rc = getaddrinfo(e -> host, NULL, &hints, &res);
+
+        pthread_mutex_lock(&lock);
+        resolved(e, res, rc);
+        pthread_mutex_unlock(&lock);
+    }
+    return NULL;
+}
+
+/*
+ * resolved - store the answer rc, res of getaddrinfo for e and hand it
+ *      to the waiting queries, with lock held
+ */
+static void resolved(DnsEntry *e, struct addrinfo *res, int rc) {
+    time_t now = time(NULL);
+    DnsQuery *q;
+    int err = rc;
+
+    e -> resolving = 0;
+    if (rc == 0 || rc == EAI_NONAME) {
+        if (e -> addrs) {
+            freeaddrinfo(e -> addrs);
+        }
+        e -> addrs = rc == 0 ? res : NULL;
+        e -> err = rc;
+        e -> valid = 1;
+        e -> expires = now + (rc == 0 ? DNS_TTL : DNS_NEGATIVE_TTL);
+    }
+    else {
+        /* maybe passing, keep what we had */
+        failures++;
+        if (e -> valid && e -> addrs) {
+            err = 0;
+        }
+    }
+
+    while ((q = e -> waiters) != NULL) {
+        DnsMailbox *mb = q -> mailbox;
+        uint64_t one = 1;
+
+        e -> waiters = q -> next;
+        answer(q, e, err);
+        q -> state = DNS_DELIVERING;
+        q -> next = NULL;
+        if (mb -> tail) {
+            mb -> tail -> next = q;
+            mb -> tail = q;
+            continue;
+        }
+        mb -> head = mb -> tail = q;
+        /* the first one in wakes the worker, which takes them all */
+        if (write(mb -> fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            unix_error_non_exit("eventfd write error");
+        }
+    }
+}
+
+/*
+ * answer - give q the answer of e, or err if it is an error,
+ *      with lock held
+ */
+static void answer(DnsQuery *q, DnsEntry *e, int err) {
+    q -> err = err;
+    q -> addrs = NULL;
+    if (err == 0 && (q -> addrs = copy_addrs(e -> addrs, q -> port)) == NULL) {
+        q -> err = EAI_MEMORY;
+    }
+}
+
+/*
+ * find_entry - find the entry of host, creating an empty one if there
+ *      is none, with lock held.
+ *      Returns the entry, NULL if malloc failed.
+ */
+static DnsEntry *find_entry(const char *host, time_t now) {
+    DnsEntry **bucket = &table[hash_host(host) & (DNS_BUCKETS - 1)];
+    DnsEntry *e;
+
+    for (e = *bucket; e; e = e -> next) {
+        if (!strcasecmp(e -> host, host)) {
+            return e;
+        }
+    }
+    if (entry_count >= DNS_MAX_ENTRIES) {
+        evict_entry();
+    }
+    if ((e = (DnsEntry *) calloc(1, sizeof(DnsEntry))) == NULL ||
+            (e -> host = strdup(host)) == NULL) {
+        unix_error_non_exit("malloc for dns error");
+        free(e);
+        return NULL;
+    }
+    e -> used = now;
+    e -> next = *bucket;
+    *bucket = e;
+    entry_count++;
+    return e;
+}
+
+/*
+ * evict_entry - drop the least recently used entry nobody waits for,
+ *      with lock held
+ */
+static void evict_entry(void) {
+    DnsEntry **pp, **victim = NULL;
+    size_t i;
+
+    for (i = 0; i < DNS_BUCKETS; i++) {
+        for (pp = &table[i]; *pp; pp = &(*pp) -> next) {
+            if ((*pp) -> resolving) {
+                continue;
+            }
+            if (victim == NULL || (*pp) -> used < (*victim) -> used) {
+                victim = pp;
+            }
+        }
+    }
+    if (victim == NULL) {
+        /* all of them are being resolved, go over the limit for now */
+        return;
+    }
+    DnsEntry *e = *victim;
+    *victim = e -> next;
+    if (e -> addrs) {
+        freeaddrinfo(e -> addrs);
+    }
+    free(e -> host);
+    free(e);
+    entry_count--;
+}
+
+/*
+ * queue_job - hand e to the resolvers, with lock held
+ */
+static void queue_job(DnsEntry *e) {
+    e -> resolving = 1;
+    e -> job_next = NULL;
+    if (jobs_tail) {
+        jobs_tail -> job_next = e;
+    }
+    else {
+        jobs = e;
+    }
+    jobs_tail = e;
+    pthread_cond_signal(&jobs_ready);
+}
+
+/*
+ * copy_addrs - copy the addresses for a query, with port put in.
+ *      Returns the copy, NULL if there is none or malloc failed.
+ */
+static struct addrinfo *copy_addrs(struct addrinfo *addrs, int port) {
+    struct addrinfo *head = NULL, **tail = &head;
+    DnsAddr *a;
+
+    for (; addrs; addrs = addrs -> ai_next) {
+        if (addrs -> ai_addrlen > sizeof(a -> addr)) {
+            continue;
+        }
+        if ((a = (DnsAddr *) malloc(sizeof(DnsAddr))) == NULL) {
+            dns_free(head);
+            return NULL;
+        }
+        a -> ai = *addrs;
+        a -> ai.ai_canonname = NULL;
+        a -> ai.ai_next = NULL;
+        a -> ai.ai_addr = (struct sockaddr *) &a -> addr;
+        memcpy(&a -> addr, addrs -> ai_addr, addrs -> ai_addrlen);
+        if (a -> ai.ai_family == AF_INET) {
+            ((struct sockaddr_in *) &a -> addr) -> sin_port = htons(port);
+        }
+        else if (a -> ai.ai_family == AF_INET6) {
+            ((struct sockaddr_in6 *) &a -> addr) -> sin6_port = htons(port);
+        }
+        *tail = &a -> ai;
+        tail = &a -> ai.ai_next;
+    }
+    return head;
+}
+
+/*
+ * parse_port - the numeric port.
+ *      Returns the port, -1 if it is not a valid port number.
+ */
+static int parse_port(const char *port) {
+    char *end;
+    long n = strtol(port, &end, 10);
+
+    if (end == port || *end != '\0' || n < 0 || n > 65535) {
+        return -1;
+    }
+    return (int) n;
+}
+
+/*
+ * hash_host - FNV-1a hash of the name, ignoring case
+ */
+static unsigned int hash_host(const char *host) {
+    unsigned int h = 2166136261u;
+
+    for (; *host; host++) {
+        h ^= (unsigned char) tolower((unsigned char) *host);
+        h *= 16777619u;
+    }
+    return h;
+}
@@ -0,0 +1,77 @@
+/*
+ * dns.h - declarations for the shared resolver cache
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ */
+#ifndef __DNS_H__
+#define __DNS_H__
+
+#include <netdb.h>
+#include <time.h>
+#include "buffer.h"
+
+#define DNS_TTL 60              /* seconds an answer is used as is */
+#define DNS_STALE_TTL 300       /* seconds past that it is served stale
+                                   while it is refreshed */
+#define DNS_NEGATIVE_TTL 5      /* seconds a nonexistent name is remembered */
+#define DNS_MAX_ENTRIES 1024    /* max names kept */
+#define DNS_BUCKETS 1024        /* hash buckets, a power of 2 */
+#define DNS_THREADS 2           /* resolver threads */
+
+typedef struct dns_query_type DnsQuery;
+typedef void (*DnsCallback)(DnsQuery *q);
+
+/* where a query is */
+typedef enum {
+    DNS_IDLE,               /* not asked, or answered and handed out */
+    DNS_WAITING,            /* waiting for a resolver thread */
+    DNS_DELIVERING,         /* answered, queued in its worker's mailbox */
+} DnsQueryState;
+
+/* the completed queries of a worker, signalled through an eventfd */
+typedef struct dns_mailbox_type {
+    int fd;                 /* the eventfd, read by the worker's loop */
+    DnsQuery *head;         /* completed queries, oldest first */
+    DnsQuery *tail;
+} DnsMailbox;
+
+/* a name cached with its answer */
+typedef struct dns_entry_type {
+    char *host;                 /* the name */
+    struct addrinfo *addrs;     /* its addresses without the port,
+                                   NULL if it does not exist */
+    int err;                    /* EAI_NONAME if it does not exist */
+    int valid;                  /* whether an answer came yet */
+    int resolving;              /* whether a resolver has it */
+    time_t expires;             /* the answer is fresh until then */
+    time_t used;                /* the last lookup, for the eviction */
+    DnsQuery *waiters;          /* queries waiting for the answer */
+    struct dns_entry_type *next;        /* hash chain */
+    struct dns_entry_type *job_next;    /* resolver queue */
+} DnsEntry;
+
+/* a lookup of a connection, answered now or through its mailbox */
+struct dns_query_type {
+    DnsQueryState state;        /* where the query is */
+    DnsCallback callback;       /* called by the worker once answered */
+    void *data;                 /* owner of the query */
+    int port;                   /* the port to put into the addresses */
+    int err;                    /* 0 or the getaddrinfo error */
+    struct addrinfo *addrs;     /* the answer, freed with dns_free */
+    DnsEntry *entry;            /* the entry waited for */
+    DnsMailbox *mailbox;        /* the worker to answer */
+    DnsQuery *next;             /* next waiter or next in the mailbox */
+};
+
+int dns_init(void);
+int dns_mailbox_init(DnsMailbox *mb);
+void dns_mailbox_bind(DnsMailbox *mb);
+void dns_mailbox_drain(DnsMailbox *mb);
+void dns_query_init(DnsQuery *q, DnsCallback callback, void *data);
+int dns_resolve(DnsQuery *q, const char *host, const char *port);
+void dns_cancel(DnsQuery *q);
+void dns_free(struct addrinfo *addrs);
+void dns_stats(Buffer *b);
+
+#endif /* __DNS_H__ */
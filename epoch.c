@@ -0,0 +1,173 @@
+/*
+ * epoch.c - epoch based memory reclamation
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * Lets readers follow pointers into a shared structure without any lock,
+ * while writers unlink and free its objects. A reader brackets its reads
+ * with epoch_enter and epoch_exit, which only announce the global epoch
+ * in a slot of the reader's own thread, so readers never write memory
+ * another thread uses. A writer unlinks an object, then retires it
+ * (epoch_retire): it is tagged with the global epoch, and once two more
+ * epochs have passed a later write takes it off the list (epoch_detach)
+ * and releases it after letting go of its lock (epoch_release), so the
+ * frees never hold the lock up.
+ *
+ * The global epoch only moves on when every thread inside a read section
+ * has announced the current one. So once it is two epochs past the one
+ * an object was retired in, every reader which might have seen the
+ * object before it was unlinked has left, and the object can be freed.
+ * A reader staying inside its section holds the reclamation up, so the
+ * sections must be short.
+ */
+#include "csapp.h"
+#include "epoch.h"
+#include "proxylib.h"
+
+static atomic_ulong global_epoch = 1;           /* the current epoch */
+static _Atomic(EpochThread *) threads = NULL;   /* every reader thread */
+static __thread EpochThread *self = NULL;       /* this thread's slot */
+
+/* function declarations */
+static EpochThread *epoch_register(void);
+static unsigned long epoch_advance(void);
+
+/*
+ * epoch_enter - start a read section, which may nest
+ */
+void epoch_enter(void) {
+    EpochThread *t = self ? self : epoch_register();
+
+    if (t -> nesting++ > 0) {
+        return;
+    }
+    atomic_store_explicit(&t -> epoch,
+            (atomic_load_explicit(&global_epoch, memory_order_acquire) << 1)
+            | 1, memory_order_relaxed);
+    /* the announcement must be visible before any pointer is read */
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+/*
+ * epoch_exit - end a read section, nothing read in it may be used after
+ */
+void epoch_exit(void) {
+    EpochThread *t = self;
+
+    if (--t -> nesting > 0) {
+        return;
+    }
+    atomic_store_explicit(&t -> epoch, 0, memory_order_release);
+}
+
+/*
+ * epoch_retire - queue the release of an object unlinked from the
+ *      shared structure, d being the storage for it
+ */
+void epoch_retire(EpochList *l, EpochDeferred *d,
+        void (*release)(void *arg), void *arg) {
+    d -> release = release;
+    d -> arg = arg;
+    d -> next = NULL;
+    /* the unlink must be visible before the epoch is sampled */
+    atomic_thread_fence(memory_order_seq_cst);
+    d -> epoch = atomic_load_explicit(&global_epoch, memory_order_relaxed);
+    if (l -> tail) {
+        l -> tail -> next = d;
+    }
+    else {
+        l -> head = d;
+    }
+    l -> tail = d;
+    l -> count++;
+}
+
+/*
+ * epoch_detach - move the epoch on if the readers allow it and take the
+ *      objects no reader can see anymore off l.
+ *      Returns them oldest first, for epoch_release.
+ */
+EpochDeferred *epoch_detach(EpochList *l) {
+    EpochDeferred *ready = l -> head, *last = NULL, *d;
+    unsigned long epoch;
+
+    if (l -> head == NULL) {
+        return NULL;
+    }
+    epoch = epoch_advance();
+    while ((d = l -> head) != NULL && d -> epoch + 2 <= epoch) {
+        l -> head = d -> next;
+        l -> count--;
+        last = d;
+    }
+    if (last == NULL) {
+        return NULL;
+    }
+    last -> next = NULL;
+    if (l -> head == NULL) {
+        l -> tail = NULL;
+    }
+    return ready;
+}
+
+/*
+ * epoch_release - release the objects detached from a list, which no
+ *      lock needs to be held for
+ */
+void epoch_release(EpochDeferred *d) {
+    EpochDeferred *next;
+
+    for (; d; d = next) {
+        /* the object may hold d itself */
+        next = d -> next;
+        d -> release(d -> arg);
+    }
+}
+
+/*
+ * epoch_register - give the calling thread its slot, kept for the life
+ *      of the process
+ */
+static EpochThread *epoch_register(void) {
+    EpochThread *t;
+
+    if ((t = (EpochThread *) aligned_alloc(64, sizeof(EpochThread))) == NULL) {
+        unix_error("malloc for epoch error");
+    }
+    atomic_init(&t -> epoch, 0);
+    t -> nesting = 0;
+    t -> next = atomic_load_explicit(&threads, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&threads, &t -> next, t,
+                memory_order_release, memory_order_relaxed)) {
+    }
+    self = t;
+    return t;
+}
+
+/*
+ * epoch_advance - move the global epoch on by one if every thread in
+ *      a read section has seen the current one.
+ *      Returns the global epoch.
+ */
+static unsigned long epoch_advance(void) {
+    unsigned long epoch = atomic_load_explicit(&global_epoch,
+            memory_order_relaxed);
+    EpochThread *t;
+
+    atomic_thread_fence(memory_order_seq_cst);
+    for (t = atomic_load_explicit(&threads, memory_order_acquire); t;
+            t = t -> next) {
+        unsigned long e = atomic_load_explicit(&t -> epoch,
+                memory_order_acquire);
+        if ((e & 1) && (e >> 1) != epoch) {
+            return epoch;
+        }
+    }
+    /* another writer may have moved it meanwhile, either way is fine */
+    if (atomic_compare_exchange_strong_explicit(&global_epoch, &epoch,
+                epoch + 1, memory_order_acq_rel, memory_order_relaxed)) {
+        epoch++;
+    }
+    return epoch;
+}
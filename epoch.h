@@ -0,0 +1,43 @@
+/*
+ * epoch.h - declarations for the epoch based memory reclamation
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ */
+#ifndef __EPOCH_H__
+#define __EPOCH_H__
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/* the epoch announcement of a thread, on a cache line of its own */
+typedef struct epoch_thread_type {
+    _Alignas(64) atomic_ulong epoch;    /* (epoch << 1) | 1 while reading,
+                                           0 otherwise */
+    int nesting;                        /* depth of epoch_enter calls */
+    struct epoch_thread_type *next;     /* all the threads */
+} EpochThread;
+
+/* an object whose release waits until no reader can see it anymore */
+typedef struct epoch_deferred_type {
+    void (*release)(void *arg);
+    void *arg;
+    unsigned long epoch;                /* the epoch it was retired in */
+    struct epoch_deferred_type *next;
+} EpochDeferred;
+
+/* retired objects, oldest first, owned by one writer at a time */
+typedef struct epoch_list_type {
+    EpochDeferred *head;
+    EpochDeferred *tail;
+    size_t count;                       /* objects waiting */
+} EpochList;
+
+void epoch_enter(void);
+void epoch_exit(void);
+void epoch_retire(EpochList *l, EpochDeferred *d,
+        void (*release)(void *arg), void *arg);
+EpochDeferred *epoch_detach(EpochList *l);
+void epoch_release(EpochDeferred *d);
+
+#endif /* __EPOCH_H__ */
@@ -0,0 +1,139 @@
+/*
+ * event.c - the epoll based event loop
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * Every descriptor is registered with an EventHandler, whose address is
+ * stored as the epoll user data, so a ready event leads straight to its
+ * callback. Interest sets are level triggered and only rewritten when
+ * they change.
+ *
+ * A callback may tear down an object owning handlers which still have
+ * events queued in the same epoll_wait batch. Such objects are released
+ * through event_defer, which runs the release after the batch is done.
+ */
+#include "csapp.h"
+#include "event.h"
+#include "proxylib.h"
+
+/*
+ * event_loop_init - create the epoll instance of the loop.
+ *      Returns 0 on success, -1 on failure.
+ */
+int event_loop_init(EventLoop *loop) {
+    if ((loop -> epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        unix_error_non_exit("epoll_create1 error");
+        return -1;
+    }
+    loop -> deferred = NULL;
+    return 0;
+}
+
+/*
+ * event_handler_init - set up a handler which is not registered yet
+ */
+void event_handler_init(EventHandler *h, int fd,
+        EventCallback callback, void *data) {
+    h -> fd = fd;
+    h -> events = 0;
+    h -> registered = 0;
+    h -> callback = callback;
+    h -> data = data;
+}
+
+/*
+ * event_add - register the handler with the interest set events.
+ *      Returns 0 on success, -1 on failure.
+ */
+int event_add(EventLoop *loop, EventHandler *h, uint32_t events) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = h;
+    if (epoll_ctl(loop -> epfd, EPOLL_CTL_ADD, h -> fd, &ev) < 0) {
+        unix_error_non_exit("epoll_ctl add error");
+        return -1;
+    }
+    h -> events = events;
+    h -> registered = 1;
+    return 0;
+}
+
+/*
+ * event_mod - change the interest set of the handler,
+ *      registering it first if needed.
+ *      Returns 0 on success, -1 on failure.
+ */
+int event_mod(EventLoop *loop, EventHandler *h, uint32_t events) {
+    if (!h -> registered) {
+        return event_add(loop, h, events);
+    }
+    if (h -> events == events) {
+        /* nothing changed, save the syscall */
+        return 0;
+    }
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = h;
+    if (epoll_ctl(loop -> epfd, EPOLL_CTL_MOD, h -> fd, &ev) < 0) {
+        unix_error_non_exit("epoll_ctl mod error");
+        return -1;
+    }
+    h -> events = events;
+    return 0;
+}
+
+/*
+ * event_del - unregister the handler from the loop
+ */
+void event_del(EventLoop *loop, EventHandler *h) {
+    if (!h -> registered) {
+        return;
+    }
+    if (epoll_ctl(loop -> epfd, EPOLL_CTL_DEL, h -> fd, NULL) < 0) {
+        unix_error_non_exit("epoll_ctl del error");
+    }
+    h -> registered = 0;
+    h -> events = 0;
+}
+
+/*
+ * event_defer - release arg once the current batch of events is handled
+ */
+void event_defer(EventLoop *loop, EventDeferred *d,
+        void (*release)(void *arg), void *arg) {
+    d -> release = release;
+    d -> arg = arg;
+    d -> next = loop -> deferred;
+    loop -> deferred = d;
+}
+
+/*
+ * event_loop_run - wait for events and dispatch them forever
+ */
+void event_loop_run(EventLoop *loop) {
+    struct epoll_event events[EVENT_BATCH];
+    int i, n;
+
+    while (1) {
+        if ((n = epoll_wait(loop -> epfd, events, EVENT_BATCH, -1)) < 0) {
+            if (errno != EINTR) {
+                unix_error_non_exit("epoll_wait error");
+            }
+            continue;
+        }
+        for (i = 0; i < n; i++) {
+            EventHandler *h = (EventHandler *) events[i].data.ptr;
+            /* a handler unregistered earlier in this batch is stale */
+            if (h -> registered) {
+                h -> callback(h, events[i].events);
+            }
+        }
+        /* now nothing in this batch can refer to the released objects */
+        while (loop -> deferred) {
+            EventDeferred *d = loop -> deferred;
+            loop -> deferred = d -> next;
+            d -> release(d -> arg);
+        }
+    }
+}
@@ -0,0 +1,50 @@
+/*
+ * event.h - declarations for the epoll based event loop
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ */
+#ifndef __EVENT_H__
+#define __EVENT_H__
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#define EVENT_BATCH 256     /* max events handled per epoll_wait */
+
+typedef struct event_handler_type EventHandler;
+typedef void (*EventCallback)(EventHandler *handler, uint32_t events);
+
+/* a descriptor registered in the loop and the callback serving it */
+struct event_handler_type {
+    int fd;                 /* the watched descriptor, -1 if none */
+    uint32_t events;        /* the currently registered interest set */
+    int registered;         /* whether fd is in the epoll set */
+    EventCallback callback; /* called with the ready events */
+    void *data;             /* owner of the handler */
+};
+
+/* an object whose release is deferred until the current batch is done */
+typedef struct event_deferred_type {
+    void (*release)(void *arg);
+    void *arg;
+    struct event_deferred_type *next;
+} EventDeferred;
+
+/* the event loop */
+typedef struct event_loop_type {
+    int epfd;                   /* the epoll instance */
+    EventDeferred *deferred;    /* releases pending after this batch */
+} EventLoop;
+
+int event_loop_init(EventLoop *loop);
+void event_loop_run(EventLoop *loop);
+void event_handler_init(EventHandler *h, int fd,
+        EventCallback callback, void *data);
+int event_add(EventLoop *loop, EventHandler *h, uint32_t events);
+int event_mod(EventLoop *loop, EventHandler *h, uint32_t events);
+void event_del(EventLoop *loop, EventHandler *h);
+void event_defer(EventLoop *loop, EventDeferred *d,
+        void (*release)(void *arg), void *arg);
+
+#endif /* __EVENT_H__ */
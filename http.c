@@ -0,0 +1,427 @@
+/*
+ * http.c - an incremental HTTP/1.1 response parser
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * To reuse a connection to an origin, the proxy has to know exactly where
+ * each response ends rather than waiting for the origin to close. The
+ * parser is fed the bytes as they arrive, in pieces of any size, and
+ * finds the end from the Content-Length or the chunked encoding. Interim
+ * 1xx responses before the final one are skipped, as the client never
+ * asked for them.
+ *
+ * The head is normalized on the way: the hop-by-hop headers describing
+ * the origin connection (Connection, Keep-Alive, Transfer-Encoding) are
+ * dropped, and a chunked body is decoded, so the proxy can frame the
+ * response for the client its own way. The decoded body is appended to
+ * the caller's buffer.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <limits.h>
+#include "http.h"
+
+/* function declarations */
+static ssize_t collect_head(HttpResponse *r, const char *buf, size_t n);
+static ssize_t collect_line(HttpResponse *r, const char *buf, size_t n,
+        int *complete);
+static int parse_head(HttpResponse *r);
+static int parse_line(HttpResponse *r);
+static int parse_length(const char *value, size_t len, long long *length);
+
+/*
+ * http_response_init - get ready for a new response
+ */
+void http_response_init(HttpResponse *r) {
+    r -> state = HTTP_HEAD;
+    buffer_init(&r -> raw);
+    buffer_init(&r -> head);
+    r -> status = 0;
+    r -> keep_alive = 0;
+    r -> chunked = 0;
+    r -> content_length = -1;
+    r -> remaining = 0;
+    r -> received = 0;
+    r -> body_size = 0;
+}
+
+/*
+ * http_response_free - release the buffers of the parser
+ */
+void http_response_free(HttpResponse *r) {
+    buffer_free(&r -> raw);
+    buffer_free(&r -> head);
+}
+
+/*
+ * http_response_feed - parse n more bytes of the response, appending
+ *      the decoded body to body. Stops right after the head is
+ *      complete, so the caller can pass it on before the body, and at
+ *      the end of the response.
+ *      Returns the number of bytes used, -1 if the response is malformed
+ *      or memory ran out.
+ */
+ssize_t http_response_feed(HttpResponse *r, const char *buf, size_t n,
+        Buffer *body) {
+    size_t used = 0;
+    ssize_t k;
+    int complete;
+
+    while (used < n && r -> state != HTTP_DONE) {
+        const char *p = buf + used;
+        size_t left = n - used;
+
+        switch (r -> state) {
+        case HTTP_HEAD:
+            if ((k = collect_head(r, p, left)) < 0) {
+                return -1;
+            }
+            used += k;
+            if (r -> state != HTTP_HEAD) {
+                r -> received += used;
+                return used;
+            }
+            break;
+
+        case HTTP_BODY:
+        case HTTP_CHUNK_DATA:
+        case HTTP_UNTIL_CLOSE:
+            k = left;
+            if (r -> state != HTTP_UNTIL_CLOSE && k > r -> remaining) {
+                k = r -> remaining;
+            }
+            if (buffer_append(body, p, k) < 0) {
+                return -1;
+            }
+            used += k;
+            r -> body_size += k;
+            if (r -> state == HTTP_UNTIL_CLOSE) {
+                break;
+            }
+            if ((r -> remaining -= k) == 0) {
+                r -> state = r -> state == HTTP_BODY ?
+                    HTTP_DONE : HTTP_CHUNK_END;
+            }
+            break;
+
+        default:
+            /* chunk size, chunk end and trailer lines */
+            if ((k = collect_line(r, p, left, &complete)) < 0) {
+                return -1;
+            }
+            used += k;
+            if (complete && parse_line(r) < 0) {
+                return -1;
+            }
+            break;
+        }
+    }
+    r -> received += used;
+    return used;
+}
+
+/*
+ * collect_head - collect the head until the blank line ending it.
+ *      Returns the number of bytes used, -1 on failure.
+ */
+static ssize_t collect_head(HttpResponse *r, const char *buf, size_t n) {
+    /* only the new bytes and the 3 before can complete "\r\n\r\n" */
+    size_t scan = buffer_pending(&r -> raw);
+    scan = scan > 3 ? scan - 3 : 0;
+    char *end;
+
+    if (buffer_pending(&r -> raw) + n > HTTP_MAX_HEAD) {
+        fprintf(stderr, "response headers are too large\n");
+        return -1;
+    }
+    /* keep one more byte to terminate the head as a string */
+    if (buffer_append(&r -> raw, buf, n) < 0 ||
+            buffer_reserve(&r -> raw, 1) < 0) {
+        return -1;
+    }
+    r -> raw.data[r -> raw.len] = '\0';
+    if ((end = strstr(buffer_head(&r -> raw) + scan, "\r\n\r\n")) == NULL) {
+        return n;
+    }
+    /* give back the bytes after the head, they belong to the body */
+    end += 4;
+    size_t extra = r -> raw.data + r -> raw.len - end;
+    r -> raw.len -= extra;
+    *end = '\0';
+    /* a NUL would cut the head short for the string parsing */
+    if (memchr(buffer_head(&r -> raw), '\0',
+                buffer_pending(&r -> raw)) != NULL) {
+        fprintf(stderr, "response headers contain a NUL byte\n");
+        return -1;
+    }
+    if (parse_head(r) < 0) {
+        return -1;
+    }
+    buffer_consume(&r -> raw, buffer_pending(&r -> raw));
+    return n - extra;
+}
+
+/*
+ * parse_head - interpret the complete head collected in raw
+ *      and decide how the body is framed.
+ *      Returns 0 on success, -1 if the head is malformed.
+ */
+static int parse_head(HttpResponse *r) {
+    char *line = buffer_head(&r -> raw);
+    char *headers, *p, *key, *value;
+    size_t keylen, valuelen;
+    int minor, other_coding = 0;
+
+    if ((headers = strstr(line, "\r\n")) == NULL) {
+        fprintf(stderr, "malformed status line\n");
+        return -1;
+    }
+    headers += 2;
+    if (sscanf(line, "HTTP/1.%d %d", &minor, &r -> status) != 2 ||
+            r -> status < 100 || r -> status > 999) {
+        fprintf(stderr, "malformed status line\n");
+        return -1;
+    }
+    if (r -> status == 101) {
+        fprintf(stderr, "switching protocols is not supported\n");
+        return -1;
+    }
+    if (r -> status / 100 == 1) {
+        /* an interim response, the final one follows */
+        r -> status = 0;
+        return 0;
+    }
+    /* HTTP/1.1 connections are persistent unless said otherwise */
+    r -> keep_alive = minor >= 1;
+
+    /* first learn how the body is framed */
+    for (p = headers; (p = http_next_header(p, &key, &keylen,
+                    &value, &valuelen)) != NULL; ) {
+        if (keylen == 10 && !strncasecmp("Connection", key, keylen)) {
+            if (http_has_token(value, valuelen, "close")) {
+                r -> keep_alive = 0;
+            }
+            else if (http_has_token(value, valuelen, "keep-alive")) {
+                r -> keep_alive = 1;
+            }
+        }
+        else if (keylen == 17 &&
+                !strncasecmp("Transfer-Encoding", key, keylen)) {
+            if (http_has_token(value, valuelen, "chunked")) {
+                r -> chunked = 1;
+            }
+            else {
+                other_coding = 1;
+            }
+        }
+        else if (keylen == 14 &&
+                !strncasecmp("Content-Length", key, keylen)) {
+            long long length;
+            if (parse_length(value, valuelen, &length) < 0 ||
+                    (r -> content_length >= 0 &&
+                     r -> content_length != length)) {
+                fprintf(stderr, "malformed Content-Length\n");
+                return -1;
+            }
+            r -> content_length = length;
+        }
+    }
+
+    /* then keep the status line and the end-to-end headers */
+    if (buffer_append(&r -> head, line, headers - line) < 0) {
+        return -1;
+    }
+    for (p = headers; (p = http_next_header(p, &key, &keylen,
+                    &value, &valuelen)) != NULL; ) {
+        if ((keylen == 10 && !strncasecmp("Connection", key, keylen)) ||
+                (keylen == 10 && !strncasecmp("Keep-Alive", key, keylen)) ||
+                (keylen == 16 &&
+                 !strncasecmp("Proxy-Connection", key, keylen)) ||
+                (keylen == 17 &&
+                 !strncasecmp("Transfer-Encoding", key, keylen))) {
+            continue;
+        }
+        if (keylen == 14 && !strncasecmp("Content-Length", key, keylen) &&
+                (r -> chunked || other_coding)) {
+            /* a transfer coding overrides the length */
+            continue;
+        }
+        if (buffer_append(&r -> head, key, value + valuelen - key) < 0 ||
+                buffer_append(&r -> head, "\r\n", 2) < 0) {
+            return -1;
+        }
+    }
+
+    if (r -> status == 204 || r -> status == 304) {
+        /* these never have a body */
+        r -> state = HTTP_DONE;
+    }
+    else if (other_coding) {
+        /* a coding we cannot decode, only the close ends it */
+        r -> keep_alive = 0;
+        r -> state = HTTP_UNTIL_CLOSE;
+    }
+    else if (r -> chunked) {
+        r -> content_length = -1;
+        r -> state = HTTP_CHUNK_SIZE;
+    }
+    else if (r -> content_length >= 0) {
+        r -> remaining = r -> content_length;
+        r -> state = r -> remaining ? HTTP_BODY : HTTP_DONE;
+    }
+    else {
+        r -> keep_alive = 0;
+        r -> state = HTTP_UNTIL_CLOSE;
+    }
+    return 0;
+}
+
+/*
+ * parse_length - read the Content-Length value of len bytes into
+ *      length: decimal digits alone, no sign, no space and no more than
+ *      fit.
+ *      Returns 0 on success, -1 if the value is malformed.
+ */
+static int parse_length(const char *value, size_t len, long long *length) {
+    long long n = 0;
+    size_t i;
+
+    if (len == 0) {
+        return -1;
+    }
+    for (i = 0; i < len; i++) {
+        if (!isdigit((unsigned char) value[i]) ||
+                n > (LLONG_MAX - (value[i] - '0')) / 10) {
+            return -1;
+        }
+        n = n * 10 + (value[i] - '0');
+    }
+    *length = n;
+    return 0;
+}
+
+/*
+ * next_header - find the header line at p, ending at the blank line.
+ *      Returns the start of the following line, NULL at the end.
+ */
+char *http_next_header(char *p, char **key, size_t *keylen,
+        char **value, size_t *valuelen) {
+    char *eol, *colon;
+
+    while ((eol = strstr(p, "\r\n")) != NULL && eol != p) {
+        if ((colon = memchr(p, ':', eol - p)) == NULL) {
+            /* not a header, skip it */
+            p = eol + 2;
+            continue;
+        }
+        *key = p;
+        *keylen = colon - p;
+        for (p = colon + 1; p < eol && (*p == ' ' || *p == '\t'); p++) {
+        }
+        *value = p;
+        for (p = eol; p > *value && (p[-1] == ' ' || p[-1] == '\t'); p--) {
+        }
+        *valuelen = p - *value;
+        return eol + 2;
+    }
+    return NULL;
+}
+
+/*
+ * collect_line - collect a line of the chunked body, setting complete
+ *      once its line feed is in.
+ *      Returns the number of bytes used, -1 if the line is too long.
+ */
+static ssize_t collect_line(HttpResponse *r, const char *buf, size_t n,
+        int *complete) {
+    const char *lf = memchr(buf, '\n', n);
+    size_t k = lf ? (size_t) (lf - buf) + 1 : n;
+
+    if (buffer_pending(&r -> raw) + k > HTTP_MAX_LINE) {
+        fprintf(stderr, "chunk line is too long\n");
+        return -1;
+    }
+    /* keep one more byte to terminate the line as a string */
+    if (buffer_append(&r -> raw, buf, k) < 0 ||
+            buffer_reserve(&r -> raw, 1) < 0) {
+        return -1;
+    }
+    r -> raw.data[r -> raw.len] = '\0';
+    *complete = lf != NULL;
+    return k;
+}
+
+/*
+ * parse_line - interpret a complete line of the chunked body.
+ *      Returns 0 on success, -1 if the line is malformed.
+ */
+static int parse_line(HttpResponse *r) {
+    char *line = buffer_head(&r -> raw);
+    int blank = !strcmp(line, "\r\n") || !strcmp(line, "\n");
+    unsigned long long size;
+    char *end;
+
+    buffer_consume(&r -> raw, buffer_pending(&r -> raw));
+    switch (r -> state) {
+    case HTTP_CHUNK_SIZE:
+        /* hex size, maybe followed by extensions which we ignore */
+        size = strtoull(line, &end, 16);
+        if (end == line || !isxdigit((unsigned char) *line)) {
+            fprintf(stderr, "malformed chunk size\n");
+            return -1;
+        }
+        if (size == 0) {
+            r -> state = HTTP_TRAILER;
+        }
+        else {
+            r -> remaining = size;
+            r -> state = HTTP_CHUNK_DATA;
+        }
+        return 0;
+
+    case HTTP_CHUNK_END:
+        if (!blank) {
+            fprintf(stderr, "malformed chunk end\n");
+            return -1;
+        }
+        r -> state = HTTP_CHUNK_SIZE;
+        return 0;
+
+    default:
+        /* trailer fields are dropped, the blank line ends the body */
+        if (blank) {
+            r -> state = HTTP_DONE;
+        }
+        return 0;
+    }
+}
+
+/*
+ * http_has_token - whether the comma separated header value of len
+ *      bytes lists token, compared case-insensitively
+ */
+int http_has_token(const char *value, size_t len, const char *token) {
+    size_t toklen = strlen(token);
+    const char *end = value + len;
+    const char *p = value, *q;
+
+    while (p < end) {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+        for (q = p; q < end && *q != ','; q++) {
+        }
+        const char *e = q;
+        while (e > p && (e[-1] == ' ' || e[-1] == '\t')) {
+            e--;
+        }
+        if ((size_t) (e - p) == toklen && !strncasecmp(p, token, toklen)) {
+            return 1;
+        }
+        p = q;
+    }
+    return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * http.h - declarations for the incremental HTTP/1.1 response parser
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ */
+#ifndef __HTTP_H__
+#define __HTTP_H__
+
+#include <sys/types.h>
+#include "buffer.h"
+
+#define HTTP_MAX_HEAD 65536     /* max size of the response headers */
+#define HTTP_MAX_LINE 1024      /* max size of a chunk size or trailer line */
+
+/* where the parser is in the response */
+typedef enum {
+    HTTP_HEAD,          /* reading the status line and the headers */
+    HTTP_BODY,          /* reading a body of known length */
+    HTTP_CHUNK_SIZE,    /* reading a chunk size line */
+    HTTP_CHUNK_DATA,    /* reading the data of a chunk */
+    HTTP_CHUNK_END,     /* reading the CRLF closing the chunk data */
+    HTTP_TRAILER,       /* reading the trailer after the last chunk */
+    HTTP_UNTIL_CLOSE,   /* reading a body which ends with the connection */
+    HTTP_DONE,          /* the response is complete */
+} HttpState;
+
+/* a response read from an origin */
+typedef struct http_response_type {
+    HttpState state;            /* the current state */
+    Buffer raw;                 /* the head or line being collected */
+    Buffer head;                /* status line and end-to-end headers,
+                                   without the closing blank line */
+    int status;                 /* the status code */
+    int keep_alive;             /* whether the origin keeps the connection */
+    int chunked;                /* whether the body is chunked */
+    long long content_length;   /* the Content-Length, -1 if none */
+    unsigned long long remaining; /* bytes left in the body or chunk */
+    size_t received;            /* bytes taken from the origin */
+    size_t body_size;           /* decoded body bytes produced */
+} HttpResponse;
+
+void http_response_init(HttpResponse *r);
+void http_response_free(HttpResponse *r);
+ssize_t http_response_feed(HttpResponse *r, const char *buf, size_t n,
+        Buffer *body);
+char *http_next_header(char *p, char **key, size_t *keylen,
+        char **value, size_t *valuelen);
+int http_has_token(const char *value, size_t len, const char *token);
+
+#endif /* __HTTP_H__ */
@@ -0,0 +1,669 @@
+/*
+ * pool.c - the worker pool
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * A fixed number of worker threads is spawned at startup, each running
+ * its own event loop. The accepting thread hands descriptors over through
+ * one bounded lock-free queue (Vyukov's MPMC ring: every slot carries a
+ * sequence number telling whether it is ready for the next producer or
+ * the next consumer) and signals a worker's eventfd round-robin. Whichever
+ * worker wakes up drains the queue, so an idle worker picks up the slack
+ * of a busy one.
+ *
+ * When the queue is full, pool_dispatch fails and the caller backs off,
+ * which leaves further connections waiting in the kernel backlog instead
+ * of growing memory without bound.
+ *
+ * Alternatively the workers accept by themselves (pool_listen): each one
+ * gets its own SO_REUSEPORT listener, so the kernel spreads connections
+ * among them and no single accepting thread caps the connection rate.
+ * Listeners are registered with EPOLLEXCLUSIVE, so when a listener has
+ * to be shared by all the workers instead, a new connection wakes only
+ * one of them rather than the whole herd.
+ *
+ * With the io_uring engine a worker runs a ring instead of an epoll loop:
+ * the wake eventfd is read by a queued read, and a listener is served by
+ * one multishot accept which keeps posting a completion per connection.
+ *
+ * Every worker also watches the eventfd of its DNS mailbox the same way
+ * as its wake eventfd, to pick up the lookups the resolver threads
+ * answered (see dns.c), and the one of its cache mailbox, for the
+ * readers of objects still being fetched which more came for (see
+ * cache.c), and a timerfd which goes off every POOL_SWEEP_INTERVAL
+ * seconds to time out the connections which missed their deadline (see
+ * conn.c).
+ */
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "csapp.h"
+#include "cgroup.h"
+#include "conn.h"
+#include "pool.h"
+#include "proxylib.h"
+
+static PoolQueue queue;                     /* the hand-off queue */
+static Worker workers[POOL_MAX_WORKERS];    /* the workers */
+static int worker_count = 0;                /* the number of workers */
+static PoolEngine pool_engine;              /* the engine of the workers */
+static atomic_uint next_worker;             /* round-robin wake cursor */
+
+/* function declarations */
+static void *worker_thread(void *arg);
+static void wake_event(EventHandler *h, uint32_t events);
+static void dns_event(EventHandler *h, uint32_t events);
+static void tails_event(EventHandler *h, uint32_t events);
+static void sweep_event(EventHandler *h, uint32_t events);
+static void listen_event(EventHandler *h, uint32_t events);
+static void wake_done(UringOp *op, int res, uint32_t flags);
+static void dns_done(UringOp *op, int res, uint32_t flags);
+static void tails_done(UringOp *op, int res, uint32_t flags);
+static void sweep_done(UringOp *op, int res, uint32_t flags);
+static void accept_done(UringOp *op, int res, uint32_t flags);
+static void drain_queue(Worker *w);
+static void worker_accept(Worker *w, int fd);
+static int queue_push(int fd);
+static int queue_pop(int *fd);
+static int sweep_timer(void);
+static int cgroup_cpu_limit(void);
+static int cgroup_cpu_walk(const char *root, const char *name, int v2);
+static int cgroup_cpu_quota(const char *dir, int v2);
+
+/*
+ * pool_default_size - the worker count matching the CPUs we may use:
+ *      the online CPUs, capped by the cgroup CPU quota if there is one
+ */
+int pool_default_size(void) {
+    int n = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int limit = cgroup_cpu_limit();
+
+    if (n < 1) {
+        n = 1;
+    }
+    if (limit > 0 && limit < n) {
+        n = limit;
+    }
+    return n > POOL_MAX_WORKERS ? POOL_MAX_WORKERS : n;
+}
+
+/*
+ * cgroup_cpu_limit - the CPU quota of our cgroup rounded up to whole
+ *      CPUs, or 0 if there is no quota. The cgroup is the one
+ *      /proc/self/cgroup names (see cgroup.c).
+ */
+static int cgroup_cpu_limit(void) {
+    char v1[MAXLINE], v2[MAXLINE];
+    int limit;
+
+    /* unknown cgroups are looked for at the roots, as in a namespace */
+    if (cgroup_self("cpu", v1, v2) < 0) {
+        strcpy(v1, "/");
+        strcpy(v2, "/");
+    }
+    if (v2[0] && (limit = cgroup_cpu_walk(CGROUP_ROOT, v2, 1)) >= 0) {
+        return limit;
+    }
+    if (v1[0] && (limit = cgroup_cpu_walk(CGROUP_ROOT "/cpu", v1, 0)) >= 0) {
+        return limit;
+    }
+    return 0;
+}
+
+/*
+ * cgroup_cpu_walk - the smallest CPU quota of the cgroup name under
+ *      root and of its parents, which all cap it, v2 for the files of
+ *      the unified hierarchy.
+ *      Returns the quota, 0 if there is none, -1 if no cgroup has files.
+ */
+static int cgroup_cpu_walk(const char *root, const char *name, int v2) {
+    char path[MAXLINE], *slash;
+    size_t root_len = strlen(root);
+    int limit = -1, q;
+
+    snprintf(path, MAXLINE, "%s%.*s", root, MAXLINE / 2, name);
+    while (1) {
+        if ((q = cgroup_cpu_quota(path, v2)) > 0) {
+            limit = limit > 0 && limit < q ? limit : q;
+        }
+        else if (q == 0 && limit < 0) {
+            limit = 0;
+        }
+        if (strlen(path) <= root_len ||
+                (slash = strrchr(path + root_len, '/')) == NULL) {
+            break;
+        }
+        *slash = '\0';
+    }
+    return limit;
+}
+
+/*
+ * cgroup_cpu_quota - the CPU quota set in the cgroup directory dir
+ *      rounded up to whole CPUs, v2 for the files of the unified
+ *      hierarchy.
+ *      Returns the quota, 0 if there is none, -1 if there are no files.
+ */
+static int cgroup_cpu_quota(const char *dir, int v2) {
+    char path[MAXLINE], quota[32];
+    FILE *fp;
+    long q, period;
+    int limit = 0;
+
+    if (v2) {
+        /* "<quota|max> <period>" */
+        snprintf(path, MAXLINE, "%s/cpu.max", dir);
+        if ((fp = fopen(path, "r")) == NULL) {
+            return -1;
+        }
+        if (fscanf(fp, "%31s %ld", quota, &period) == 2 &&
+                strcmp(quota, "max") && (q = atol(quota)) > 0 && period > 0) {
+            limit = (int) ((q + period - 1) / period);
+        }
+        fclose(fp);
+        return limit;
+    }
+    /* quota and period in separate files, quota -1 if none */
+    snprintf(path, MAXLINE, "%s/cpu.cfs_quota_us", dir);
+    if ((fp = fopen(path, "r")) == NULL) {
+        return -1;
+    }
+    if (fscanf(fp, "%ld", &q) != 1) {
+        q = -1;
+    }
+    fclose(fp);
+    snprintf(path, MAXLINE, "%s/cpu.cfs_period_us", dir);
+    if (q > 0 && (fp = fopen(path, "r"))) {
+        if (fscanf(fp, "%ld", &period) == 1 && period > 0) {
+            limit = (int) ((q + period - 1) / period);
+        }
+        fclose(fp);
+    }
+    return limit;
+}
+
+/*
+ * pool_init - set up the hand-off queue and nworkers workers running
+ *      engine, started by pool_start.
+ *      Returns 0 on success, -1 on failure.
+ */
+int pool_init(int nworkers, PoolEngine engine) {
+    size_t i;
+    int wakefd, sweepfd;
+
+    if (nworkers < 1 || nworkers > POOL_MAX_WORKERS) {
+        fprintf(stderr, "worker count must be in [1, %d]\n",
+                POOL_MAX_WORKERS);
+        return -1;
+    }
+    for (i = 0; i < POOL_QUEUE_SIZE; i++) {
+        atomic_init(&queue.cells[i].seq, i);
+    }
+    atomic_init(&queue.enqueue_pos, 0);
+    atomic_init(&queue.dequeue_pos, 0);
+    atomic_init(&next_worker, 0);
+    pool_engine = engine;
+
+    for (worker_count = 0; worker_count < nworkers; worker_count++) {
+        Worker *w = &workers[worker_count];
+        if ((wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+            unix_error_non_exit("eventfd error");
+            return -1;
+        }
+        if (dns_mailbox_init(&w -> dns) < 0 ||
+                cache_mailbox_init(&w -> tails) < 0 ||
+                (sweepfd = sweep_timer()) < 0) {
+            return -1;
+        }
+        atomic_init(&w -> connections, 0);
+        event_handler_init(&w -> listener, -1, listen_event, w);
+        event_handler_init(&w -> wake, wakefd, wake_event, w);
+        event_handler_init(&w -> dns_ev, w -> dns.fd, dns_event, w);
+        event_handler_init(&w -> tails_ev, w -> tails.fd, tails_event, w);
+        event_handler_init(&w -> sweep_ev, sweepfd, sweep_event, w);
+        if (engine == POOL_URING) {
+            if (uring_init(&w -> ring) < 0) {
+                return -1;
+            }
+            uring_op_init(&w -> wake_op, wake_done, w);
+            uring_op_init(&w -> accept_op, accept_done, w);
+            uring_op_init(&w -> dns_op, dns_done, w);
+            uring_op_init(&w -> tails_op, tails_done, w);
+            uring_op_init(&w -> sweep_op, sweep_done, w);
+            uring_prep_read(&w -> ring, &w -> wake_op, wakefd,
+                    &w -> wake_count, sizeof(w -> wake_count));
+            uring_prep_read(&w -> ring, &w -> dns_op, w -> dns.fd,
+                    &w -> dns_count, sizeof(w -> dns_count));
+            uring_prep_read(&w -> ring, &w -> tails_op, w -> tails.fd,
+                    &w -> tails_count, sizeof(w -> tails_count));
+            uring_prep_read(&w -> ring, &w -> sweep_op, sweepfd,
+                    &w -> sweep_count, sizeof(w -> sweep_count));
+            continue;
+        }
+        if (event_loop_init(&w -> loop) < 0 ||
+                event_add(&w -> loop, &w -> wake, EPOLLIN) < 0 ||
+                event_add(&w -> loop, &w -> dns_ev, EPOLLIN) < 0 ||
+                event_add(&w -> loop, &w -> tails_ev, EPOLLIN) < 0 ||
+                event_add(&w -> loop, &w -> sweep_ev, EPOLLIN) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * pool_start - spawn the worker threads. The workers own their loops
+ *      from here on, so pool_listen must come first.
+ *      Returns 0 on success, -1 on failure.
+ */
+int pool_start(void) {
+    int i, rc;
+
+    for (i = 0; i < worker_count; i++) {
+        Worker *w = &workers[i];
+        if ((rc = pthread_create(&w -> tid, NULL, worker_thread, w)) != 0) {
+            posix_error_non_exit(rc, "pthread_create error");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * pool_listen - let a worker accept on a non-blocking listenfd by itself,
+ *      or every worker if worker is POOL_ALL_WORKERS.
+ *      Returns 0 on success, -1 on failure.
+ */
+int pool_listen(int worker, int listenfd) {
+    int i;
+
+    for (i = 0; i < worker_count; i++) {
+        if (worker != POOL_ALL_WORKERS && worker != i) {
+            continue;
+        }
+        Worker *w = &workers[i];
+        event_handler_init(&w -> listener, listenfd, listen_event, w);
+        if (pool_engine == POOL_URING) {
+            /* with several multishot accepts on a shared listener,
+             * each connection still completes only one of them */
+            uring_prep_accept_multishot(&w -> ring, &w -> accept_op,
+                    listenfd);
+            continue;
+        }
+        if (event_add(&w -> loop, &w -> listener,
+                    EPOLLIN | EPOLLEXCLUSIVE) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * pool_join - wait for the workers, which never return
+ */
+void pool_join(void) {
+    int i;
+    for (i = 0; i < worker_count; i++) {
+        Pthread_join(workers[i].tid, NULL);
+    }
+}
+
+/*
+ * pool_dispatch - queue an accepted fd for the workers and wake one.
+ *      Returns 0 on success, -1 if the queue is full.
+ */
+int pool_dispatch(int fd) {
+    uint64_t one = 1;
+    unsigned int i;
+
+    if (queue_push(fd) < 0) {
+        return -1;
+    }
+    i = atomic_fetch_add_explicit(&next_worker, 1, memory_order_relaxed);
+    if (write(workers[i % worker_count].wake.fd, &one, sizeof(one)) < 0 &&
+            errno != EAGAIN) {
+        unix_error_non_exit("eventfd write error");
+    }
+    return 0;
+}
+
+/*
+ * pool_queue_depth - the number of fds waiting for a worker
+ */
+size_t pool_queue_depth(void) {
+    size_t tail = atomic_load_explicit(&queue.enqueue_pos,
+            memory_order_relaxed);
+    size_t head = atomic_load_explicit(&queue.dequeue_pos,
+            memory_order_relaxed);
+    /* the two loads race, never report a negative depth */
+    return tail > head ? tail - head : 0;
+}
+
+/*
+ * pool_stats - append the pool metrics
+ */
+void pool_stats(Buffer *b) {
+    int i;
+
+    buffer_printf(b, "pool_engine %s\n",
+            pool_engine == POOL_URING ? "io_uring" : "epoll");
+    buffer_printf(b, "pool_workers %d\n", worker_count);
+    buffer_printf(b, "pool_queue_capacity %d\n", POOL_QUEUE_SIZE);
+    buffer_printf(b, "pool_queue_depth %zu\n", pool_queue_depth());
+    for (i = 0; i < worker_count; i++) {
+        buffer_printf(b, "pool_worker_%d_connections %lu\n", i,
+                atomic_load_explicit(&workers[i].connections,
+                    memory_order_relaxed));
+    }
+    if (pool_engine == POOL_URING) {
+        unsigned long enters = 0, submitted = 0, completed = 0;
+        /* written by the workers alone, a stale sum is good enough */
+        for (i = 0; i < worker_count; i++) {
+            Uring *r = &workers[i].ring;
+            enters += __atomic_load_n(&r -> enters, __ATOMIC_RELAXED);
+            submitted += __atomic_load_n(&r -> submitted, __ATOMIC_RELAXED);
+            completed += __atomic_load_n(&r -> completed, __ATOMIC_RELAXED);
+        }
+        buffer_printf(b, "uring_enters %lu\n", enters);
+        buffer_printf(b, "uring_submitted %lu\n", submitted);
+        buffer_printf(b, "uring_completed %lu\n", completed);
+    }
+}
+
+/*
+ * worker_thread - the thread function of a worker
+ */
+static void *worker_thread(void *arg) {
+    Worker *w = (Worker *) arg;
+    dns_mailbox_bind(&w -> dns);
+    cache_mailbox_bind(&w -> tails);
+    if (pool_engine == POOL_URING) {
+        uring_run(&w -> ring);
+    }
+    else {
+        event_loop_run(&w -> loop);
+    }
+    return NULL;
+}
+
+/*
+ * wake_event - fds were queued, take as many as there are
+ */
+static void wake_event(EventHandler *h, uint32_t events) {
+    Worker *w = (Worker *) h -> data;
+    uint64_t count;
+
+    /* reset the eventfd before draining so no signal is lost */
+    if (read(h -> fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        unix_error_non_exit("eventfd read error");
+    }
+    drain_queue(w);
+}
+
+/*
+ * wake_done - the read of the wake eventfd completed, fds were queued
+ */
+static void wake_done(UringOp *op, int res, uint32_t flags) {
+    Worker *w = (Worker *) op -> data;
+
+    if (res < 0 && res != -EAGAIN) {
+        errno = -res;
+        unix_error_non_exit("eventfd read error");
+    }
+    /* re-arm before draining so no signal is lost */
+    uring_prep_read(&w -> ring, op, w -> wake.fd,
+            &w -> wake_count, sizeof(w -> wake_count));
+    drain_queue(w);
+}
+
+/*
+ * dns_event - the resolver threads answered lookups of this worker
+ */
+static void dns_event(EventHandler *h, uint32_t events) {
+    Worker *w = (Worker *) h -> data;
+    uint64_t count;
+
+    /* reset the eventfd before draining so no answer is lost */
+    if (read(h -> fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        unix_error_non_exit("eventfd read error");
+    }
+    dns_mailbox_drain(&w -> dns);
+}
+
+/*
+ * dns_done - the read of the mailbox eventfd completed, lookups of
+ *      this worker were answered
+ */
+static void dns_done(UringOp *op, int res, uint32_t flags) {
+    Worker *w = (Worker *) op -> data;
+
+    if (res < 0 && res != -EAGAIN) {
+        errno = -res;
+        unix_error_non_exit("eventfd read error");
+    }
+    /* re-arm before draining so no answer is lost */
+    uring_prep_read(&w -> ring, op, w -> dns.fd,
+            &w -> dns_count, sizeof(w -> dns_count));
+    dns_mailbox_drain(&w -> dns);
+}
+
+/*
+ * tails_event - more came for readers of cache fills of this worker
+ */
+static void tails_event(EventHandler *h, uint32_t events) {
+    Worker *w = (Worker *) h -> data;
+    uint64_t count;
+
+    /* reset the eventfd before draining so no wakeup is lost */
+    if (read(h -> fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        unix_error_non_exit("eventfd read error");
+    }
+    cache_mailbox_drain(&w -> tails);
+}
+
+/*
+ * tails_done - the read of the cache mailbox eventfd completed, more
+ *      came for readers of cache fills of this worker
+ */
+static void tails_done(UringOp *op, int res, uint32_t flags) {
+    Worker *w = (Worker *) op -> data;
+
+    if (res < 0 && res != -EAGAIN) {
+        errno = -res;
+        unix_error_non_exit("eventfd read error");
+    }
+    /* re-arm before draining so no wakeup is lost */
+    uring_prep_read(&w -> ring, op, w -> tails.fd,
+            &w -> tails_count, sizeof(w -> tails_count));
+    cache_mailbox_drain(&w -> tails);
+}
+
+/*
+ * sweep_event - the sweep timer went off, time out the connections
+ *      which missed their deadline
+ */
+static void sweep_event(EventHandler *h, uint32_t events) {
+    uint64_t count;
+
+    if (read(h -> fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        unix_error_non_exit("timerfd read error");
+    }
+    conn_expire();
+}
+
+/*
+ * sweep_done - the read of the sweep timerfd completed, time out the
+ *      connections which missed their deadline
+ */
+static void sweep_done(UringOp *op, int res, uint32_t flags) {
+    Worker *w = (Worker *) op -> data;
+
+    if (res < 0 && res != -EAGAIN) {
+        errno = -res;
+        unix_error_non_exit("timerfd read error");
+    }
+    uring_prep_read(&w -> ring, op, w -> sweep_ev.fd,
+            &w -> sweep_count, sizeof(w -> sweep_count));
+    conn_expire();
+}
+
+/*
+ * sweep_timer - create a timerfd going off every POOL_SWEEP_INTERVAL
+ *      seconds.
+ *      Returns the fd, -1 on failure.
+ */
+static int sweep_timer(void) {
+    struct itimerspec spec;
+    int fd;
+
+    if ((fd = timerfd_create(CLOCK_MONOTONIC,
+                    TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        unix_error_non_exit("timerfd_create error");
+        return -1;
+    }
+    memset(&spec, 0, sizeof(spec));
+    spec.it_interval.tv_sec = POOL_SWEEP_INTERVAL;
+    spec.it_value.tv_sec = POOL_SWEEP_INTERVAL;
+    if (timerfd_settime(fd, 0, &spec, NULL) < 0) {
+        unix_error_non_exit("timerfd_settime error");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * drain_queue - take as many queued fds as there are
+ */
+static void drain_queue(Worker *w) {
+    int fd;
+
+    while (queue_pop(&fd) == 0) {
+        worker_accept(w, fd);
+    }
+}
+
+/*
+ * listen_event - connections are pending on the worker's listener,
+ *      accept a batch of them
+ */
+static void listen_event(EventHandler *h, uint32_t events) {
+    Worker *w = (Worker *) h -> data;
+    int i, connfd;
+
+    /* bounded, so a flood of connections cannot starve the others */
+    for (i = 0; i < POOL_ACCEPT_BATCH; i++) {
+        if ((connfd = accept_client(h -> fd)) < 0) {
+            return;
+        }
+        worker_accept(w, connfd);
+    }
+}
+
+/*
+ * accept_done - the multishot accept on the worker's listener
+ *      completed with a connection or an error
+ */
+static void accept_done(UringOp *op, int res, uint32_t flags) {
+    Worker *w = (Worker *) op -> data;
+
+    if (res >= 0) {
+        worker_accept(w, res);
+    }
+    else if (res != -EAGAIN && res != -ECONNABORTED) {
+        errno = -res;
+        unix_error_non_exit("accept error");
+    }
+    if (!(flags & IORING_CQE_F_MORE)) {
+        /* the kernel stopped the multishot, start it over */
+        uring_prep_accept_multishot(&w -> ring, op, w -> listener.fd);
+    }
+}
+
+/*
+ * worker_accept - start serving a connection on this worker
+ */
+static void worker_accept(Worker *w, int fd) {
+    atomic_fetch_add_explicit(&w -> connections, 1, memory_order_relaxed);
+    if (pool_engine == POOL_URING) {
+        conn_uring_start(&w -> ring, fd);
+    }
+    else {
+        conn_epoll_start(&w -> loop, fd);
+    }
+}
+
+/*
+ * queue_push - put fd into the queue.
+ *      Returns 0 on success, -1 if the queue is full.
+ */
+static int queue_push(int fd) {
+    PoolCell *cell;
+    size_t pos = atomic_load_explicit(&queue.enqueue_pos,
+            memory_order_relaxed);
+
+    while (1) {
+        cell = &queue.cells[pos & (POOL_QUEUE_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&cell -> seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+        if (diff == 0) {
+            /* the slot is free for this ticket, try to claim it */
+            if (atomic_compare_exchange_weak_explicit(&queue.enqueue_pos,
+                        &pos, pos + 1,
+                        memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            /* the slot still holds an fd from the last lap: full */
+            return -1;
+        }
+        else {
+            /* another producer took this ticket */
+            pos = atomic_load_explicit(&queue.enqueue_pos,
+                    memory_order_relaxed);
+        }
+    }
+    cell -> fd = fd;
+    /* publish the fd to the consumer of this ticket */
+    atomic_store_explicit(&cell -> seq, pos + 1, memory_order_release);
+    return 0;
+}
+
+/*
+ * queue_pop - take the oldest fd out of the queue.
+ *      Returns 0 on success, -1 if the queue is empty.
+ */
+static int queue_pop(int *fd) {
+    PoolCell *cell;
+    size_t pos = atomic_load_explicit(&queue.dequeue_pos,
+            memory_order_relaxed);
+
+    while (1) {
+        cell = &queue.cells[pos & (POOL_QUEUE_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&cell -> seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+        if (diff == 0) {
+            /* the slot is filled for this ticket, try to claim it */
+            if (atomic_compare_exchange_weak_explicit(&queue.dequeue_pos,
+                        &pos, pos + 1,
+                        memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (diff < 0) {
+            /* nothing published here yet: empty */
+            return -1;
+        }
+        else {
+            /* another consumer took this ticket */
+            pos = atomic_load_explicit(&queue.dequeue_pos,
+                    memory_order_relaxed);
+        }
+    }
+    *fd = cell -> fd;
+    /* hand the slot back to the producer one lap later */
+    atomic_store_explicit(&cell -> seq, pos + POOL_QUEUE_SIZE,
+            memory_order_release);
+    return 0;
+}
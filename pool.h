@@ -0,0 +1,78 @@
+/*
+ * pool.h - declarations for the worker pool
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ */
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include "buffer.h"
+#include "cache.h"
+#include "dns.h"
+#include "event.h"
+#include "uring.h"
+
+#define POOL_QUEUE_SIZE 4096    /* hand-off queue slots, a power of 2 */
+#define POOL_MAX_WORKERS 256    /* upper bound on the worker count */
+#define POOL_ACCEPT_BATCH 64    /* max accepts per listener wakeup */
+#define POOL_ALL_WORKERS -1     /* pool_listen: share with every worker */
+#define POOL_SWEEP_INTERVAL 1   /* seconds between deadline sweeps */
+
+/* the I/O engines a pool can run its workers on */
+typedef enum {
+    POOL_EPOLL,             /* readiness through epoll, see conn_epoll.c */
+    POOL_URING,             /* completions through io_uring, see
+                               conn_uring.c */
+} PoolEngine;
+
+/* a slot of the hand-off queue */
+typedef struct pool_cell_type {
+    atomic_size_t seq;      /* the ticket this slot is ready for */
+    int fd;                 /* the accepted descriptor */
+} PoolCell;
+
+/* a bounded lock-free multi-producer multi-consumer queue of fds */
+typedef struct pool_queue_type {
+    PoolCell cells[POOL_QUEUE_SIZE];
+    /* keep the two tickets on separate cache lines */
+    _Alignas(64) atomic_size_t enqueue_pos;
+    _Alignas(64) atomic_size_t dequeue_pos;
+} PoolQueue;
+
+/* a worker thread running its own event loop or ring */
+typedef struct worker_type {
+    pthread_t tid;          /* the worker thread */
+    EventLoop loop;         /* the loop serving this worker's connections */
+    EventHandler wake;      /* eventfd signalled when fds are queued */
+    EventHandler listener;  /* the listener this worker accepts on */
+    Uring ring;             /* the ring serving this worker's connections */
+    UringOp wake_op;        /* the read of the wake eventfd */
+    UringOp accept_op;      /* the multishot accept on the listener */
+    uint64_t wake_count;    /* the value read from the wake eventfd */
+    DnsMailbox dns;         /* lookups answered by the resolver threads */
+    EventHandler dns_ev;    /* the mailbox eventfd registration */
+    UringOp dns_op;         /* the read of the mailbox eventfd */
+    uint64_t dns_count;     /* the value read from the mailbox eventfd */
+    CacheMailbox tails;     /* readers of cache fills more came for */
+    EventHandler tails_ev;  /* its eventfd registration */
+    UringOp tails_op;       /* the read of its eventfd */
+    uint64_t tails_count;   /* the value read from its eventfd */
+    EventHandler sweep_ev;  /* timerfd of the deadline sweeps */
+    UringOp sweep_op;       /* the read of the timerfd */
+    uint64_t sweep_count;   /* the value read from the timerfd */
+    atomic_ulong connections; /* connections served by this worker */
+} Worker;
+
+int pool_default_size(void);
+int pool_init(int nworkers, PoolEngine engine);
+int pool_listen(int worker, int listenfd);
+int pool_start(void);
+void pool_join(void);
+int pool_dispatch(int fd);
+size_t pool_queue_depth(void);
+void pool_stats(Buffer *b);
+
+#endif /* __POOL_H__ */
@@ -0,0 +1,266 @@
+/*
+ * pressure.c - the memory pressure monitor
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * The proxy runs in containers with memory limits, where a cache filling
+ * its whole budget while the connections buffer a lot gets the process
+ * killed. So a thread samples the memory of the proxy's cgroup every
+ * PRESSURE_INTERVAL seconds: memory.current against the lower of
+ * memory.high and memory.max with cgroup v2, memory.usage_in_bytes
+ * against memory.limit_in_bytes with v1, and the share of time tasks
+ * stalled on memory (PSI), if the kernel reports it.
+ *
+ * Past PRESSURE_HIGH percent of the limit, or PRESSURE_PSI_HIGH percent
+ * of the time stalled, the budget of the cache is cut by a quarter, or
+ * by the excess if that is more, and the reclaimer brings the cache down
+ * to it (see cache_pressure). Once the cgroup is back under PRESSURE_LOW
+ * percent and the stalls are rare, the budget grows back by steps of
+ * 1/PRESSURE_GROW of the configured one: it is cut fast and given back
+ * slowly, so it settles rather than swings.
+ *
+ * The cgroup is the proxy's own (see cgroup.c), looked for under
+ * CGROUP_ROOT, or at the root of the hierarchy, which is where it is in
+ * a container with a cgroup namespace of its own. Another directory may
+ * be given instead. With no cgroup files only the stalls are watched,
+ * and with no PSI either the budget stays as configured.
+ */
+#include "csapp.h"
+#include "cache.h"
+#include "cgroup.h"
+#include "pressure.h"
+#include "proxylib.h"
+
+#define PSI_MEMORY "/proc/pressure/memory"  /* the stalls of the system */
+#define CGROUP_V1_UNLIMITED (1ULL << 62)    /* v1 tells no limit by a
+                                               huge one */
+
+static char dir[MAXLINE];           /* the cgroup directory */
+static int version = 0;             /* of its files, 0 if there are none */
+static char psi_path[MAXLINE];      /* the PSI file, "" if there is none */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* guarded by lock */
+static PressureSample last;         /* the last sample */
+static unsigned long shrinks = 0;   /* cuts of the cache budget */
+static unsigned long grows = 0;     /* steps of it back up */
+
+/* function declarations */
+static void *pressure_thread(void *arg);
+static int pressure_sample(PressureSample *s);
+static void cgroup_find(void);
+static int cgroup_probe(const char *path);
+static int read_bytes(const char *name, size_t *bytes);
+static int read_stall(double *stall);
+
+/*
+ * pressure_init - start watching the memory of the cgroup directory
+ *      cgroup, or of the proxy's own if it is NULL.
+ *      Returns 0 on success, -1 on failure.
+ */
+int pressure_init(const char *cgroup) {
+    pthread_t tid;
+    int rc;
+
+    if (cgroup && (version = cgroup_probe(cgroup)) == 0) {
+        fprintf(stderr, "no cgroup memory files in %s\n", cgroup);
+        return -1;
+    }
+    if (cgroup == NULL) {
+        cgroup_find();
+    }
+    /* the stalls of the cgroup, or else of the whole system */
+    snprintf(psi_path, MAXLINE, "%.*s/memory.pressure", MAXLINE / 2, dir);
+    if (version != 2 || access(psi_path, R_OK) < 0) {
+        snprintf(psi_path, MAXLINE, "%s",
+                access(PSI_MEMORY, R_OK) == 0 ? PSI_MEMORY : "");
+    }
+    if (version == 0 && psi_path[0] == '\0') {
+        printf("No cgroup memory files or PSI, the cache keeps its budget\n");
+        return 0;
+    }
+    if ((rc = pthread_create(&tid, NULL, pressure_thread, NULL)) != 0) {
+        posix_error_non_exit(rc, "pthread_create error");
+        return -1;
+    }
+    pthread_detach(tid);
+    return 0;
+}
+
+/*
+ * pressure_stats - append the memory pressure metrics
+ */
+void pressure_stats(Buffer *b) {
+    pthread_mutex_lock(&lock);
+    buffer_printf(b, "memory_cgroup %s\n", version ? dir : "none");
+    buffer_printf(b, "memory_cgroup_version %d\n", version);
+    buffer_printf(b, "memory_current %zu\n", last.current);
+    buffer_printf(b, "memory_limit %zu\n", last.limit);
+    buffer_printf(b, "memory_stall_avg10 %.2f\n", last.stall);
+    buffer_printf(b, "memory_pressure_shrinks %lu\n", shrinks);
+    buffer_printf(b, "memory_pressure_grows %lu\n", grows);
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * pressure_thread - sample the memory, and cut the budget of the cache
+ *      or give it back as the pressure goes, for as long as the process
+ *      runs
+ */
+static void *pressure_thread(void *arg) {
+    PressureSample s;
+    size_t effective, total, mark, over, cut, now;
+
+    while (1) {
+        sleep(PRESSURE_INTERVAL);
+        if (pressure_sample(&s) < 0) {
+            continue;
+        }
+        effective = cache_effective_capacity();
+        total = cache_capacity();
+        now = effective;
+        mark = s.limit / 100 * PRESSURE_HIGH;
+        over = s.limit && s.current > mark ? s.current - mark : 0;
+        if (over || s.stall >= PRESSURE_PSI_HIGH) {
+            cut = effective / PRESSURE_SHRINK;
+            if (over > cut) {
+                cut = over;
+            }
+            now = cache_pressure(cut < effective ? effective - cut : 0);
+        }
+        else if (effective < total && s.stall < PRESSURE_PSI_LOW &&
+                (!s.limit || s.current < s.limit / 100 * PRESSURE_LOW)) {
+            now = cache_pressure(effective + total / PRESSURE_GROW);
+        }
+        if (now != effective) {
+            printf("Cache budget %s to %zu bytes, memory at %zu of %zu\n",
+                    now < effective ? "cut" : "back up", now, s.current,
+                    s.limit);
+        }
+        pthread_mutex_lock(&lock);
+        last = s;
+        shrinks += now < effective;
+        grows += now > effective;
+        pthread_mutex_unlock(&lock);
+    }
+    return NULL;
+}
+
+/*
+ * pressure_sample - read the memory use and limit of the cgroup and the
+ *      stalls into s.
+ *      Returns 0 on success, -1 if the files could not be read.
+ */
+static int pressure_sample(PressureSample *s) {
+    size_t high = SIZE_MAX, max = SIZE_MAX;
+
+    s -> current = 0;
+    s -> stall = 0.0;
+    if (version == 2 && (read_bytes("memory.current", &s -> current) < 0 ||
+                read_bytes("memory.high", &high) < 0 ||
+                read_bytes("memory.max", &max) < 0)) {
+        return -1;
+    }
+    if (version == 1 &&
+            (read_bytes("memory.usage_in_bytes", &s -> current) < 0 ||
+             read_bytes("memory.limit_in_bytes", &max) < 0)) {
+        return -1;
+    }
+    if (high < max) {
+        max = high;
+    }
+    s -> limit = max == SIZE_MAX ? 0 : max;
+    if (psi_path[0] && read_stall(&s -> stall) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * cgroup_find - find the memory files of the proxy's own cgroup, the
+ *      unified hierarchy first
+ */
+static void cgroup_find(void) {
+    char path[MAXLINE], v1[MAXLINE], v2[MAXLINE];
+
+    if (cgroup_self("memory", v1, v2) < 0) {
+        return;
+    }
+    snprintf(path, MAXLINE, "%s%.*s", CGROUP_ROOT, MAXLINE / 2, v2);
+    if (v2[0] && ((version = cgroup_probe(path)) == 2 ||
+                (version = cgroup_probe(CGROUP_ROOT)) == 2)) {
+        return;
+    }
+    snprintf(path, MAXLINE, "%s/memory%.*s", CGROUP_ROOT, MAXLINE / 2, v1);
+    if (v1[0] && ((version = cgroup_probe(path)) == 1 ||
+                (version = cgroup_probe(CGROUP_ROOT "/memory")) == 1)) {
+        return;
+    }
+    version = 0;
+}
+
+/*
+ * cgroup_probe - use the cgroup directory path if it has memory files.
+ *      Returns the cgroup version of them, 0 if there are none.
+ */
+static int cgroup_probe(const char *path) {
+    char file[MAXLINE];
+
+    snprintf(dir, MAXLINE, "%s", path);
+    snprintf(file, MAXLINE, "%s/memory.current", path);
+    if (access(file, R_OK) == 0) {
+        return 2;
+    }
+    snprintf(file, MAXLINE, "%s/memory.usage_in_bytes", path);
+    if (access(file, R_OK) == 0) {
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * read_bytes - read the byte count in the cgroup file name into bytes,
+ *      SIZE_MAX for no limit.
+ *      Returns 0 on success, -1 on failure.
+ */
+static int read_bytes(const char *name, size_t *bytes) {
+    char path[MAXLINE], value[64];
+    unsigned long long n;
+    FILE *f;
+    int rc;
+
+    snprintf(path, MAXLINE, "%.*s/%s", MAXLINE / 2, dir, name);
+    if ((f = fopen(path, "r")) == NULL) {
+        return -1;
+    }
+    rc = fscanf(f, "%63s", value);
+    fclose(f);
+    if (rc != 1) {
+        return -1;
+    }
+    if (!strcmp(value, "max")) {
+        *bytes = SIZE_MAX;
+        return 0;
+    }
+    n = strtoull(value, NULL, 10);
+    *bytes = n >= CGROUP_V1_UNLIMITED ? SIZE_MAX : n;
+    return 0;
+}
+
+/*
+ * read_stall - read the percent of the last 10 seconds some task stalled
+ *      on memory into stall.
+ *      Returns 0 on success, -1 on failure.
+ */
+static int read_stall(double *stall) {
+    FILE *f;
+    int rc;
+
+    if ((f = fopen(psi_path, "r")) == NULL) {
+        return -1;
+    }
+    rc = fscanf(f, "some avg10=%lf", stall);
+    fclose(f);
+    return rc == 1 ? 0 : -1;
+}
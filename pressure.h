@@ -0,0 +1,37 @@
+/*
+ * pressure.h - declarations for the memory pressure monitor
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ */
+#ifndef __PRESSURE_H__
+#define __PRESSURE_H__
+
+#include <stddef.h>
+#include "buffer.h"
+
+#define PRESSURE_INTERVAL 1         /* seconds between two samples */
+#define PRESSURE_HIGH 90            /* percent of the limit shrinking the
+                                       cache */
+#define PRESSURE_LOW 80             /* percent of the limit under which it
+                                       grows back */
+#define PRESSURE_PSI_HIGH 10.0      /* percent of time stalled on memory
+                                       shrinking the cache */
+#define PRESSURE_PSI_LOW 1.0        /* and under which it grows back */
+#define PRESSURE_SHRINK 4           /* a shrink takes 1/4 of the budget */
+#define PRESSURE_GROW 16            /* a step back up adds 1/16 of the
+                                       configured budget */
+
+/* the memory use of the cgroup, as last sampled */
+typedef struct pressure_sample_type {
+    size_t current;                 /* bytes the cgroup uses */
+    size_t limit;                   /* bytes it is to stay under, 0 if
+                                       none */
+    double stall;                   /* percent of the last 10 seconds
+                                       some task stalled on memory */
+} PressureSample;
+
+int pressure_init(const char *cgroup);
+void pressure_stats(Buffer *b);
+
+#endif /* __PRESSURE_H__ */
@@ -5,45 +5,33 @@
  * Andrew ID: txin
  * 
  * This implementation of proxy utilizes Linux network socket
- * interfaces for network connections, Robust I/O library for
- * file I/O, pthread library for concurrency and semaphores
- * for threads synchronization.
+ * interfaces for network connections, a pool of worker threads each
+ * running an epoll event loop over non-blocking descriptors, or an
+ * io_uring completion loop with -e uring, for concurrency (see pool.c,
+ * event.c, uring.c and conn.c) and semaphores for the synchronization
+ * of the cache.
  */
 
+#define ACCEPT_BACKOFF_US 1000  /* wait before retrying a full queue */
+
+#include <ctype.h>
 #include <stdio.h>
 #include "csapp.h"
 #include "cache.h"
+#include "conn.h"
+#include "dns.h"
+#include "event.h"
+#include "pool.h"
+#include "pressure.h"
+#include "slab.h"
+#include "upstream.h"
 #include "proxylib.h"
 
-#define HTTP_PROTOCOL "http://"
-#define HTTP_PROTOCOL_LEN 7
-#define PORT_NUM_MIN 0
-#define PORT_NUM_MAX 65535
-#define DEFAULT_HTTP_PORT_STR "80"
-
-/* You won't lose style points for including this long line in your code */
-static const char *user_agent_hdr = "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:10.0.3) Gecko/20120305 Firefox/10.0.3\r\n";
-/* Connection header value */
-static const char *connection_hdr = "Connection: close\r\n";
-/* Proxy-connection header value */
-static const char *proxy_connection_hdr = "Proxy-Connection: close\r\n";
-
-/* the request information in proxy */
-typedef struct proxy_info_type {
-    int fd;                 /* the connection file descriptor */
-    char *hostname;         /* the requested host name */
-    char *port;             /* the requested port */
-    char *uri;              /* the requested resource URI */
-    rio_t *p_server_rio;    /* RIO wrapper of the client connection */
-} ProxyInfo;
-
 /* function declarations */
 
-/* proxy core functions */
-void serve_proxy(ProxyInfo *proxy_info);
-void parse_uri(char *request_uri, char *hostname, char *port, char *uri);
-void doit(int fd);
-void *handle_request_thread(void *p_fd);
+/* accept loops */
+int serve_reuseport(char *port, int nworkers);
+void accept_loop(int listenfd);
 
 /* signal handler */
 void sigpipe_handler(int sig);
@@ -54,358 +42,262 @@ void sigpipe_handler(int sig);
 int
 main(int argc, char **argv) {
     int listenfd;
-    int *connfdp;
-    char hostname[MAXLINE], port[MAXLINE];
-    int rc;
-    socklen_t clientlen;
-    struct sockaddr_storage clientaddr;
-
-    init_cache();
-    pthread_t tid;
+    int opt;
+    int nworkers = pool_default_size();
+    int reuseport = 0;
+    int nshards = CACHE_DEFAULT_SHARDS;
+    size_t cache_size = MAX_CACHE_SIZE;
+    size_t object_size = MAX_OBJECT_SIZE;
+    char *cgroup = NULL;
+    CachePolicy *policy = &lru_policy;
+    int admit = 0;
+    PoolEngine engine = POOL_EPOLL;
 
     /* Check command line args */
-    if (argc != 2) {
-        fprintf(stderr, "usage: %s <port>\n", argv[0]);
+    while ((opt = getopt(argc, argv, "a:c:e:g:o:p:rs:w:")) != -1) {
+        switch (opt) {
+        case 'a':
+            if (!strcmp(optarg, "tinylfu")) {
+                admit = 1;
+            }
+            else if (!strcmp(optarg, "none")) {
+                admit = 0;
+            }
+            else {
+                fprintf(stderr, "unknown admission %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'c':
+            if (parse_size(optarg, &cache_size) < 0) {
+                fprintf(stderr, "bad cache size %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'e':
+            if (!strcmp(optarg, "epoll")) {
+                engine = POOL_EPOLL;
+            }
+            else if (!strcmp(optarg, "uring")) {
+                engine = POOL_URING;
+            }
+            else {
+                fprintf(stderr, "unknown engine %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'g':
+            cgroup = optarg;
+            break;
+        case 'o':
+            if (parse_size(optarg, &object_size) < 0) {
+                fprintf(stderr, "bad object size %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'p':
+            if ((policy = cache_find_policy(optarg)) == NULL) {
+                fprintf(stderr, "unknown cache policy %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'r':
+            reuseport = 1;
+            break;
+        case 's':
+            nshards = atoi(optarg);
+            break;
+        case 'w':
+            nworkers = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-a tinylfu|none] [-c cache_size] "
+                    "[-e epoll|uring] [-g cgroup_dir] [-o object_size] "
+                    "[-p lru|clock|s3fifo|arc|gdsf] [-r] [-s shards] "
+                    "[-w workers] <port>\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-a tinylfu|none] [-c cache_size] "
+                "[-e epoll|uring] [-g cgroup_dir] [-o object_size] "
+                "[-p lru|clock|s3fifo|arc|gdsf] [-r] [-s shards] "
+                "[-w workers] <port>\n", argv[0]);
         exit(1);
     }
 
     /* Install the SIGPIPE signal handler */
     Signal(SIGPIPE,  sigpipe_handler);
 
-    /* if listenfd cannot be opened on specified port, quit the proxy */
-    if ((listenfd = open_listenfd(argv[1])) < 0) {
-        fprintf(stderr, "Could not bind to port %s", argv[1]);
-        exit(-1);
+    if (init_cache(nshards, cache_size, object_size, policy, admit) < 0 ||
+            pressure_init(cgroup) < 0 || dns_init() < 0 ||
+            pool_init(nworkers, engine) < 0) {
+        exit(1);
     }
-
-    /* the main loop */
-    while (1) {
-	    clientlen = sizeof(clientaddr);
-        /* get size of client addr */
-        if ((connfdp = (int *) malloc(sizeof(int))) == NULL) {
-            /* Try next iteration */
-            unix_error_non_exit("malloc error");
-            continue;
+    printf("Serving with %d %s workers\n", nworkers,
+            engine == POOL_URING ? "io_uring" : "epoll");
+
+    if (reuseport) {
+        /* every worker accepts on a listener of its own */
+        if (serve_reuseport(argv[optind], nworkers) < 0) {
+            fprintf(stderr, "Could not bind to port %s", argv[optind]);
+            exit(-1);
         }
-
-        if ((*connfdp = accept(listenfd, (SA *)&clientaddr, &clientlen))
-                < 0) {
-            /* Try next connection */
-            unix_error_non_exit("accept error");
-            continue;
-        }
-
-        if ((rc = getnameinfo((SA *) &clientaddr, clientlen, hostname, MAXLINE,
-                    port, MAXLINE, 0)) != 0) {
-            gai_error_non_exit(rc, "getnameinfo error");
-            /* If close connection fd failure again, exit */
-            if (close(*connfdp) < 0)  {
-                fprintf(stderr, "close failure\n");
-            }
-            free(connfdp);
-            continue;
-        }
-        printf("Accepted from %s:%s\n", hostname, port);
-
-        if ((rc = pthread_create(
-                        &tid, NULL, handle_request_thread, connfdp)) != 0) {
-	        posix_error_non_exit(rc, "pthread_create error");
-            /* If close connection fd failure again, exit */
-            if (close(*connfdp) < 0) {
-                fprintf(stderr, "close failure\n");
-            }
-            free(connfdp);
+        if (pool_start() < 0) {
+            exit(1);
         }
+        pool_join();
+        return 0;
     }
-    return 0;
-}
-
-/* serve_proxy - serve requested content as a proxy */
-void serve_proxy(ProxyInfo *proxy_info) {
-    rio_t rio;                  /* the rio as a client */
-    int clientfd;               /* client descriptor */
-    char buf[MAXLINE];          /* a buffer for reading and writing */
-    char key_val_buf[MAXLINE];  /* a buffer to extract keys and values
-                                   from request headers */
-
-    /* take variables from struct */
-    int fd = proxy_info -> fd;
-    char *hostname = proxy_info -> hostname;
-    char *port = proxy_info -> port;
-    char *uri = proxy_info -> uri;
-    rio_t *p_server_rio = proxy_info -> p_server_rio;
-
-    char *cache_absolute_uri;
-    if ((cache_absolute_uri = (char *) malloc(MAXLINE)) == NULL) {
-        /* if malloc failure, ignore this request, keep calm and carry on */
-        internal_server_error(fd);
-        return;
-    }
-    /* construct the cache_absolute_uri */
-    snprintf(cache_absolute_uri, MAXLINE, "%s:%s%s", hostname, port, uri);
-
-    CacheNode *cache_node;
-
-    if ((cache_node = get_cache(cache_absolute_uri)) != NULL) {
-        /* cache hit, return the result directly */
-        proxy_rio_writen(fd, cache_node -> content, cache_node -> size);
-        return;
+    if (pool_start() < 0) {
+        exit(1);
     }
 
-    /* Try to open cilentfd and connect to requested web server */
-    if ((clientfd = open_clientfd(hostname, port)) < 0) {
-        internal_server_error(fd);
-        return;
+    /* if listenfd cannot be opened on specified port, quit the proxy */
+    if ((listenfd = open_listenfd(argv[optind])) < 0) {
+        fprintf(stderr, "Could not bind to port %s", argv[optind]);
+        exit(-1);
     }
 
-    Rio_readinitb(&rio, clientfd);
-
-    /* trasmit first line of request */
-    snprintf(buf, MAXLINE, "GET %s HTTP/1.0\r\n", uri);
-    
-    proxy_rio_writen(clientfd, buf, strlen(buf));
-
-    /* read request headers */
-    int host_set = 0;
-    while(strcmp(buf, "\r\n")) {
-	    proxy_rio_readlineb(p_server_rio, buf, MAXLINE);
-        strncpy(key_val_buf, buf, MAXLINE);
-        char *p_split;
-        if ((p_split = strstr(key_val_buf, ":")) != NULL) {
-            *p_split = '\0';
-            char *keybuf = key_val_buf;
+    /* the main loop */
+    accept_loop(listenfd);
+    return 0;
+}
 
-            if (!strcasecmp("Host", keybuf)) {
-                host_set = 1;
-            }
-            if (!strcasecmp("User-Agent", keybuf)) {
-                /* ignore user-agent header */
-                continue;
-            }
-            if (!strcasecmp("Connection", keybuf)) {
-                /* ignore connection header */
-                continue;
-            }
-            if (!strcasecmp("Proxy-Connection", keybuf)) {
-                /* ignore proxy-connection header */
-                continue;
-            }
-        }
-        if (strcmp(buf, "\r\n")) {
-            proxy_rio_writen(clientfd, buf, strlen(buf));
-        }
-    }
-    /* write host-header */
-    if (!host_set) {
-        snprintf(buf, MAXLINE, "Host: %s", hostname);
-        proxy_rio_writen(clientfd, buf, strlen(buf));
-    }
-    /* write user-agent header */
-    proxy_rio_writen(clientfd, (char *) user_agent_hdr, strlen(user_agent_hdr));
-    /* write connection header */
-    proxy_rio_writen(clientfd, (char *) connection_hdr, strlen(connection_hdr));
-    /* write proxy-connection header */
-    proxy_rio_writen(clientfd, 
-            (char *) proxy_connection_hdr, strlen(proxy_connection_hdr));
-    proxy_rio_writen(clientfd, "\r\n", 2);
+/*
+ * serve_reuseport - open one SO_REUSEPORT listener per worker and let
+ *      the workers accept by themselves. If the kernel lacks
+ *      SO_REUSEPORT, the workers share a single listener instead.
+ *      Returns 0 on success, -1 on failure.
+ */
+int serve_reuseport(char *port, int nworkers) {
+    int i, listenfd;
 
-    char *cache_content;
-    if ((cache_content = (char *) malloc(MAX_OBJECT_SIZE)) == NULL) {
-        /* if malloc failure, ignore this request and carry on */
-        internal_server_error(fd);
-        if (close(clientfd) < 0) {
-            fprintf(stderr, "close failure\n");
-        }
-        return;
-    }
-    char *cachep = cache_content;       /* memcpy pointer */
-    size_t s = 0;                       /* read size */
-    size_t cache_object_size = 0;       /* object size */
-    while ((s = proxy_rio_readnb(&rio, buf, MAXLINE)) && s != -1) {
-        if (proxy_rio_writen(fd, buf, s) == -1) {
+    for (i = 0; i < nworkers; i++) {
+        if ((listenfd = open_reuseport_listenfd(port)) < 0) {
             break;
         }
-        cache_object_size += s;
-        if (cache_object_size <= MAX_OBJECT_SIZE) {
-            memcpy(cachep, buf, s);
-            cachep += s;
+        if (pool_listen(i, listenfd) < 0) {
+            return -1;
         }
     }
-    if (cache_object_size <= MAX_OBJECT_SIZE) {
-        /* put cache object into cache only if its size is small enough */
-        put_cache(cache_absolute_uri, cache_content, cache_object_size);
+    if (i == nworkers) {
+        return 0;
+    }
+    if (i > 0) {
+        /* some listeners are bound already, the port is ours */
+        unix_error_non_exit("open_reuseport_listenfd error");
+        return -1;
     }
-    if (close(clientfd) < 0) {
-        fprintf(stderr, "close failure\n");
+
+    unix_error_non_exit("SO_REUSEPORT unavailable, sharing one listener");
+    if ((listenfd = open_listenfd(port)) < 0 ||
+            set_nonblocking(listenfd) < 0) {
+        return -1;
     }
+    return pool_listen(POOL_ALL_WORKERS, listenfd);
 }
 
 /*
- * parse_uri - parse the request uri into hostname, port and the relative uri
+ * accept_loop - accept connections forever and hand them to the workers
  */
-void parse_uri(char *request_uri, char *hostname, char *port, char *uri) {
-    char *p;
-    /* Parse hostname */
-    strncpy(hostname, request_uri, MAXLINE);
-    if (strstr(hostname, HTTP_PROTOCOL)) {
-        /* truncate leading "http://" */
-        strncpy(hostname, hostname + HTTP_PROTOCOL_LEN, MAXLINE);
-    }
-    if ((p = strstr(hostname, ":")) != NULL) {
-        /* truncate port */
-        *p = '\0';
-    }
-    if ((p = strstr(hostname, "/")) != NULL) {
-        /* truncate uri after '/' */
-        *p = '\0';
-    }
+void accept_loop(int listenfd) {
+    int connfd;
 
-    /* Parse port number */
-    strncpy(port, request_uri, MAXLINE);
-    if (strstr(port, HTTP_PROTOCOL)) {
-        /* truncate leading "http://" */
-        strncpy(port, port + HTTP_PROTOCOL_LEN, MAXLINE);
-    }
-    if ((p = strstr(port, "/")) != NULL) {
-        /* truncate uri after '/' */
-        *p = '\0';
-    }
-
-    if ((p = strstr(port, ":")) != NULL) {
-        /* truncate port */
-        strncpy(port, p + 1, MAXLINE);
-        /* convert string port number to int, truncating illegal chars */
-        int port_num = atoi(port);
-        if (port_num < PORT_NUM_MIN || port_num > PORT_NUM_MAX) {
-            strncpy(port, DEFAULT_HTTP_PORT_STR, MAXLINE);
+    while (1) {
+        if ((connfd = accept_client(listenfd)) < 0) {
+            /* Try next connection */
+            continue;
+        }
+        /* the workers are saturated, let the backlog absorb the burst */
+        while (pool_dispatch(connfd) < 0) {
+            usleep(ACCEPT_BACKOFF_US);
         }
-    }
-    else {
-        /* If there is no port found, specify port num as 80 */
-        strncpy(port, DEFAULT_HTTP_PORT_STR, MAXLINE);
-    }
-
-    /* Parse uri */
-    strncpy(uri, request_uri, MAXLINE);
-    if (strstr(uri, HTTP_PROTOCOL)) {
-        /* truncate leading "http://" */
-        strncpy(uri, uri + HTTP_PROTOCOL_LEN, MAXLINE);
-    }
-    if ((p = strstr(uri, "/")) != NULL) {
-        /* get uri after '/' */
-        uri = strncpy(uri, p, MAXLINE);
-    }
-    else {
-        /* if no uri is set in the request, set the uri as "/" (the root) */
-        strncpy(uri, "/", MAXLINE);
     }
 }
 
 /*
- * doit - handle an HTTP GET request in the proxy 
+ * accept_client - accept a connection on listenfd and log the peer.
+ *      Returns the connected fd, or -1 if none was accepted. On a
+ *      non-blocking listenfd errno is then EAGAIN if none is pending.
  */
-void doit(int fd) {
-    char buf[MAXLINE];          /* the buffer for reading and writing */
-    char method[MAXLINE];       /* the request method */
-    char request_uri[MAXLINE];  /* the request uri */
-    char version[MAXLINE];      /* the request http version */
-
-    char hostname[MAXLINE];     /* the requested server hostname */
-    char port[MAXLINE];         /* the requested server port */
-    char uri[MAXLINE];          /* the requested resource uri */
-    rio_t server_rio;           /* the rio object for the request client */
-
-    Rio_readinitb(&server_rio, fd);
-    /* read the first line of request and parse it */
-    if (!proxy_rio_readlineb(&server_rio, buf, MAXLINE))
-        return;
+int accept_client(int listenfd) {
+    int connfd;
+    char hostname[MAXLINE], port[MAXLINE];
+    int rc;
+    socklen_t clientlen;
+    struct sockaddr_storage clientaddr;
 
-    printf("%s", buf);
-    sscanf(buf, "%s %s %s", method, request_uri, version);
-    /* check if is GET method */
-    if (strcasecmp(method, "GET")) {
-        clienterror(fd, method, "501", "Not Implemented",
-                    "This proxy does not implement this method");
-        printf("Rejected method %s\n", method);
-        return;
-    }
-    /* check if the protocol is http */
-    if (strstr(request_uri, HTTP_PROTOCOL) != request_uri) {
-        clienterror(fd, request_uri, "400", "Bad Request",
-                    "Request URI does not lead with \"http://\".");
-        printf("Rejected URI %s\n", request_uri);
-        return;
-    }
-    /* check if http version is HTTP/1.0 or HTTP/1.1 */
-    if (strcmp(version, "HTTP/1.0") && strcmp(version, "HTTP/1.1")) {
-        clienterror(fd, version, "501", "Not Implemented",
-                    "This HTTP version is not supported.");
-        printf("Rejected version %s\n", version);
+    do {
+        clientlen = sizeof(clientaddr);
+        connfd = accept(listenfd, (SA *)&clientaddr, &clientlen);
+    } while (connfd < 0 && (errno == EINTR || errno == ECONNABORTED));
+    if (connfd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            unix_error_non_exit("accept error");
+        }
+        return -1;
     }
-    /* parse the hostname, port and uri from request_uri */
-    parse_uri(request_uri, hostname, port, uri);
 
-    /* using getaddrinfo to get the validity of hostname and port */
-    struct addrinfo hints, *listp;
-    memset(&hints, 0, sizeof(struct addrinfo));
-    hints.ai_socktype = SOCK_STREAM;  /* Open a connection */
-    hints.ai_flags = AI_NUMERICSERV;  /* ... using a numeric port arg. */
-    hints.ai_flags |= AI_ADDRCONFIG;  /* Recommended for connections */
-    int rc;
-    if ((rc = getaddrinfo(hostname, port, &hints, &listp)) != 0) {
-        /* if something's wrong with getaddrinfo, the request is bad. */
-        Freeaddrinfo(listp);
-        char cause[MAXLINE];
-        snprintf(cause, MAXLINE, "hostname: %s, port: %s", hostname, port);
-        clienterror(fd, cause, "400", "Bad Request",
-                    "Malformed hostname or port number.");
-        gai_error_non_exit(rc, "Getaddrinfo error");
-	    if (close(fd) < 0){
+    /* numeric only, a reverse lookup here would stall every accept */
+    if ((rc = getnameinfo((SA *) &clientaddr, clientlen, hostname,
+                    MAXLINE, port, MAXLINE,
+                    NI_NUMERICHOST | NI_NUMERICSERV)) != 0) {
+        gai_error_non_exit(rc, "getnameinfo error");
+        if (close(connfd) < 0)  {
             fprintf(stderr, "close failure\n");
         }
-        return;
+        return -1;
     }
+    printf("Accepted from %s:%s\n", hostname, port);
+    return connfd;
+}
 
-    /* construct the proxy_info struct and call serve_proxy to serve page */
-    ProxyInfo proxy_info;
-    proxy_info.fd = fd;
-    proxy_info.hostname = hostname;
-    proxy_info.port = port;
-    proxy_info.uri = uri;
-    proxy_info.p_server_rio = &server_rio;
-
-	serve_proxy(&proxy_info);
+/*
+ * parse_size - parse a byte count with an optional k, m or g suffix,
+ *      of 1024 bytes and its powers, into size.
+ *      Returns 0 on success, -1 if it is not one.
+ */
+int parse_size(const char *s, size_t *size) {
+    unsigned long long n;
+    char *end;
 
-    /* close the proxy fd */
-	if (close(fd) < 0){
-        fprintf(stderr, "close failure\n");
+    if (!isdigit((unsigned char) *s)) {
+        return -1;
     }
+    errno = 0;
+    n = strtoull(s, &end, 10);
+    switch (tolower((unsigned char) *end)) {
+    case 'g':
+        n = n > (SIZE_MAX >> 30) ? SIZE_MAX : n << 30;
+        end++;
+        break;
+    case 'm':
+        n = n > (SIZE_MAX >> 20) ? SIZE_MAX : n << 20;
+        end++;
+        break;
+    case 'k':
+        n = n > (SIZE_MAX >> 10) ? SIZE_MAX : n << 10;
+        end++;
+        break;
+    }
+    if (errno || *end != '\0' || n == 0 || n >= SIZE_MAX) {
+        return -1;
+    }
+    *size = n;
+    return 0;
 }
 
 /*
- * clienterror - respond with an error message
- *      to the client identified by fd
+ * report_stats - append the metrics of every proxy component
  */
-void clienterror(int fd, char *cause, char *errnum, 
-		 char *shortmsg, char *longmsg) 
-{
-    char buf[MAXLINE], body[MAXBUF];
-
-    /* Build the HTTP response body */
-    snprintf(body, MAXBUF, "<html><title>Proxy Error</title>");
-    snprintf(body, MAXBUF, "%s<body bgcolor=""ffffff"">\r\n", body);
-    snprintf(body, MAXBUF, "%s%s: %s\r\n", body, errnum, shortmsg);
-    snprintf(body, MAXBUF, "%s<p>%s: %s\r\n", body, longmsg, cause);
-    snprintf(body, MAXBUF, "%s<hr><em>The Proxy Server</em>\r\n", body);
-
-    /* Print the HTTP response */
-    snprintf(buf, MAXBUF, "HTTP/1.0 %s %s\r\n", errnum, shortmsg);
-    proxy_rio_writen(fd, buf, strlen(buf));
-    snprintf(buf, MAXBUF, "Content-type: text/html\r\n");
-    proxy_rio_writen(fd, buf, strlen(buf));
-    snprintf(buf, MAXBUF, "Content-length: %d\r\n\r\n", (int)strlen(body));
-    proxy_rio_writen(fd, buf, strlen(buf));
-    proxy_rio_writen(fd, body, strlen(body));
+void report_stats(Buffer *b) {
+    pool_stats(b);
+    cache_stats(b);
+    slab_stats(b);
+    pressure_stats(b);
+    upstream_stats(b);
+    dns_stats(b);
 }
 
 /* 
@@ -448,85 +340,13 @@ void posix_error_non_exit(int code, char *msg) {
 }
 
 /*
- * proxy_rio_readnb -
- *      rio_readnb wrapper.
- *      On failure, if errno is set to ECONNRESET, log the error.
- *      otherwise, exit the program with an error message.
- */
-ssize_t proxy_rio_readnb(rio_t *rp, void *usrbuf, size_t n) {
-    ssize_t rc;
-
-    if ((rc = rio_readnb(rp, usrbuf, n)) < 0) {
-        if (errno == ECONNRESET) {
-            unix_error_non_exit("proxy_rio_readnb error");
-        }
-        else {
-	        internal_server_error(rp -> rio_fd);
-        }
-    }
-    return rc;
-}
-
-/*
- * proxy_rio_readlineb -
- *      rio_readlineb wrapper.
- *      On failure, if errno is set to ECONNRESET, log the error.
- *      otherwise, exit the program with an error message.
+ * set_nonblocking - put the descriptor into non-blocking mode.
+ *      Returns 0 on success, -1 on failure.
  */
-ssize_t proxy_rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen) {
-    ssize_t rc;
-
-    if ((rc = rio_readlineb(rp, usrbuf, maxlen)) < 0) {
-        if (errno == ECONNRESET) {
-            unix_error_non_exit("proxy_rio_readnb error");
-        }
-        else {
-	        internal_server_error(rp -> rio_fd);
-        }
-    }
-    return rc;
-} 
-
-/*
- * proxy_rio_writen -
- *      rio_writen wrapper.
- *      On failure, if errno is set to ECONNRESET or EPIPE, log the error.
- *      otherwise, exit the program with an error message.
- */
-int proxy_rio_writen(int fd, void *usrbuf, size_t n) {
-    if (rio_writen(fd, usrbuf, n) != n) {
-        if (errno == EPIPE || errno == ECONNRESET) {
-            unix_error_non_exit("proxy_rio_writen error");
-        }
-        else {
-	        unix_error("proxy_rio_writen error");
-        }
+int set_nonblocking(int fd) {
+    int flags;
+    if ((flags = fcntl(fd, F_GETFL)) < 0) {
         return -1;
     }
-    return n;
+    return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
 }
-
-/*
- * internal_server_error -
- *      respond the client with an internal server error message.
- */
-void internal_server_error(int fd) {
-    clienterror(fd, "", "500", "Internal Server Error",
-                "The proxy server encountered a problem");
-}
-
-/*
- * handle_request_thread - the thread function
- */
-void *handle_request_thread(void *p_fd) {
-    /* change the thread into detached state */
-    /* if thread cannot detatch or identify self,
-     * cannot proceed with normal workflow.
-     * exit with failure message. */
-    Pthread_detach(Pthread_self());
-    /* call  */
-    doit(*((int *) p_fd));
-    free(p_fd);
-    return NULL;
-}
-
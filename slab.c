@@ -0,0 +1,297 @@
+/*
+ * slab.c - the slab allocator of the cache
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * The cache stores objects of any size up to its object limit, and
+ * allocating each of them with malloc leaves the heap fragmented over
+ * time in ways the cache cannot see or account for. Instead, the memory
+ * of the cache is carved out of pages, each of which holds the chunks of
+ * a single size class. The pages are SLAB_PAGE_SIZE bytes, or the next
+ * power of 2 large enough for the largest chunk the cache asks for, a
+ * segment of a large object (see cache.c). The classes grow by
+ * SLAB_GROWTH, so an object wastes less than a quarter of its chunk, and
+ * every chunk of a class is alike, so a freed one is reused as is.
+ *
+ * A page which has no chunk handed out anymore leaves its class: a few
+ * are kept in a pool for whichever class runs out of room next, the rest
+ * go back to the system. So as the mix of object sizes shifts, the pages
+ * move from the classes which shrink to the ones which grow. How much
+ * of the pages is actually asked for is reported as the fragmentation,
+ * inside the chunks and in the unused part of the pages.
+ *
+ * One lock guards the allocator. It is only taken by the writers of the
+ * cache and held for a few pointer updates.
+ */
+#include "csapp.h"
+#include "slab.h"
+#include "proxylib.h"
+
+/* the bytes of a page before its first chunk */
+#define SLAB_HEADER ((sizeof(SlabPage) + 63) & ~(size_t) 63)
+
+static SlabClass classes[SLAB_MAX_CLASSES];     /* by chunk size */
+static int class_count = 0;
+static sem_t mutex;                             /* protects it all */
+static size_t page_size = SLAB_PAGE_SIZE;      /* bytes of a page */
+static SlabPage *pool = NULL;                   /* free pages */
+static size_t pool_count = 0;                   /* pages in the pool */
+static size_t page_count = 0;                   /* pages allocated */
+static unsigned long reassigned = 0;            /* pages moved between
+                                                   classes */
+
+/* function declarations */
+static SlabClass *slab_class(size_t size);
+static SlabPage *page_get(SlabClass *cls);
+static void page_put(SlabPage *page);
+static void partial_push(SlabClass *cls, SlabPage *page);
+static void partial_unlink(SlabClass *cls, SlabPage *page);
+
+/*
+ * slab_init - set up the size classes for chunks of up to max_size
+ *      bytes.
+ *      Returns 0 on success, -1 on failure.
+ */
+int slab_init(size_t max_size) {
+    size_t size = SLAB_MIN_CHUNK;
+
+    while (max_size > page_size - SLAB_HEADER) {
+        if (page_size == SLAB_MAX_PAGE_SIZE) {
+            fprintf(stderr, "slab pages cannot hold %zu bytes\n", max_size);
+            return -1;
+        }
+        page_size <<= 1;
+    }
+    Sem_init(&mutex, 0, 1);
+    for (;;) {
+        if (size >= max_size || class_count == SLAB_MAX_CLASSES - 1) {
+            /* the last class holds the largest chunks */
+            size = (max_size + 15) & ~(size_t) 15;
+        }
+        classes[class_count].size = size;
+        classes[class_count].per_page =
+            (page_size - SLAB_HEADER) / size;
+        class_count++;
+        if (size >= max_size) {
+            return 0;
+        }
+        size = ((size_t) (size * SLAB_GROWTH) + 15) & ~(size_t) 15;
+    }
+}
+
+/*
+ * slab_alloc - allocate a chunk for size bytes.
+ *      Returns the chunk, NULL if it is too large or out of memory.
+ */
+void *slab_alloc(size_t size) {
+    SlabClass *cls;
+    SlabPage *page;
+    void *p;
+
+    if ((cls = slab_class(size)) == NULL) {
+        return NULL;
+    }
+    P(&mutex);
+    if ((page = cls -> partial) == NULL &&
+            (page = page_get(cls)) == NULL) {
+        V(&mutex);
+        return NULL;
+    }
+    if ((p = page -> free) != NULL) {
+        page -> free = *(void **) p;
+    }
+    else {
+        /* a fresh page is carved as it is used */
+        p = (char *) page + page -> carved;
+        page -> carved += cls -> size;
+    }
+    if (++page -> used == cls -> per_page) {
+        partial_unlink(cls, page);
+    }
+    cls -> chunks++;
+    cls -> requested += size;
+    V(&mutex);
+    return p;
+}
+
+/*
+ * slab_free - free the chunk p, which was allocated for size bytes
+ */
+void slab_free(void *p, size_t size) {
+    SlabPage *page = (SlabPage *) ((uintptr_t) p &
+            ~(uintptr_t) (page_size - 1));
+    SlabClass *cls;
+
+    if (p == NULL) {
+        return;
+    }
+    cls = page -> cls;
+    P(&mutex);
+    *(void **) p = page -> free;
+    page -> free = p;
+    if (page -> used-- == cls -> per_page) {
+        partial_push(cls, page);
+    }
+    cls -> chunks--;
+    cls -> requested -= size;
+    if (page -> used == 0) {
+        /* the page is free for any class */
+        partial_unlink(cls, page);
+        page_put(page);
+    }
+    V(&mutex);
+}
+
+/*
+ * slab_size - the bytes a chunk for size bytes takes, 0 if too large
+ */
+size_t slab_size(size_t size) {
+    SlabClass *cls = slab_class(size);
+
+    return cls ? cls -> size : 0;
+}
+
+/*
+ * slab_footprint - the bytes of all the pages, in a class or pooled
+ */
+size_t slab_footprint(void) {
+    size_t bytes;
+
+    P(&mutex);
+    bytes = page_count * page_size;
+    V(&mutex);
+    return bytes;
+}
+
+/*
+ * slab_stats - append the allocator metrics
+ */
+void slab_stats(Buffer *b) {
+    size_t used_pages = 0, chunk_bytes = 0, requested = 0;
+    int i;
+
+    P(&mutex);
+    for (i = 0; i < class_count; i++) {
+        SlabClass *cls = &classes[i];
+        used_pages += cls -> pages;
+        chunk_bytes += cls -> chunks * cls -> size;
+        requested += cls -> requested;
+    }
+    buffer_printf(b, "slab_page_size %zu\n", page_size);
+    buffer_printf(b, "slab_classes %d\n", class_count);
+    buffer_printf(b, "slab_pages %zu\n", page_count);
+    buffer_printf(b, "slab_pool_pages %zu\n", pool_count);
+    buffer_printf(b, "slab_reassigned %lu\n", reassigned);
+    buffer_printf(b, "slab_chunk_bytes %zu\n", chunk_bytes);
+    buffer_printf(b, "slab_requested_bytes %zu\n", requested);
+    /* wasted inside the chunks, and in the pages around them */
+    buffer_printf(b, "slab_internal_fragmentation %zu\n",
+            chunk_bytes - requested);
+    buffer_printf(b, "slab_external_fragmentation %zu\n",
+            used_pages * page_size - chunk_bytes);
+    for (i = 0; i < class_count; i++) {
+        SlabClass *cls = &classes[i];
+        if (cls -> pages) {
+            buffer_printf(b, "slab_class_%zu_pages %zu\n", cls -> size,
+                    cls -> pages);
+            buffer_printf(b, "slab_class_%zu_chunks %zu\n", cls -> size,
+                    cls -> chunks);
+        }
+    }
+    V(&mutex);
+}
+
+/*
+ * slab_class - the smallest class with chunks of at least size bytes,
+ *      NULL if there is none
+ */
+static SlabClass *slab_class(size_t size) {
+    int lo = 0, hi = class_count;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (classes[mid].size < size) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo < class_count ? &classes[lo] : NULL;
+}
+
+/*
+ * page_get - give cls a page, from the pool if it has one.
+ *      Returns the page, NULL if malloc failed.
+ */
+static SlabPage *page_get(SlabClass *cls) {
+    SlabPage *page;
+
+    if ((page = pool) != NULL) {
+        pool = (SlabPage *) page -> free;
+        pool_count--;
+        if (page -> cls != cls) {
+            reassigned++;
+        }
+    }
+    else if ((page = (SlabPage *) aligned_alloc(page_size,
+                    page_size)) == NULL) {
+        unix_error_non_exit("malloc for slab error");
+        return NULL;
+    }
+    else {
+        page_count++;
+    }
+    page -> cls = cls;
+    page -> free = NULL;
+    page -> carved = SLAB_HEADER;
+    page -> used = 0;
+    cls -> pages++;
+    partial_push(cls, page);
+    return page;
+}
+
+/*
+ * page_put - take an empty page from its class, into the pool if it
+ *      has room, back to the system if not
+ */
+static void page_put(SlabPage *page) {
+    page -> cls -> pages--;
+    if (pool_count < SLAB_POOL_PAGES) {
+        /* the class stays noted, to tell when the page moves */
+        page -> free = pool;
+        pool = page;
+        pool_count++;
+        return;
+    }
+    free(page);
+    page_count--;
+}
+
+/*
+ * partial_push - page of cls has a free chunk again
+ */
+static void partial_push(SlabClass *cls, SlabPage *page) {
+    page -> prev = NULL;
+    page -> next = cls -> partial;
+    if (cls -> partial) {
+        cls -> partial -> prev = page;
+    }
+    cls -> partial = page;
+}
+
+/*
+ * partial_unlink - page of cls has no free chunk, or left the class
+ */
+static void partial_unlink(SlabClass *cls, SlabPage *page) {
+    if (page -> prev) {
+        page -> prev -> next = page -> next;
+    }
+    else {
+        cls -> partial = page -> next;
+    }
+    if (page -> next) {
+        page -> next -> prev = page -> prev;
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ * slab.h - declarations for the slab allocator of the cache
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ */
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <semaphore.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "buffer.h"
+
+#define SLAB_PAGE_SIZE (128 * 1024) /* bytes of a page at least, a power
+                                       of 2 */
+#define SLAB_MAX_PAGE_SIZE (64 * 1024 * 1024)  /* and at most */
+#define SLAB_MIN_CHUNK 64           /* the smallest size class */
+#define SLAB_GROWTH 1.25            /* ratio of two size classes */
+#define SLAB_MAX_CLASSES 48
+#define SLAB_POOL_PAGES 4           /* free pages kept for any class */
+
+typedef struct slab_class_type SlabClass;
+
+/* a page of chunks of one size class, its header at its start. Pages
+ * are aligned to their size, so the page of a chunk is found from its
+ * address */
+typedef struct slab_page_type {
+    SlabClass *cls;                     /* the class it is carved for */
+    void *free;                         /* its free chunks */
+    size_t carved;                      /* offset of the uncarved rest */
+    size_t used;                        /* chunks handed out */
+    struct slab_page_type *next;        /* the pages with free chunks */
+    struct slab_page_type *prev;
+} SlabPage;
+
+/* the chunks of one size */
+struct slab_class_type {
+    size_t size;                        /* bytes of a chunk */
+    size_t per_page;                    /* chunks a page holds */
+    SlabPage *partial;                  /* pages with free chunks */
+    size_t pages;                       /* pages of the class */
+    size_t chunks;                      /* chunks handed out */
+    size_t requested;                   /* bytes asked for in them */
+};
+
+int slab_init(size_t max_size);
+void *slab_alloc(size_t size);
+void slab_free(void *p, size_t size);
+size_t slab_size(size_t size);
+size_t slab_footprint(void);
+void slab_stats(Buffer *b);
+
+#endif /* __SLAB_H__ */
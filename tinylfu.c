@@ -0,0 +1,191 @@
+/*
+ * tinylfu.c - the TinyLFU frequency sketch
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * Counts how often keys were asked for lately, in constant space, so
+ * the cache can tell whether a new object is worth more than the ones
+ * it would evict. A count-min sketch holds TINYLFU_DEPTH small counters
+ * per key, each in a row of its own, and the estimate is the smallest
+ * of them; an access only raises the counters at that minimum, which
+ * keeps the others from drifting up through collisions.
+ *
+ * Most keys are only seen once, so a doorkeeper takes the first access
+ * of a key, and only the later ones reach the counters. It is a bloom
+ * filter setting TINYLFU_DOOR_BITS bits per key, each found by a hash
+ * of its own, so a new key only passes for one seen before if other
+ * keys set all of its bits. Once TINYLFU_SAMPLE accesses per counter
+ * were counted, the sketch ages: every counter is halved and the
+ * doorkeeper cleared, so the counts follow what is popular now rather
+ * than ever.
+ */
+#include "csapp.h"
+#include "tinylfu.h"
+#include "proxylib.h"
+
+/* odd multipliers spreading the hash over the rows */
+static const uint64_t seeds[TINYLFU_DEPTH] = {
+    0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL,
+    0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL,
+};
+
+/* and over the doorkeeper bits */
+static const uint64_t door_seeds[TINYLFU_DOOR_BITS] = {
+    0xff51afd7ed558ccdULL, 0xc4ceb9fe1a85ec53ULL,
+};
+
+/* function declarations */
+static size_t tinylfu_index(TinyLfu *t, uint64_t hash, int row);
+static size_t door_bit(TinyLfu *t, uint64_t hash, int i);
+static int door_seen(TinyLfu *t, uint64_t hash);
+static void door_set(TinyLfu *t, uint64_t hash);
+
+/*
+ * tinylfu_init - initialize an empty sketch of width counters per row.
+ *      Returns 0 on success, -1 on failure.
+ */
+int tinylfu_init(TinyLfu *t, size_t width) {
+    size_t i;
+
+    t -> width = width;
+    atomic_init(&t -> additions, 0);
+    if ((t -> counters = (atomic_uchar *) malloc(TINYLFU_DEPTH * width *
+                    sizeof(atomic_uchar))) == NULL ||
+            (t -> doorkeeper = (atomic_ulong *) malloc((width + 63) / 64 *
+                    sizeof(atomic_ulong))) == NULL) {
+        unix_error_non_exit("malloc for sketch error");
+        return -1;
+    }
+    for (i = 0; i < TINYLFU_DEPTH * width; i++) {
+        atomic_init(&t -> counters[i], 0);
+    }
+    for (i = 0; i < (width + 63) / 64; i++) {
+        atomic_init(&t -> doorkeeper[i], 0);
+    }
+    return 0;
+}
+
+/*
+ * tinylfu_record - count an access to the key of hash
+ */
+void tinylfu_record(TinyLfu *t, uint64_t hash) {
+    int row, min = TINYLFU_MAX;
+
+    atomic_fetch_add_explicit(&t -> additions, 1, memory_order_relaxed);
+    if (!door_seen(t, hash)) {
+        /* the first access only passes the doorkeeper */
+        door_set(t, hash);
+        return;
+    }
+    for (row = 0; row < TINYLFU_DEPTH; row++) {
+        int c = atomic_load_explicit(&t -> counters[row * t -> width +
+                tinylfu_index(t, hash, row)], memory_order_relaxed);
+        min = c < min ? c : min;
+    }
+    if (min == TINYLFU_MAX) {
+        return;
+    }
+    /* raise only the counters at the minimum */
+    for (row = 0; row < TINYLFU_DEPTH; row++) {
+        atomic_uchar *c = &t -> counters[row * t -> width +
+            tinylfu_index(t, hash, row)];
+        if (atomic_load_explicit(c, memory_order_relaxed) == min) {
+            atomic_store_explicit(c, min + 1, memory_order_relaxed);
+        }
+    }
+}
+
+/*
+ * tinylfu_estimate - about how often the key of hash was accessed lately
+ */
+int tinylfu_estimate(TinyLfu *t, uint64_t hash) {
+    int row, min = TINYLFU_MAX;
+
+    for (row = 0; row < TINYLFU_DEPTH; row++) {
+        int c = atomic_load_explicit(&t -> counters[row * t -> width +
+                tinylfu_index(t, hash, row)], memory_order_relaxed);
+        min = c < min ? c : min;
+    }
+    if (door_seen(t, hash)) {
+        min++;
+    }
+    return min;
+}
+
+/*
+ * tinylfu_age - halve the counts if enough accesses were counted since
+ *      they were last halved. Called by one thread at a time.
+ *      Returns 1 if it aged the sketch, 0 if not.
+ */
+int tinylfu_age(TinyLfu *t) {
+    size_t i;
+
+    if (atomic_load_explicit(&t -> additions, memory_order_relaxed) <
+            TINYLFU_SAMPLE * t -> width) {
+        return 0;
+    }
+    for (i = 0; i < TINYLFU_DEPTH * t -> width; i++) {
+        atomic_store_explicit(&t -> counters[i], atomic_load_explicit(
+                    &t -> counters[i], memory_order_relaxed) >> 1,
+                memory_order_relaxed);
+    }
+    for (i = 0; i < (t -> width + 63) / 64; i++) {
+        atomic_store_explicit(&t -> doorkeeper[i], 0, memory_order_relaxed);
+    }
+    atomic_store_explicit(&t -> additions, 0, memory_order_relaxed);
+    return 1;
+}
+
+/*
+ * tinylfu_bytes - the bytes the counters and doorkeeper of t take
+ */
+size_t tinylfu_bytes(TinyLfu *t) {
+    return TINYLFU_DEPTH * t -> width * sizeof(atomic_uchar) +
+        (t -> width + 63) / 64 * sizeof(atomic_ulong);
+}
+
+/*
+ * tinylfu_index - the counter of the key of hash in row
+ */
+static size_t tinylfu_index(TinyLfu *t, uint64_t hash, int row) {
+    return ((hash * seeds[row]) >> 32) & (t -> width - 1);
+}
+
+/*
+ * door_bit - the doorkeeper bit i of the key of hash
+ */
+static size_t door_bit(TinyLfu *t, uint64_t hash, int i) {
+    return ((hash * door_seeds[i]) >> 32) & (t -> width - 1);
+}
+
+/*
+ * door_seen - whether all the doorkeeper bits of the key of hash are set
+ */
+static int door_seen(TinyLfu *t, uint64_t hash) {
+    size_t bit;
+    int i;
+
+    for (i = 0; i < TINYLFU_DOOR_BITS; i++) {
+        bit = door_bit(t, hash, i);
+        if (!(atomic_load_explicit(&t -> doorkeeper[bit / 64],
+                        memory_order_relaxed) & (1UL << (bit % 64)))) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * door_set - set the doorkeeper bits of the key of hash
+ */
+static void door_set(TinyLfu *t, uint64_t hash) {
+    size_t bit;
+    int i;
+
+    for (i = 0; i < TINYLFU_DOOR_BITS; i++) {
+        bit = door_bit(t, hash, i);
+        atomic_fetch_or_explicit(&t -> doorkeeper[bit / 64],
+                1UL << (bit % 64), memory_order_relaxed);
+    }
+}
@@ -0,0 +1,36 @@
+/*
+ * tinylfu.h - declarations for the TinyLFU frequency sketch
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ */
+#ifndef __TINYLFU_H__
+#define __TINYLFU_H__
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TINYLFU_DEPTH 4     /* counters per key, one in each row */
+#define TINYLFU_MAX 15      /* counters saturate there */
+#define TINYLFU_SAMPLE 10   /* accesses per counter before aging */
+#define TINYLFU_DOOR_BITS 2 /* doorkeeper bits per key */
+
+/* the approximate access counts of keys, by their 64-bit hash. Written
+ * by misses, and by the batches of hits of the lookups (see cache.c),
+ * without a lock, so an access may be lost in a race */
+typedef struct tinylfu_type {
+    atomic_uchar *counters;         /* TINYLFU_DEPTH rows of width */
+    atomic_ulong *doorkeeper;       /* a bloom filter, a bit per counter
+                                       of a row */
+    size_t width;                   /* counters per row, a power of 2 */
+    atomic_ulong additions;         /* accesses counted since aging */
+} TinyLfu;
+
+int tinylfu_init(TinyLfu *t, size_t width);
+void tinylfu_record(TinyLfu *t, uint64_t hash);
+int tinylfu_estimate(TinyLfu *t, uint64_t hash);
+int tinylfu_age(TinyLfu *t);
+size_t tinylfu_bytes(TinyLfu *t);
+
+#endif /* __TINYLFU_H__ */
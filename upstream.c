@@ -0,0 +1,209 @@
+/*
+ * upstream.c - the pool of idle origin connections
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * Once a response is read to its end and the origin keeps the connection
+ * open, the connection is parked here under its "host:port" instead of
+ * being closed, and the next miss for that origin skips the handshake.
+ *
+ * Every worker keeps a pool of its own, so the descriptors never change
+ * threads and no lock is needed; only the counters are shared. An origin
+ * keeps at most UPSTREAM_MAX_IDLE idle connections, the oldest giving
+ * way to a new one, and connections idle for more than
+ * UPSTREAM_IDLE_TIMEOUT seconds are closed, checked at most once a second
+ * whenever the pool is used.
+ *
+ * An idle connection is not watched, so the origin may have closed it in
+ * the meantime. Closed connections are mostly caught by peeking before a
+ * connection is handed out; the rest fail before the first response byte
+ * and the request is retried on a fresh connection (upstream_retried).
+ */
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include "csapp.h"
+#include "upstream.h"
+#include "proxylib.h"
+
+static __thread UpstreamOrigin *origins = NULL; /* this worker's pool */
+static __thread time_t last_sweep = 0;          /* time of the last sweep */
+
+/* counters of all the workers */
+static atomic_ulong reused;     /* misses served on an idle connection */
+static atomic_ulong missed;     /* misses which had to connect */
+static atomic_ulong parked;     /* connections put into the pool */
+static atomic_ulong expired;    /* idle connections timed out or displaced */
+static atomic_ulong stale;      /* idle connections the origin closed */
+static atomic_long idle_count;  /* idle connections right now */
+
+/* function declarations */
+static UpstreamOrigin *find_origin(const char *key, int create);
+static void sweep(time_t now);
+static void drop(UpstreamOrigin *o, int i);
+static int alive(int fd);
+static void close_idle(int fd);
+
+/*
+ * upstream_get - take an idle connection to the origin key, the most
+ *      recently used one as it is the least likely to be closed.
+ *      Returns the descriptor, or -1 if there is none.
+ */
+int upstream_get(const char *key) {
+    UpstreamOrigin *o;
+    int fd;
+
+    sweep(time(NULL));
+    if ((o = find_origin(key, 0)) != NULL) {
+        while (o -> count > 0) {
+            fd = o -> idle[--o -> count].fd;
+            atomic_fetch_sub_explicit(&idle_count, 1, memory_order_relaxed);
+            if (alive(fd)) {
+                atomic_fetch_add_explicit(&reused, 1, memory_order_relaxed);
+                return fd;
+            }
+            atomic_fetch_add_explicit(&stale, 1, memory_order_relaxed);
+            close_idle(fd);
+        }
+    }
+    atomic_fetch_add_explicit(&missed, 1, memory_order_relaxed);
+    return -1;
+}
+
+/*
+ * upstream_put - park fd, whose last response was read to its end,
+ *      as an idle connection to the origin key
+ */
+void upstream_put(const char *key, int fd) {
+    UpstreamOrigin *o;
+    time_t now = time(NULL);
+
+    sweep(now);
+    if ((o = find_origin(key, 1)) == NULL) {
+        close_idle(fd);
+        return;
+    }
+    if (o -> count == UPSTREAM_MAX_IDLE) {
+        /* make room by dropping the oldest */
+        atomic_fetch_add_explicit(&expired, 1, memory_order_relaxed);
+        drop(o, 0);
+    }
+    o -> idle[o -> count].fd = fd;
+    o -> idle[o -> count].since = now;
+    o -> count++;
+    atomic_fetch_add_explicit(&parked, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&idle_count, 1, memory_order_relaxed);
+}
+
+/*
+ * upstream_retried - an idle connection handed out turned out to be
+ *      closed by the origin, so the request was sent again
+ */
+void upstream_retried(void) {
+    atomic_fetch_add_explicit(&stale, 1, memory_order_relaxed);
+}
+
+/*
+ * upstream_stats - append the pool metrics
+ */
+void upstream_stats(Buffer *b) {
+    buffer_printf(b, "upstream_max_idle_per_origin %d\n", UPSTREAM_MAX_IDLE);
+    buffer_printf(b, "upstream_idle_timeout %d\n", UPSTREAM_IDLE_TIMEOUT);
+    buffer_printf(b, "upstream_idle %ld\n",
+            atomic_load_explicit(&idle_count, memory_order_relaxed));
+    buffer_printf(b, "upstream_reused %lu\n",
+            atomic_load_explicit(&reused, memory_order_relaxed));
+    buffer_printf(b, "upstream_connected %lu\n",
+            atomic_load_explicit(&missed, memory_order_relaxed));
+    buffer_printf(b, "upstream_parked %lu\n",
+            atomic_load_explicit(&parked, memory_order_relaxed));
+    buffer_printf(b, "upstream_expired %lu\n",
+            atomic_load_explicit(&expired, memory_order_relaxed));
+    buffer_printf(b, "upstream_stale %lu\n",
+            atomic_load_explicit(&stale, memory_order_relaxed));
+}
+
+/*
+ * find_origin - find the idle connections of the origin key,
+ *      creating an empty entry if create is set.
+ *      Returns the entry, NULL if there is none or malloc failed.
+ */
+static UpstreamOrigin *find_origin(const char *key, int create) {
+    UpstreamOrigin *o;
+
+    for (o = origins; o; o = o -> next) {
+        if (!strcmp(o -> key, key)) {
+            return o;
+        }
+    }
+    if (!create) {
+        return NULL;
+    }
+    if ((o = (UpstreamOrigin *) calloc(1, sizeof(UpstreamOrigin))) == NULL ||
+            (o -> key = strdup(key)) == NULL) {
+        unix_error_non_exit("malloc for upstream error");
+        free(o);
+        return NULL;
+    }
+    o -> next = origins;
+    origins = o;
+    return o;
+}
+
+/*
+ * sweep - close the connections idle for too long and forget
+ *      the origins left without any, once a second at most
+ */
+static void sweep(time_t now) {
+    UpstreamOrigin **pp, *o;
+
+    if (now == last_sweep) {
+        return;
+    }
+    last_sweep = now;
+    for (pp = &origins; (o = *pp) != NULL; ) {
+        /* the oldest are in front */
+        while (o -> count > 0 &&
+                now - o -> idle[0].since > UPSTREAM_IDLE_TIMEOUT) {
+            atomic_fetch_add_explicit(&expired, 1, memory_order_relaxed);
+            drop(o, 0);
+        }
+        if (o -> count == 0) {
+            *pp = o -> next;
+            free(o -> key);
+            free(o);
+            continue;
+        }
+        pp = &o -> next;
+    }
+}
+
+/*
+ * drop - close the i-th idle connection of o
+ */
+static void drop(UpstreamOrigin *o, int i) {
+    close_idle(o -> idle[i].fd);
+    memmove(&o -> idle[i], &o -> idle[i + 1],
+            (o -> count - i - 1) * sizeof(UpstreamIdle));
+    o -> count--;
+    atomic_fetch_sub_explicit(&idle_count, 1, memory_order_relaxed);
+}
+
+/*
+ * alive - whether the origin still keeps the idle connection fd open:
+ *      nothing may be waiting on it, not even the end of the stream
+ */
+static int alive(int fd) {
+    char c;
+    ssize_t n = recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+    return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+/*
+ * close_idle - close an idle connection which is not needed anymore
+ */
+static void close_idle(int fd) {
+    if (close(fd) < 0) {
+        fprintf(stderr, "close failure\n");
+    }
+}
@@ -0,0 +1,35 @@
+/*
+ * upstream.h - declarations for the pool of idle origin connections
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ */
+#ifndef __UPSTREAM_H__
+#define __UPSTREAM_H__
+
+#include <time.h>
+#include "buffer.h"
+
+#define UPSTREAM_MAX_IDLE 8         /* idle connections kept per origin */
+#define UPSTREAM_IDLE_TIMEOUT 30    /* seconds an idle connection is kept */
+
+/* an idle connection to an origin */
+typedef struct upstream_idle_type {
+    int fd;                 /* the connected descriptor */
+    time_t since;           /* when it became idle */
+} UpstreamIdle;
+
+/* the idle connections of one origin, oldest first */
+typedef struct upstream_origin_type {
+    char *key;                              /* "host:port" */
+    UpstreamIdle idle[UPSTREAM_MAX_IDLE];
+    int count;                              /* idle connections in use */
+    struct upstream_origin_type *next;
+} UpstreamOrigin;
+
+int upstream_get(const char *key);
+void upstream_put(const char *key, int fd);
+void upstream_retried(void);
+void upstream_stats(Buffer *b);
+
+#endif /* __UPSTREAM_H__ */
@@ -0,0 +1,347 @@
+/*
+ * uring.c - the io_uring completion loop
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ *
+ * A thin layer over the raw io_uring system calls. Operations are
+ * prepared into the submission queue and only handed to the kernel by
+ * the io_uring_enter which also waits for the next completions, so all
+ * the I/O started while handling one batch of completions costs a
+ * single system call.
+ *
+ * Receives do not name a buffer. They pick one from a ring of provided
+ * buffers registered with the kernel when data actually arrives, so an
+ * idle connection does not pin a buffer of its own. The completion
+ * flags carry the buffer id, and the buffer goes back to the ring with
+ * uring_recycle once its bytes are consumed.
+ *
+ * Every operation is a UringOp whose address is the user data of its
+ * submission, so a completion leads straight to its callback.
+ */
+#include <sys/syscall.h>
+#include "csapp.h"
+#include "proxylib.h"
+#include "uring.h"
+
+/* function declarations */
+static struct io_uring_sqe *uring_sqe(Uring *r, UringOp *op);
+static int uring_enter(Uring *r, unsigned min_complete);
+static int uring_init_buffers(Uring *r);
+
+/*
+ * uring_init - set up the rings and the provided buffers.
+ *      Returns 0 on success, -1 on failure.
+ */
+int uring_init(Uring *r) {
+    struct io_uring_params p;
+
+    memset(r, 0, sizeof(Uring));
+    memset(&p, 0, sizeof(p));
+    if ((r -> fd = (int) syscall(__NR_io_uring_setup,
+                    URING_ENTRIES, &p)) < 0) {
+        unix_error_non_exit("io_uring_setup error");
+        return -1;
+    }
+
+    /* map the submission and completion rings */
+    r -> sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r -> cq_ring_size = p.cq_off.cqes +
+        p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        /* both rings share one mapping */
+        if (r -> cq_ring_size > r -> sq_ring_size) {
+            r -> sq_ring_size = r -> cq_ring_size;
+        }
+        r -> cq_ring_size = r -> sq_ring_size;
+    }
+    r -> sq_ring = mmap(NULL, r -> sq_ring_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, r -> fd, IORING_OFF_SQ_RING);
+    if (r -> sq_ring == MAP_FAILED) {
+        unix_error_non_exit("io_uring mmap error");
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r -> cq_ring = r -> sq_ring;
+    }
+    else {
+        r -> cq_ring = mmap(NULL, r -> cq_ring_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, r -> fd, IORING_OFF_CQ_RING);
+        if (r -> cq_ring == MAP_FAILED) {
+            unix_error_non_exit("io_uring mmap error");
+            return -1;
+        }
+    }
+    r -> sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    r -> sqes = mmap(NULL, r -> sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, r -> fd, IORING_OFF_SQES);
+    if (r -> sqes == MAP_FAILED) {
+        unix_error_non_exit("io_uring mmap error");
+        return -1;
+    }
+
+    char *sq = (char *) r -> sq_ring;
+    char *cq = (char *) r -> cq_ring;
+    r -> sq_head = (unsigned *) (sq + p.sq_off.head);
+    r -> sq_tail = (unsigned *) (sq + p.sq_off.tail);
+    r -> sq_mask = (unsigned *) (sq + p.sq_off.ring_mask);
+    r -> sq_array = (unsigned *) (sq + p.sq_off.array);
+    r -> sq_entries = p.sq_entries;
+    r -> sq_local_tail = *r -> sq_tail;
+    r -> cq_head = (unsigned *) (cq + p.cq_off.head);
+    r -> cq_tail = (unsigned *) (cq + p.cq_off.tail);
+    r -> cq_mask = (unsigned *) (cq + p.cq_off.ring_mask);
+    r -> cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    return uring_init_buffers(r);
+}
+
+/*
+ * uring_init_buffers - register the provided buffer ring and fill it.
+ *      Returns 0 on success, -1 on failure.
+ */
+static int uring_init_buffers(Uring *r) {
+    struct io_uring_buf_reg reg;
+    uint32_t i;
+
+    /* the ring itself must be page aligned */
+    if (posix_memalign((void **) &r -> buf_ring, sysconf(_SC_PAGESIZE),
+                URING_BUFFERS * sizeof(struct io_uring_buf)) != 0 ||
+            (r -> bufs = (char *) malloc(
+                (size_t) URING_BUFFERS * URING_BUFFER_SIZE)) == NULL) {
+        unix_error_non_exit("malloc for io_uring buffers error");
+        return -1;
+    }
+    memset(r -> buf_ring, 0, URING_BUFFERS * sizeof(struct io_uring_buf));
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) (uintptr_t) r -> buf_ring;
+    reg.ring_entries = URING_BUFFERS;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, r -> fd,
+                IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        unix_error_non_exit("io_uring_register buffer ring error");
+        return -1;
+    }
+
+    r -> buf_tail = 0;
+    for (i = 0; i < URING_BUFFERS; i++) {
+        uring_recycle(r, (i << IORING_CQE_BUFFER_SHIFT) | IORING_CQE_F_BUFFER);
+    }
+    return 0;
+}
+
+/*
+ * uring_op_init - set up an operation which is not in flight
+ */
+void uring_op_init(UringOp *op, UringCallback callback, void *data) {
+    op -> callback = callback;
+    op -> data = data;
+    op -> busy = 0;
+}
+
+/*
+ * uring_sqe - claim a cleared submission entry for op,
+ *      submitting what is prepared if the queue is full
+ */
+static struct io_uring_sqe *uring_sqe(Uring *r, UringOp *op) {
+    struct io_uring_sqe *sqe;
+    unsigned idx;
+
+    while (r -> sq_local_tail - __atomic_load_n(r -> sq_head,
+                __ATOMIC_ACQUIRE) >= r -> sq_entries) {
+        /* full, let the kernel consume what is queued */
+        uring_enter(r, 0);
+    }
+    idx = r -> sq_local_tail & *r -> sq_mask;
+    sqe = &r -> sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe -> user_data = (uint64_t) (uintptr_t) op;
+    r -> sq_array[idx] = idx;
+    r -> sq_local_tail++;
+    if (op) {
+        op -> busy = 1;
+    }
+    return sqe;
+}
+
+/*
+ * uring_enter - publish the prepared entries and wait for at least
+ *      min_complete completions.
+ *      Returns the number of entries submitted, -1 on failure.
+ */
+static int uring_enter(Uring *r, unsigned min_complete) {
+    /* everything the kernel has not consumed yet, including entries
+     * a failed call left behind */
+    unsigned to_submit = r -> sq_local_tail -
+        __atomic_load_n(r -> sq_head, __ATOMIC_ACQUIRE);
+    int rc;
+
+    __atomic_store_n(r -> sq_tail, r -> sq_local_tail, __ATOMIC_RELEASE);
+    r -> enters++;
+    rc = (int) syscall(__NR_io_uring_enter, r -> fd, to_submit, min_complete,
+            min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (rc < 0) {
+        if (errno != EINTR && errno != EBUSY && errno != EAGAIN) {
+            unix_error_non_exit("io_uring_enter error");
+        }
+        return -1;
+    }
+    r -> submitted += rc;
+    return rc;
+}
+
+/*
+ * uring_run - submit prepared operations, wait for completions and
+ *      dispatch them forever
+ */
+void uring_run(Uring *r) {
+    struct io_uring_cqe *cqe;
+    unsigned head;
+
+    while (1) {
+        uring_enter(r, 1);
+        head = *r -> cq_head;
+        while (head != __atomic_load_n(r -> cq_tail, __ATOMIC_ACQUIRE)) {
+            cqe = &r -> cqes[head & *r -> cq_mask];
+            UringOp *op = (UringOp *) (uintptr_t) cqe -> user_data;
+            int res = cqe -> res;
+            uint32_t flags = cqe -> flags;
+
+            /* free the slot before the callback queues more work */
+            head++;
+            __atomic_store_n(r -> cq_head, head, __ATOMIC_RELEASE);
+            r -> completed++;
+
+            if (op == NULL) {
+                /* completion of a cancellation, nothing to do */
+                continue;
+            }
+            if (!(flags & IORING_CQE_F_MORE)) {
+                /* the last completion of the op */
+                op -> busy = 0;
+            }
+            op -> callback(op, res, flags);
+        }
+    }
+}
+
+/*
+ * uring_prep_accept_multishot - accept connections on listenfd until
+ *      a completion comes without IORING_CQE_F_MORE
+ */
+void uring_prep_accept_multishot(Uring *r, UringOp *op, int listenfd) {
+    struct io_uring_sqe *sqe = uring_sqe(r, op);
+    sqe -> opcode = IORING_OP_ACCEPT;
+    sqe -> fd = listenfd;
+    sqe -> ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe -> accept_flags = SOCK_CLOEXEC;
+}
+
+/*
+ * uring_prep_recv - receive into a provided buffer
+ */
+void uring_prep_recv(Uring *r, UringOp *op, int fd) {
+    struct io_uring_sqe *sqe = uring_sqe(r, op);
+    sqe -> opcode = IORING_OP_RECV;
+    sqe -> fd = fd;
+    sqe -> len = URING_BUFFER_SIZE;
+    sqe -> flags = IOSQE_BUFFER_SELECT;
+    sqe -> buf_group = URING_BUFFER_GROUP;
+}
+
+/*
+ * uring_prep_send - send n bytes of buf, which must stay untouched
+ *      until the completion
+ */
+void uring_prep_send(Uring *r, UringOp *op, int fd,
+        const void *buf, size_t n) {
+    struct io_uring_sqe *sqe = uring_sqe(r, op);
+    sqe -> opcode = IORING_OP_SEND;
+    sqe -> fd = fd;
+    sqe -> addr = (uint64_t) (uintptr_t) buf;
+    sqe -> len = (uint32_t) n;
+    sqe -> msg_flags = MSG_NOSIGNAL;
+}
+
+/*
+ * uring_prep_sendmsg - send the pieces msg points at, which must all
+ *      stay untouched until the completion
+ */
+void uring_prep_sendmsg(Uring *r, UringOp *op, int fd,
+        const struct msghdr *msg) {
+    struct io_uring_sqe *sqe = uring_sqe(r, op);
+    sqe -> opcode = IORING_OP_SENDMSG;
+    sqe -> fd = fd;
+    sqe -> addr = (uint64_t) (uintptr_t) msg;
+    sqe -> len = 1;
+    sqe -> msg_flags = MSG_NOSIGNAL;
+}
+
+/*
+ * uring_prep_connect - connect fd to addr. If link is set, the next
+ *      prepared operation only starts once the connect succeeded,
+ *      and completes with -ECANCELED otherwise.
+ */
+void uring_prep_connect(Uring *r, UringOp *op, int fd,
+        const struct sockaddr *addr, socklen_t addrlen, int link) {
+    struct io_uring_sqe *sqe = uring_sqe(r, op);
+    sqe -> opcode = IORING_OP_CONNECT;
+    sqe -> fd = fd;
+    sqe -> addr = (uint64_t) (uintptr_t) addr;
+    sqe -> off = addrlen;
+    if (link) {
+        sqe -> flags = IOSQE_IO_LINK;
+    }
+}
+
+/*
+ * uring_prep_read - read up to n bytes of a stream into buf
+ */
+void uring_prep_read(Uring *r, UringOp *op, int fd, void *buf, size_t n) {
+    struct io_uring_sqe *sqe = uring_sqe(r, op);
+    sqe -> opcode = IORING_OP_READ;
+    sqe -> fd = fd;
+    sqe -> addr = (uint64_t) (uintptr_t) buf;
+    sqe -> len = (uint32_t) n;
+    sqe -> off = (uint64_t) -1;     /* the current position */
+}
+
+/*
+ * uring_prep_cancel - cancel the in-flight op, which then completes
+ *      with -ECANCELED unless it completes on its own first
+ */
+void uring_prep_cancel(Uring *r, UringOp *op) {
+    struct io_uring_sqe *sqe = uring_sqe(r, NULL);
+    sqe -> opcode = IORING_OP_ASYNC_CANCEL;
+    sqe -> addr = (uint64_t) (uintptr_t) op;
+}
+
+/*
+ * uring_buffer - the provided buffer a recv completion filled
+ */
+char *uring_buffer(Uring *r, uint32_t flags) {
+    uint32_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    return r -> bufs + (size_t) bid * URING_BUFFER_SIZE;
+}
+
+/*
+ * uring_recycle - give the buffer of a recv completion back to the ring
+ */
+void uring_recycle(Uring *r, uint32_t flags) {
+    uint32_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+    struct io_uring_buf *buf;
+
+    if (!(flags & IORING_CQE_F_BUFFER)) {
+        /* the completion did not consume a buffer */
+        return;
+    }
+    buf = &r -> buf_ring -> bufs[r -> buf_tail & (URING_BUFFERS - 1)];
+    buf -> addr = (uint64_t) (uintptr_t) (r -> bufs +
+            (size_t) bid * URING_BUFFER_SIZE);
+    buf -> len = URING_BUFFER_SIZE;
+    buf -> bid = (uint16_t) bid;
+    r -> buf_tail++;
+    /* the kernel may take the buffer as soon as it sees the tail */
+    __atomic_store_n(&r -> buf_ring -> tail, r -> buf_tail, __ATOMIC_RELEASE);
+}
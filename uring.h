@@ -0,0 +1,86 @@
+/*
+ * uring.h - declarations for the io_uring completion loop
+ *
+ * Author: Tian Xin
+ * Andrew ID: txin
+ */
+#ifndef __URING_H__
+#define __URING_H__
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 1024      /* submission queue entries */
+#define URING_BUFFERS 512       /* provided recv buffers, a power of 2 */
+#define URING_BUFFER_SIZE 8192  /* size of each provided buffer */
+#define URING_BUFFER_GROUP 0    /* the provided buffer group id */
+
+typedef struct uring_op_type UringOp;
+typedef void (*UringCallback)(UringOp *op, int res, uint32_t flags);
+
+/* an operation which can be in flight, its address is the user data */
+struct uring_op_type {
+    UringCallback callback; /* called with every completion of the op */
+    void *data;             /* owner of the op */
+    int busy;               /* whether the op is in flight */
+};
+
+/* a ring and the provided buffers of its recv operations */
+typedef struct uring_type {
+    int fd;                         /* the io_uring instance */
+
+    /* submission queue */
+    unsigned *sq_head;              /* consumed by the kernel up to here */
+    unsigned *sq_tail;              /* published to the kernel up to here */
+    unsigned *sq_mask;
+    unsigned *sq_array;             /* indices into sqes */
+    unsigned sq_entries;
+    unsigned sq_local_tail;         /* prepared up to here */
+    struct io_uring_sqe *sqes;
+
+    /* completion queue */
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    /* mappings */
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+
+    /* provided buffer ring */
+    struct io_uring_buf_ring *buf_ring;
+    char *bufs;                     /* URING_BUFFERS buffers back to back */
+    uint16_t buf_tail;              /* refilled up to here */
+
+    /* counters */
+    unsigned long enters;           /* io_uring_enter calls */
+    unsigned long submitted;        /* submission entries */
+    unsigned long completed;        /* completion entries */
+} Uring;
+
+int uring_init(Uring *r);
+void uring_run(Uring *r);
+void uring_op_init(UringOp *op, UringCallback callback, void *data);
+
+/* preparation, submitted with the next io_uring_enter */
+void uring_prep_accept_multishot(Uring *r, UringOp *op, int listenfd);
+void uring_prep_recv(Uring *r, UringOp *op, int fd);
+void uring_prep_send(Uring *r, UringOp *op, int fd,
+        const void *buf, size_t n);
+void uring_prep_sendmsg(Uring *r, UringOp *op, int fd,
+        const struct msghdr *msg);
+void uring_prep_connect(Uring *r, UringOp *op, int fd,
+        const struct sockaddr *addr, socklen_t addrlen, int link);
+void uring_prep_read(Uring *r, UringOp *op, int fd, void *buf, size_t n);
+void uring_prep_cancel(Uring *r, UringOp *op);
+
+/* provided buffers */
+char *uring_buffer(Uring *r, uint32_t flags);
+void uring_recycle(Uring *r, uint32_t flags);
+
+#endif /* __URING_H__ */